@@ -0,0 +1,49 @@
+-- Helpers of bench/run.sh, in their own schema so that the benchmarks of
+-- the modules can drop theirs.
+
+CREATE SCHEMA perf;
+
+-- duration of a statement, in seconds
+CREATE FUNCTION perf.chronometre(requete text)
+RETURNS float8
+LANGUAGE plpgsql
+AS $$
+DECLARE
+  debut timestamptz := clock_timestamp();
+BEGIN
+  EXECUTE requete;
+  RETURN extract(epoch FROM clock_timestamp() - debut);
+END
+$$;
+
+-- reloads the configuration, which starts the archiving, then waits until
+-- the archiver has archived n more segments, in seconds
+CREATE FUNCTION perf.archive(n bigint)
+RETURNS float8
+LANGUAGE plpgsql
+AS $$
+DECLARE
+  debut    timestamptz := clock_timestamp();
+  avant    pg_stat_archiver;
+  archives bigint;
+  echecs   bigint;
+BEGIN
+  -- the counters of the previous runs
+  PERFORM pg_stat_clear_snapshot();
+  SELECT * INTO avant FROM pg_stat_archiver;
+  PERFORM pg_reload_conf();
+  LOOP
+    PERFORM pg_stat_clear_snapshot();
+    SELECT archived_count - avant.archived_count,
+           failed_count - avant.failed_count
+      INTO archives, echecs
+      FROM pg_stat_archiver;
+    EXIT WHEN archives >= n;
+    IF echecs > 0 THEN
+      RAISE EXCEPTION 'archiving failed, see the server log';
+    END IF;
+    PERFORM pg_sleep(0.01);
+  END LOOP;
+  RETURN extract(epoch FROM clock_timestamp() - debut);
+END
+$$;
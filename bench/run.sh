@@ -0,0 +1,250 @@
+#!/bin/sh
+#
+# Performance regression suite of the repository.
+#
+# Starts a temporary instance and measures:
+#   - the archiving throughput of zip_archive, in segments per second, and
+#     the overhead of its AES-256 encryption;
+#   - the decoding throughput of plugin_audit, in changes per second;
+#   - the transactions and expressions per second of a script run by the
+#     client of journee3;
+#   - the cost of a call to each version of incremente, in ns.
+#
+# Each result is compared with its baseline, the median of its last
+# BENCH_BASELINE_RUNS values in the history, then appended to it. The run
+# fails when a result is worse than its baseline by more than
+# BENCH_THRESHOLD percent. A module that is not installed is skipped.
+#
+# Environment: PG_CONFIG, BENCH_THRESHOLD (10), BENCH_HISTORY
+# (bench/history.jsonl), BENCH_BASELINE_RUNS (5), BENCH_PORT (54329),
+# BENCH_SEGMENTS (32), BENCH_ROWS (1000000), BENCH_DURATION (10), or
+# BENCH_DUREE like the bench target of journee1/monextension, BENCH_CLIENT
+# (journee3/client/client, built when missing).
+
+set -e
+
+PG_CONFIG=${PG_CONFIG:-pg_config}
+SEUIL=${BENCH_THRESHOLD:-10}
+HISTORIQUE=${BENCH_HISTORY:-bench/history.jsonl}
+REFERENCES=${BENCH_BASELINE_RUNS:-5}
+PORT=${BENCH_PORT:-54329}
+SEGMENTS=${BENCH_SEGMENTS:-32}
+LIGNES=${BENCH_ROWS:-1000000}
+DUREE=${BENCH_DUREE:-${BENCH_DURATION:-10}}
+
+BINDIR=$($PG_CONFIG --bindir)
+PKGLIBDIR=$($PG_CONFIG --pkglibdir)
+DLSUFFIX=.so
+RACINE=$(cd "$(dirname "$0")/.." && pwd)
+CLIENT=${BENCH_CLIENT:-$RACINE/journee3/client/client}
+
+TEMP=$(mktemp -d)
+PGDATA=$TEMP/data
+RESULTATS=$TEMP/resultats
+
+export PGHOST=$TEMP PGPORT=$PORT PGUSER=bench PGDATABASE=postgres
+unset PGSERVICE PGOPTIONS
+
+PSQL="$BINDIR/psql -X -q -v ON_ERROR_STOP=1"
+
+arret()
+{
+  "$BINDIR/pg_ctl" -D "$PGDATA" -m immediate stop >/dev/null 2>&1 || true
+  rm -rf "$TEMP"
+}
+trap arret EXIT
+
+installe()
+{
+  test -f "$PKGLIBDIR/$1$DLSUFFIX"
+}
+
+# resultat METRIC VALUE UNIT higher|lower
+resultat()
+{
+  echo "$1 $2 $3 $4" >> "$RESULTATS"
+}
+
+# temporary instance, archiving configured but not started
+"$BINDIR/initdb" -D "$PGDATA" -U bench -A trust --no-sync >/dev/null
+cat >> "$PGDATA/postgresql.conf" <<EOF
+port = $PORT
+listen_addresses = ''
+unix_socket_directories = '$TEMP'
+wal_level = logical
+max_replication_slots = 4
+archive_mode = on
+zip_archive.archive_directory = '$TEMP/archives'
+EOF
+mkdir "$TEMP/archives"
+"$BINDIR/pg_ctl" -D "$PGDATA" -l "$TEMP/postgresql.log" -w start >/dev/null
+: > "$RESULTATS"
+
+$PSQL -f "$RACINE/bench/outils.sql"
+
+# archiving: the segments are produced first, then zip_archive gets them,
+# in clear and then encrypted
+segments()
+{
+  i=0
+  while [ $i -lt "$SEGMENTS" ]
+  do
+    $PSQL -c "INSERT INTO perf.wal SELECT generate_series(1, 100000)" \
+          -c "SELECT pg_switch_wal()" >/dev/null
+    i=$((i + 1))
+  done
+}
+
+if installe zip_archive
+then
+  echo "zip_archive: archiving $SEGMENTS segments"
+  $PSQL -c "CREATE TABLE perf.wal (x int)"
+  segments
+  $PSQL -c "ALTER SYSTEM SET archive_library = 'zip_archive'"
+  clair=$($PSQL -At -c "SELECT perf.archive($SEGMENTS)")
+  resultat zip_archive.segments_per_s \
+    "$(echo "$SEGMENTS $clair" | awk '{ printf "%.3f", $1 / $2 }')" segments/s higher
+
+  # the archive is rewritten at each segment: the encrypted segments go to
+  # an empty archive too, so that only the encryption is compared
+  echo "zip_archive: archiving $SEGMENTS segments with aes256"
+  $PSQL -c "ALTER SYSTEM RESET archive_library" -c "SELECT pg_reload_conf(), pg_sleep(1)" >/dev/null
+  segments
+  mkdir "$TEMP/archives_aes256"
+  head -c 32 /dev/urandom | od -An -tx1 | tr -d ' \n' > "$TEMP/zip_archive.key"
+  $PSQL -c "ALTER SYSTEM SET zip_archive.archive_directory = '$TEMP/archives_aes256'" \
+        -c "ALTER SYSTEM SET zip_archive.encryption_method = 'aes256'" \
+        -c "ALTER SYSTEM SET zip_archive.encryption_key_file = '$TEMP/zip_archive.key'" \
+        -c "ALTER SYSTEM SET archive_library = 'zip_archive'"
+  chiffre=$($PSQL -At -c "SELECT perf.archive($SEGMENTS)")
+  resultat zip_archive.aes256.segments_per_s \
+    "$(echo "$SEGMENTS $chiffre" | awk '{ printf "%.3f", $1 / $2 }')" segments/s higher
+  resultat zip_archive.aes256.overhead_pct \
+    "$(echo "$clair $chiffre" | awk '{ printf "%.1f", ($2 - $1) * 100 / $1 }')" % lower
+else
+  echo "zip_archive: not installed, skipped"
+fi
+
+# decoding: a slot reads one transaction of LIGNES inserts
+if installe plugin_audit
+then
+  echo "plugin_audit: decoding $LIGNES changes"
+  $PSQL -c "SELECT pg_create_logical_replication_slot('perf_audit', 'plugin_audit')" >/dev/null
+  $PSQL -c "CREATE TABLE perf.audit (x int)" \
+        -c "INSERT INTO perf.audit SELECT generate_series(1, $LIGNES)"
+  secondes=$($PSQL -At -c "SELECT perf.chronometre('SELECT count(*) FROM pg_logical_slot_get_changes(''perf_audit'', NULL, NULL)')")
+  $PSQL -c "SELECT pg_drop_replication_slot('perf_audit')" >/dev/null
+  resultat plugin_audit.changes_per_s \
+    "$(echo "$LIGNES $secondes" | awk '{ printf "%.0f", $1 / $2 }')" changes/s higher
+else
+  echo "plugin_audit: not installed, skipped"
+fi
+
+# client: a script of journee3/client, mostly expressions evaluated by the
+# client, with one short query, one connection. The client is not
+# installed by its Makefile, it is built in the source tree.
+if ! test -x "$CLIENT" && test -z "$BENCH_CLIENT"
+then
+  make -s -C "$RACINE/journee3/client" PG_CONFIG="$PG_CONFIG" client
+fi
+if ! test -x "$CLIENT"
+then
+  echo "client: $CLIENT not found, set BENCH_CLIENT" >&2
+  exit 1
+fi
+echo "client: script for $DUREE s"
+cat > "$TEMP/client.sql" <<'EOF'
+\set a random(1, 1000000)
+\set b (:a * 7 + 3) % 1000
+\set c :a / 3 + :b * 2 - 1
+\if :b > 500
+SELECT :a::bigint + :c::bigint;
+\else
+SELECT :a::bigint - :c::bigint;
+\endif
+EOF
+"$CLIENT" -f "$TEMP/client.sql" -T "$DUREE" > "$TEMP/client.out"
+resultat client.script.tps \
+  "$(sed -n 's/^tps: //p' "$TEMP/client.out")" transactions/s higher
+resultat client.script.expressions_per_s \
+  "$(sed -n 's/^expressions per second: //p' "$TEMP/client.out")" expressions/s higher
+
+# monextension: ns per call of each version of incremente and context
+if installe monextension
+then
+  echo "monextension: calls on $LIGNES rows"
+  $PSQL -v lignes="$LIGNES" -f "$RACINE/journee1/monextension/bench/setup.sql"
+  $PSQL -At -F ' ' -v repetitions=5 -f "$RACINE/journee1/monextension/bench/chrono.sql" |
+    while read -r contexte variante ns
+    do
+      resultat "monextension.$contexte.$variante" "$ns" ns lower
+    done
+else
+  echo "monextension: not installed, skipped"
+fi
+
+# comparison with the history, then its update
+test -f "$HISTORIQUE" || : > "$HISTORIQUE"
+DATE=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+COMMIT=$(git -C "$RACINE" rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+awk -v seuil="$SEUIL" -v references="$REFERENCES" '
+  FILENAME == ARGV[1] {
+    if (match($0, /"metric":"[^"]*"/))
+      metrique = substr($0, RSTART + 10, RLENGTH - 11)
+    if (match($0, /"value":[-0-9.eE+]*/))
+      valeur = substr($0, RSTART + 8, RLENGTH - 8)
+    n[metrique]++
+    historique[metrique, n[metrique]] = valeur + 0
+    next
+  }
+  FNR == 1 {
+    printf "%-45s %12s %12s %8s\n", "metric", "value", "baseline", "delta"
+  }
+  {
+    metrique = $1; valeur = $2 + 0; sens = $4
+    k = 0
+    for (i = n[metrique]; i >= 1 && k < references; i--)
+      derniers[++k] = historique[metrique, i]
+    if (k == 0)
+    {
+      printf "%-45s %12s %12s %8s\n", metrique, $2, "-", "new"
+      next
+    }
+    # median of the last values
+    for (i = 2; i <= k; i++)
+      for (j = i; j > 1 && derniers[j - 1] > derniers[j]; j--)
+      {
+        t = derniers[j]; derniers[j] = derniers[j - 1]; derniers[j - 1] = t
+      }
+    if (k % 2)
+      reference = derniers[(k + 1) / 2]
+    else
+      reference = (derniers[k / 2] + derniers[k / 2 + 1]) / 2
+    # no meaningful percentage around zero
+    if (reference <= 0)
+    {
+      printf "%-45s %12s %12s %8s\n", metrique, $2, reference, "-"
+      next
+    }
+    ecart = (valeur - reference) * 100 / reference
+    pire = (sens == "lower") ? ecart : -ecart
+    etat = (pire > seuil) ? "  REGRESSION" : ""
+    if (pire > seuil)
+      echec = 1
+    printf "%-45s %12s %12s %+7.1f%%%s\n", metrique, $2, reference, ecart, etat
+  }
+  END { exit echec }
+' "$HISTORIQUE" "$RESULTATS" && statut=0 || statut=$?
+
+while read -r metrique valeur unite sens
+do
+  printf '{"date":"%s","commit":"%s","metric":"%s","value":%s,"unit":"%s","better":"%s"}\n' \
+    "$DATE" "$COMMIT" "$metrique" "$valeur" "$unite" "$sens" >> "$HISTORIQUE"
+done < "$RESULTATS"
+
+if [ "$statut" -ne 0 ]
+then
+  echo "performance regression beyond $SEUIL%" >&2
+fi
+exit "$statut"
@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# Compares the cost of a call to the SQL and C versions of incremente.
+#
+# Usage: bench.sh [lignes] [durée]
+#
+# The server is reached through the usual libpq environment variables, and
+# monextension must be installed. psql and pgbench are taken from $PSQL and
+# $PGBENCH, "make bench" sets them to the ones of pg_config.
+
+set -e
+
+LIGNES=${1:-1000000}
+DUREE=${2:-10}
+PSQL=${PSQL:-psql}
+PGBENCH=${PGBENCH:-pgbench}
+REPERTOIRE=$(dirname "$0")
+
+JIT="-c jit=on -c jit_above_cost=0 -c jit_inline_above_cost=0 -c jit_optimize_above_cost=0"
+
+$PSQL -X -q -v ON_ERROR_STOP=1 -v lignes="$LIGNES" -f "$REPERTOIRE/setup.sql"
+
+echo "In-server timing, $LIGNES rows:"
+$PSQL -X -q -v ON_ERROR_STOP=1 -v repetitions=5 -f "$REPERTOIRE/chrono.sql"
+
+# average latency of a pgbench script, in ms; stops the benchmark when pgbench
+# fails or does not report it
+latence()
+{
+  sortie=$(PGOPTIONS="$2" $PGBENCH -n -T "$DUREE" -f "$REPERTOIRE/pgbench/$1.sql") || {
+    echo "bench.sh: pgbench failed on $1" >&2
+    exit 1
+  }
+  valeur=$(printf '%s\n' "$sortie" | sed -n 's/^latency average = \([0-9.]*\) ms$/\1/p')
+  if [ -z "$valeur" ]; then
+    echo "bench.sh: no average latency in the output of pgbench on $1" >&2
+    exit 1
+  fi
+  echo "$valeur"
+}
+
+# the latencies are gathered before printing, set -e does not reach a
+# command substitution inside a pipeline
+mesures=""
+for contexte in scan scan_jit
+do
+  if [ "$contexte" = scan_jit ]; then options="$JIT"; else options="-c jit=off"; fi
+  reference=$(latence reference "$options")
+  for variante in incremente_sql incremente_sql_appel incremente_c
+  do
+    mesure=$(latence $variante "$options")
+    mesures="$mesures$contexte $variante $mesure $reference $LIGNES
+"
+  done
+done
+
+echo "pgbench, $DUREE s per script:"
+printf ' %-10s | %-20s | %s\n' contexte variante ns_par_appel
+printf '%s' "$mesures" | awk '{ printf " %-10s | %-20s | %.2f\n", $1, $2, ($3 - $4) * 1000000 / $5 }'
@@ -0,0 +1,81 @@
+-- In-server timing of the incremente variants. Each query runs several
+-- times and its best time is kept; the time of the same query with the bare
+-- column is subtracted, which leaves the cost of the calls.
+
+CREATE FUNCTION bench.applique_contexte(contexte text)
+RETURNS void
+LANGUAGE plpgsql
+AS $$
+BEGIN
+  PERFORM set_config('jit', (contexte = 'scan_jit')::text, true);
+  PERFORM set_config('jit_above_cost', '0', true);
+  PERFORM set_config('jit_inline_above_cost', '0', true);
+  PERFORM set_config('jit_optimize_above_cost', '0', true);
+  PERFORM set_config('max_parallel_maintenance_workers', '0', true);
+  PERFORM set_config('max_parallel_workers_per_gather',
+                     CASE WHEN contexte = 'parallele' THEN '4' ELSE '0' END, true);
+  PERFORM set_config('parallel_setup_cost', '0', true);
+  PERFORM set_config('parallel_tuple_cost', '0', true);
+  PERFORM set_config('min_parallel_table_scan_size', '0', true);
+END
+$$;
+
+CREATE FUNCTION bench.chronometre(contexte text, expression text,
+                                  repetitions int)
+RETURNS float8
+LANGUAGE plpgsql
+AS $$
+DECLARE
+  requete   text;
+  debut     timestamptz;
+  duree     float8;
+  meilleure float8;
+BEGIN
+  IF contexte = 'index' THEN
+    requete := format('CREATE INDEX bench_index ON bench.donnees ((%s))', expression);
+  ELSE
+    requete := format('SELECT sum(%s) FROM bench.donnees', expression);
+  END IF;
+
+  FOR i IN 1 .. repetitions LOOP
+    debut := clock_timestamp();
+    EXECUTE requete;
+    duree := extract(epoch FROM clock_timestamp() - debut) * 1e9;
+    IF contexte = 'index' THEN
+      DROP INDEX bench.bench_index;
+    END IF;
+    meilleure := least(meilleure, duree);
+  END LOOP;
+
+  RETURN meilleure;
+END
+$$;
+
+-- ns per call of each variant in each context. "parallele" gives wall
+-- clock time, shared by the workers.
+CREATE FUNCTION bench.compare(repetitions int DEFAULT 5)
+RETURNS TABLE (contexte text, variante text, ns_par_appel numeric)
+LANGUAGE plpgsql
+AS $$
+DECLARE
+  lignes    bigint;
+  reference float8;
+BEGIN
+  SELECT count(*) INTO lignes FROM bench.donnees;
+
+  FOREACH contexte IN ARRAY ARRAY['scan', 'scan_jit', 'parallele', 'index'] LOOP
+    PERFORM bench.applique_contexte(contexte);
+    reference := bench.chronometre(contexte, 'x', repetitions);
+    FOREACH variante IN ARRAY ARRAY['incremente_sql', 'incremente_sql_appel',
+                                    'incremente_c'] LOOP
+      ns_par_appel := round(((bench.chronometre(contexte,
+                                                format('bench.%s(x)', variante),
+                                                repetitions)
+                              - reference) / lignes)::numeric, 2);
+      RETURN NEXT;
+    END LOOP;
+  END LOOP;
+END
+$$;
+
+SELECT * FROM bench.compare(:repetitions);
@@ -0,0 +1 @@
+SELECT sum(bench.incremente_c(x)) FROM bench.donnees;
@@ -0,0 +1 @@
+SELECT sum(bench.incremente_sql(x)) FROM bench.donnees;
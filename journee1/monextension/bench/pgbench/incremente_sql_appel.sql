@@ -0,0 +1 @@
+SELECT sum(bench.incremente_sql_appel(x)) FROM bench.donnees;
@@ -0,0 +1 @@
+SELECT sum(x) FROM bench.donnees;
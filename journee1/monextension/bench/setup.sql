@@ -0,0 +1,37 @@
+-- Variants of incremente compared by "make bench", and the table they scan.
+-- The number of rows is given by the psql variable "lignes".
+
+CREATE EXTENSION IF NOT EXISTS monextension;
+
+DROP SCHEMA IF EXISTS bench CASCADE;
+CREATE SCHEMA bench;
+
+-- the SQL version of 1.0, which the planner inlines
+CREATE FUNCTION bench.incremente_sql(int)
+RETURNS int
+IMMUTABLE
+PARALLEL SAFE
+LANGUAGE sql
+AS 'SELECT $1+1';
+
+-- the same body, but a SET clause prevents inlining, so each row goes
+-- through the SQL function executor
+CREATE FUNCTION bench.incremente_sql_appel(int)
+RETURNS int
+IMMUTABLE
+PARALLEL SAFE
+SET search_path FROM CURRENT
+LANGUAGE sql
+AS 'SELECT $1+1';
+
+-- the C version of 3.0, which JIT can inline from the bitcode PGXS installs
+CREATE FUNCTION bench.incremente_c(int)
+RETURNS int
+AS '$libdir/monextension', 'incremente'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE TABLE bench.donnees AS SELECT x FROM generate_series(1, :lignes) x;
+VACUUM ANALYZE bench.donnees;
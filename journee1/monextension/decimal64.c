@@ -0,0 +1,882 @@
+#include "postgres.h"
+
+#include <ctype.h>
+
+#include "fmgr.h"
+#include "common/hashfn.h"
+#include "libpq/pqformat.h"
+#include "nodes/makefuncs.h"
+#include "nodes/supportnodes.h"
+#include "optimizer/cost.h"
+#include "parser/parse_func.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+
+#include "somme128.h"
+
+/*
+ * decimal64 is a fixed-point decimal number stored in a single int64, so
+ * that it can be passed by value. The 4 low bits hold the scale (number of
+ * digits after the decimal point), the other ones the mantissa:
+ *
+ *     value = mantissa / 10^scale
+ *     datum = mantissa * 16 + scale
+ *
+ * The scale of a value is kept, like numeric does, so that its output
+ * shows the scale of its column. The typmod of a column is its scale.
+ */
+#ifndef USE_FLOAT8_BYVAL
+#error "decimal64 is passed by value, which needs 64-bit Datums"
+#endif
+#ifndef HAVE_INT128
+#error "decimal64 aggregates need a 128-bit integer type"
+#endif
+
+typedef int64 Decimal64;
+
+#define DECIMAL64_SCALE_BITS 4
+#define DECIMAL64_MAX_SCALE 15
+#define DECIMAL64_MAX_MANTISSA ((INT64CONST(1) << (63 - DECIMAL64_SCALE_BITS)) - 1)
+
+/* minimal scale of a quotient, so that 1 / 3 does not give 0 */
+#define DECIMAL64_MIN_DIV_SCALE 6
+
+#define DatumGetDecimal64(X) ((Decimal64) DatumGetInt64(X))
+#define Decimal64GetDatum(X) Int64GetDatum(X)
+#define PG_GETARG_DECIMAL64(n) DatumGetDecimal64(PG_GETARG_DATUM(n))
+#define PG_RETURN_DECIMAL64(x) return Decimal64GetDatum(x)
+
+/*
+ * Transition state of sum(decimal64) and avg(decimal64). The sum is kept at
+ * the biggest scale seen so far.
+ */
+typedef struct
+{
+  Somme128 base;
+  int      echelle;
+} Decimal64AggState;
+
+static const int64 puissances_de_10[] = {
+  INT64CONST(1),
+  INT64CONST(10),
+  INT64CONST(100),
+  INT64CONST(1000),
+  INT64CONST(10000),
+  INT64CONST(100000),
+  INT64CONST(1000000),
+  INT64CONST(10000000),
+  INT64CONST(100000000),
+  INT64CONST(1000000000),
+  INT64CONST(10000000000),
+  INT64CONST(100000000000),
+  INT64CONST(1000000000000),
+  INT64CONST(10000000000000),
+  INT64CONST(100000000000000),
+  INT64CONST(1000000000000000),
+  INT64CONST(10000000000000000),
+  INT64CONST(100000000000000000),
+  INT64CONST(1000000000000000000)
+};
+
+static inline int decimal64_echelle(Decimal64 valeur);
+static inline int64 decimal64_mantisse(Decimal64 valeur);
+static int128 puissance_de_10(int exposant);
+static int128 arrondi(int128 mantisse, int chiffres);
+static Decimal64 decimal64_construit(int128 mantisse, int echelle,
+                                     int echelle_minimale);
+static Decimal64 decimal64_divise(int128 dividende, int echelle_dividende,
+                                  int128 diviseur, int echelle_diviseur);
+static Decimal64 decimal64_typmod(Decimal64 valeur, int32 typmod);
+static int  decimal64_compare(Decimal64 a, Decimal64 b);
+static Decimal64 decimal64_normalise(Decimal64 valeur);
+static void decimal64_depassement(void) pg_attribute_noreturn();
+static void decimal64_etat_ajoute(Decimal64AggState *etat, int128 somme,
+                                  int echelle);
+
+PG_FUNCTION_INFO_V1(decimal64_in);
+PG_FUNCTION_INFO_V1(decimal64_out);
+PG_FUNCTION_INFO_V1(decimal64_recv);
+PG_FUNCTION_INFO_V1(decimal64_send);
+PG_FUNCTION_INFO_V1(decimal64_typmod_in);
+PG_FUNCTION_INFO_V1(decimal64_typmod_out);
+PG_FUNCTION_INFO_V1(decimal64);
+PG_FUNCTION_INFO_V1(int4_decimal64);
+PG_FUNCTION_INFO_V1(int8_decimal64);
+PG_FUNCTION_INFO_V1(decimal64_pl);
+PG_FUNCTION_INFO_V1(decimal64_mi);
+PG_FUNCTION_INFO_V1(decimal64_mul);
+PG_FUNCTION_INFO_V1(decimal64_div);
+PG_FUNCTION_INFO_V1(decimal64_division_sans_erreur);
+PG_FUNCTION_INFO_V1(decimal64_division_sans_erreur_support);
+PG_FUNCTION_INFO_V1(decimal64_um);
+PG_FUNCTION_INFO_V1(decimal64_eq);
+PG_FUNCTION_INFO_V1(decimal64_ne);
+PG_FUNCTION_INFO_V1(decimal64_lt);
+PG_FUNCTION_INFO_V1(decimal64_le);
+PG_FUNCTION_INFO_V1(decimal64_gt);
+PG_FUNCTION_INFO_V1(decimal64_ge);
+PG_FUNCTION_INFO_V1(decimal64_cmp);
+PG_FUNCTION_INFO_V1(decimal64_hash);
+PG_FUNCTION_INFO_V1(decimal64_hash_extended);
+PG_FUNCTION_INFO_V1(decimal64_accum);
+PG_FUNCTION_INFO_V1(decimal64_combine);
+PG_FUNCTION_INFO_V1(decimal64_serialize);
+PG_FUNCTION_INFO_V1(decimal64_deserialize);
+PG_FUNCTION_INFO_V1(decimal64_sum);
+PG_FUNCTION_INFO_V1(decimal64_avg);
+
+static inline int
+decimal64_echelle(Decimal64 valeur)
+{
+  return (int) (valeur & ((1 << DECIMAL64_SCALE_BITS) - 1));
+}
+
+static inline int64
+decimal64_mantisse(Decimal64 valeur)
+{
+  return (valeur - decimal64_echelle(valeur)) / (1 << DECIMAL64_SCALE_BITS);
+}
+
+static int128
+puissance_de_10(int exposant)
+{
+  Assert(exposant >= 0 && exposant <= 36);
+
+  if (exposant <= 18)
+    return puissances_de_10[exposant];
+  return (int128) puissances_de_10[18] * puissances_de_10[exposant - 18];
+}
+
+/*
+ * arrondi
+ *
+ * Removes the given number of digits of the mantissa, rounding half away
+ * from zero.
+ */
+static int128
+arrondi(int128 mantisse, int chiffres)
+{
+  int128 diviseur;
+  int128 quotient;
+  int128 reste;
+
+  if (chiffres <= 0)
+    return mantisse;
+
+  diviseur = puissance_de_10(chiffres);
+  quotient = mantisse / diviseur;
+  reste = mantisse % diviseur;
+
+  if (reste >= 0 && reste * 2 >= diviseur)
+    quotient++;
+  else if (reste < 0 && -reste * 2 >= diviseur)
+    quotient--;
+
+  return quotient;
+}
+
+/*
+ * decimal64_construit
+ *
+ * Builds a decimal64 from a mantissa and a scale. When the mantissa does
+ * not fit, fractional digits are rounded away, but the scale is not reduced
+ * under echelle_minimale.
+ */
+static Decimal64
+decimal64_construit(int128 mantisse, int echelle, int echelle_minimale)
+{
+  if (echelle > DECIMAL64_MAX_SCALE)
+  {
+    mantisse = arrondi(mantisse, echelle - DECIMAL64_MAX_SCALE);
+    echelle = DECIMAL64_MAX_SCALE;
+  }
+
+  while ((mantisse > DECIMAL64_MAX_MANTISSA || mantisse < -DECIMAL64_MAX_MANTISSA) &&
+         echelle > echelle_minimale)
+  {
+    mantisse = arrondi(mantisse, 1);
+    echelle--;
+  }
+
+  if (mantisse > DECIMAL64_MAX_MANTISSA || mantisse < -DECIMAL64_MAX_MANTISSA)
+    decimal64_depassement();
+
+  return (Decimal64) mantisse * (1 << DECIMAL64_SCALE_BITS) + echelle;
+}
+
+/*
+ * decimal64_divise
+ *
+ * Divides two scaled integers. The quotient gets the biggest scale of both
+ * operands, and at least DECIMAL64_MIN_DIV_SCALE digits.
+ */
+static Decimal64
+decimal64_divise(int128 dividende, int echelle_dividende,
+                 int128 diviseur, int echelle_diviseur)
+{
+  int     echelle;
+  int     exposant;
+  int128  numerateur;
+  int128  quotient;
+  int128  reste;
+
+  if (diviseur == 0)
+    ereport(ERROR,
+        (errcode(ERRCODE_DIVISION_BY_ZERO),
+         errmsg("division by zero")));
+
+  echelle = Max(Max(echelle_dividende, echelle_diviseur), DECIMAL64_MIN_DIV_SCALE);
+  echelle = Min(echelle, DECIMAL64_MAX_SCALE);
+
+  /*
+   * dividende / 10^ed / (diviseur / 10^es) * 10^echelle, computed as
+   * dividende * 10^exposant / diviseur. Digits of the quotient are given up
+   * as long as this multiplication overflows.
+   */
+  for (;;)
+  {
+    exposant = echelle - echelle_dividende + echelle_diviseur;
+    if (exposant < 0)
+    {
+      dividende = arrondi(dividende, -exposant);
+      echelle_dividende += exposant;
+      exposant = 0;
+    }
+    if (exposant <= 36 &&
+        !__builtin_mul_overflow(dividende, puissance_de_10(exposant), &numerateur))
+      break;
+    if (echelle == 0)
+      decimal64_depassement();
+    echelle--;
+  }
+
+  quotient = numerateur / diviseur;
+  reste = numerateur % diviseur;
+  if (reste != 0)
+  {
+    bool negatif = (numerateur < 0) != (diviseur < 0);
+
+    if (reste < 0)
+      reste = -reste;
+    if (reste >= (diviseur < 0 ? -diviseur : diviseur) - reste)
+      quotient += negatif ? -1 : 1;
+  }
+
+  return decimal64_construit(quotient, echelle, 0);
+}
+
+/*
+ * decimal64_typmod
+ *
+ * Sets the scale of a value to the one of its column, if any.
+ */
+static Decimal64
+decimal64_typmod(Decimal64 valeur, int32 typmod)
+{
+  int     echelle = decimal64_echelle(valeur);
+  int128  mantisse = decimal64_mantisse(valeur);
+
+  if (typmod < 0 || typmod == echelle)
+    return valeur;
+
+  if (typmod < echelle)
+    mantisse = arrondi(mantisse, echelle - typmod);
+  else
+    mantisse *= puissance_de_10(typmod - echelle);
+
+  return decimal64_construit(mantisse, typmod, typmod);
+}
+
+static int
+decimal64_compare(Decimal64 a, Decimal64 b)
+{
+  int     echelle_a = decimal64_echelle(a);
+  int     echelle_b = decimal64_echelle(b);
+  int128  mantisse_a = decimal64_mantisse(a);
+  int128  mantisse_b = decimal64_mantisse(b);
+
+  if (echelle_a < echelle_b)
+    mantisse_a *= puissance_de_10(echelle_b - echelle_a);
+  else if (echelle_b < echelle_a)
+    mantisse_b *= puissance_de_10(echelle_a - echelle_b);
+
+  if (mantisse_a < mantisse_b)
+    return -1;
+  if (mantisse_a > mantisse_b)
+    return 1;
+  return 0;
+}
+
+/*
+ * decimal64_normalise
+ *
+ * Removes the trailing zeros, so that equal values get the same hash.
+ */
+static Decimal64
+decimal64_normalise(Decimal64 valeur)
+{
+  int     echelle = decimal64_echelle(valeur);
+  int64   mantisse = decimal64_mantisse(valeur);
+
+  while (echelle > 0 && mantisse % 10 == 0)
+  {
+    mantisse /= 10;
+    echelle--;
+  }
+
+  return mantisse * (1 << DECIMAL64_SCALE_BITS) + echelle;
+}
+
+static void
+decimal64_depassement(void)
+{
+  ereport(ERROR,
+      (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+       errmsg("decimal64 out of range")));
+}
+
+/*
+ * decimal64_in
+ *
+ * Reads [+-]digits[.digits], rounded to the scale of the column.
+ */
+Datum
+decimal64_in(PG_FUNCTION_ARGS)
+{
+  char   *chaine = PG_GETARG_CSTRING(0);
+  int32   typmod = PG_GETARG_INT32(2);
+  char   *c = chaine;
+  int128  mantisse = 0;
+  int     echelle = 0;
+  int     chiffres = 0;
+  bool    negatif = false;
+  bool    virgule = false;
+  bool    chiffre_lu = false;
+
+  while (isspace((unsigned char) *c))
+    c++;
+
+  if (*c == '-' || *c == '+')
+  {
+    negatif = *c == '-';
+    c++;
+  }
+
+  for (; *c != '\0' ; c++)
+  {
+    if (isdigit((unsigned char) *c))
+    {
+      chiffre_lu = true;
+      /* one digit past the maximal scale is enough to round */
+      if (virgule && echelle > DECIMAL64_MAX_SCALE)
+        continue;
+      mantisse = mantisse * 10 + (*c - '0');
+      if (mantisse > 0 && ++chiffres > 36)
+        decimal64_depassement();
+      if (virgule)
+        echelle++;
+    }
+    else if (*c == '.' && !virgule)
+      virgule = true;
+    else
+      break;
+  }
+
+  while (isspace((unsigned char) *c))
+    c++;
+
+  if (*c != '\0' || !chiffre_lu)
+    ereport(ERROR,
+        (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+         errmsg("invalid input syntax for type %s: \"%s\"",
+                "decimal64", chaine)));
+
+  if (negatif)
+    mantisse = -mantisse;
+
+  PG_RETURN_DECIMAL64(decimal64_typmod(decimal64_construit(mantisse, echelle, 0),
+                                       typmod));
+}
+
+Datum
+decimal64_out(PG_FUNCTION_ARGS)
+{
+  Decimal64 valeur = PG_GETARG_DECIMAL64(0);
+  int       echelle = decimal64_echelle(valeur);
+  int64     mantisse = decimal64_mantisse(valeur);
+  char      chiffres[MAXINT8LEN + 1];
+  char     *resultat;
+  char     *c;
+  int       longueur;
+  int       entiers;
+
+  /* the mantissa is never PG_INT64_MIN, so its absolute value fits */
+  longueur = pg_lltoa(mantisse < 0 ? -mantisse : mantisse, chiffres);
+
+  /* sign, integer digits (at least one), point, fractional digits */
+  entiers = Max(longueur - echelle, 1);
+  resultat = c = palloc(1 + entiers + 1 + echelle + 1);
+
+  if (mantisse < 0)
+    *c++ = '-';
+
+  if (longueur <= echelle)
+  {
+    *c++ = '0';
+    if (echelle > 0)
+    {
+      *c++ = '.';
+      memset(c, '0', echelle - longueur);
+      c += echelle - longueur;
+    }
+    memcpy(c, chiffres, longueur);
+    c += longueur;
+  }
+  else
+  {
+    memcpy(c, chiffres, longueur - echelle);
+    c += longueur - echelle;
+    if (echelle > 0)
+    {
+      *c++ = '.';
+      memcpy(c, chiffres + longueur - echelle, echelle);
+      c += echelle;
+    }
+  }
+  *c = '\0';
+
+  PG_RETURN_CSTRING(resultat);
+}
+
+/*
+ * decimal64_recv
+ *
+ * Reads the datum as sent by decimal64_send. Any scale fits in its bits,
+ * but the mantissa is checked like in decimal64_in: -2^59 fits in its bits
+ * and not in the type.
+ */
+Datum
+decimal64_recv(PG_FUNCTION_ARGS)
+{
+  StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+  int32      typmod = PG_GETARG_INT32(2);
+  Decimal64  valeur = pq_getmsgint64(buf);
+  int        echelle = decimal64_echelle(valeur);
+
+  valeur = decimal64_construit(decimal64_mantisse(valeur), echelle, echelle);
+
+  PG_RETURN_DECIMAL64(decimal64_typmod(valeur, typmod));
+}
+
+Datum
+decimal64_send(PG_FUNCTION_ARGS)
+{
+  Decimal64      valeur = PG_GETARG_DECIMAL64(0);
+  StringInfoData buf;
+
+  pq_begintypsend(&buf);
+  pq_sendint64(&buf, valeur);
+  PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * decimal64_typmod_in
+ *
+ * decimal64(scale), with a scale between 0 and DECIMAL64_MAX_SCALE.
+ */
+Datum
+decimal64_typmod_in(PG_FUNCTION_ARGS)
+{
+  ArrayType *tableau = PG_GETARG_ARRAYTYPE_P(0);
+  int32     *modificateurs;
+  int        nombre;
+
+  modificateurs = ArrayGetIntegerTypmods(tableau, &nombre);
+
+  if (nombre != 1)
+    ereport(ERROR,
+        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+         errmsg("invalid type modifier"),
+         errhint("decimal64 only accepts a scale.")));
+
+  if (modificateurs[0] < 0 || modificateurs[0] > DECIMAL64_MAX_SCALE)
+    ereport(ERROR,
+        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+         errmsg("decimal64 scale %d must be between 0 and %d",
+                modificateurs[0], DECIMAL64_MAX_SCALE)));
+
+  PG_RETURN_INT32(modificateurs[0]);
+}
+
+Datum
+decimal64_typmod_out(PG_FUNCTION_ARGS)
+{
+  int32 typmod = PG_GETARG_INT32(0);
+
+  if (typmod < 0)
+    PG_RETURN_CSTRING(pstrdup(""));
+
+  PG_RETURN_CSTRING(psprintf("(%d)", typmod));
+}
+
+/*
+ * decimal64
+ *
+ * Length coercion function, applies the scale of a column.
+ */
+Datum
+decimal64(PG_FUNCTION_ARGS)
+{
+  PG_RETURN_DECIMAL64(decimal64_typmod(PG_GETARG_DECIMAL64(0),
+                                       PG_GETARG_INT32(1)));
+}
+
+Datum
+int4_decimal64(PG_FUNCTION_ARGS)
+{
+  PG_RETURN_DECIMAL64(decimal64_construit(PG_GETARG_INT32(0), 0, 0));
+}
+
+Datum
+int8_decimal64(PG_FUNCTION_ARGS)
+{
+  PG_RETURN_DECIMAL64(decimal64_construit(PG_GETARG_INT64(0), 0, 0));
+}
+
+/*
+ * Arithmetic operators. Sums and differences get the biggest scale of their
+ * operands, products the sum of both scales when it fits.
+ */
+
+Datum
+decimal64_pl(PG_FUNCTION_ARGS)
+{
+  Decimal64 a = PG_GETARG_DECIMAL64(0);
+  Decimal64 b = PG_GETARG_DECIMAL64(1);
+  int       echelle = Max(decimal64_echelle(a), decimal64_echelle(b));
+
+  PG_RETURN_DECIMAL64(decimal64_construit(
+    decimal64_mantisse(a) * puissance_de_10(echelle - decimal64_echelle(a)) +
+    decimal64_mantisse(b) * puissance_de_10(echelle - decimal64_echelle(b)),
+    echelle, echelle));
+}
+
+Datum
+decimal64_mi(PG_FUNCTION_ARGS)
+{
+  Decimal64 a = PG_GETARG_DECIMAL64(0);
+  Decimal64 b = PG_GETARG_DECIMAL64(1);
+  int       echelle = Max(decimal64_echelle(a), decimal64_echelle(b));
+
+  PG_RETURN_DECIMAL64(decimal64_construit(
+    decimal64_mantisse(a) * puissance_de_10(echelle - decimal64_echelle(a)) -
+    decimal64_mantisse(b) * puissance_de_10(echelle - decimal64_echelle(b)),
+    echelle, echelle));
+}
+
+Datum
+decimal64_mul(PG_FUNCTION_ARGS)
+{
+  Decimal64 a = PG_GETARG_DECIMAL64(0);
+  Decimal64 b = PG_GETARG_DECIMAL64(1);
+
+  PG_RETURN_DECIMAL64(decimal64_construit(
+    (int128) decimal64_mantisse(a) * decimal64_mantisse(b),
+    decimal64_echelle(a) + decimal64_echelle(b),
+    Max(decimal64_echelle(a), decimal64_echelle(b))));
+}
+
+Datum
+decimal64_div(PG_FUNCTION_ARGS)
+{
+  Decimal64 a = PG_GETARG_DECIMAL64(0);
+  Decimal64 b = PG_GETARG_DECIMAL64(1);
+
+  PG_RETURN_DECIMAL64(decimal64_divise(decimal64_mantisse(a), decimal64_echelle(a),
+                                       decimal64_mantisse(b), decimal64_echelle(b)));
+}
+
+/*
+ * decimal64_division_sans_erreur
+ *
+ * The // operator: NULL instead of a division by zero error.
+ */
+Datum
+decimal64_division_sans_erreur(PG_FUNCTION_ARGS)
+{
+  Decimal64 a = PG_GETARG_DECIMAL64(0);
+  Decimal64 b = PG_GETARG_DECIMAL64(1);
+
+  if (decimal64_mantisse(b) == 0)
+    PG_RETURN_NULL();
+
+  PG_RETURN_DECIMAL64(decimal64_divise(decimal64_mantisse(a), decimal64_echelle(a),
+                                       decimal64_mantisse(b), decimal64_echelle(b)));
+}
+
+/*
+ * decimal64_division_sans_erreur_support
+ *
+ * Planner support function of division_sans_erreur(decimal64, decimal64),
+ * doing what division_sans_erreur_support() does for the builtin types.
+ * decimal64_div() has no fixed OID, so it is looked up in the schema of
+ * the extension.
+ */
+Datum
+decimal64_division_sans_erreur_support(PG_FUNCTION_ARGS)
+{
+  Node *requete = (Node *) PG_GETARG_POINTER(0);
+  Node *resultat = NULL;
+
+  if (IsA(requete, SupportRequestSimplify))
+  {
+    SupportRequestSimplify *simplification = (SupportRequestSimplify *) requete;
+    FuncExpr *appel = simplification->fcall;
+    Node     *diviseur;
+
+    Assert(list_length(appel->args) == 2);
+    diviseur = (Node *) lsecond(appel->args);
+
+    if (IsA(diviseur, Const) && !((Const *) diviseur)->constisnull)
+    {
+      if (decimal64_mantisse(DatumGetDecimal64(((Const *) diviseur)->constvalue)) == 0)
+      {
+        resultat = (Node *) makeNullConst(appel->funcresulttype, -1,
+                                          appel->funccollid);
+      }
+      else
+      {
+        char *schema = get_namespace_name(get_func_namespace(appel->funcid));
+        Oid   types[2] = {appel->funcresulttype, appel->funcresulttype};
+        Oid   division;
+
+        division = LookupFuncName(list_make2(makeString(schema),
+                                             makeString("decimal64_div")),
+                                  2, types, true);
+        if (OidIsValid(division))
+          resultat = (Node *) makeFuncExpr(division, appel->funcresulttype,
+                                           appel->args, appel->funccollid,
+                                           appel->inputcollid,
+                                           COERCE_EXPLICIT_CALL);
+      }
+    }
+  }
+  else if (IsA(requete, SupportRequestCost))
+  {
+    SupportRequestCost *cout = (SupportRequestCost *) requete;
+
+    /* a few integer operations, like the other fixed-size types */
+    if (cout->node != NULL)
+    {
+      cout->startup = 0;
+      cout->per_tuple = cpu_operator_cost;
+      resultat = (Node *) cout;
+    }
+  }
+
+  PG_RETURN_POINTER(resultat);
+}
+
+Datum
+decimal64_um(PG_FUNCTION_ARGS)
+{
+  Decimal64 a = PG_GETARG_DECIMAL64(0);
+
+  PG_RETURN_DECIMAL64(decimal64_construit(-decimal64_mantisse(a),
+                                          decimal64_echelle(a), 0));
+}
+
+/*
+ * Comparison operators and support functions of the btree and hash
+ * operator classes.
+ */
+
+Datum
+decimal64_eq(PG_FUNCTION_ARGS)
+{
+  PG_RETURN_BOOL(decimal64_compare(PG_GETARG_DECIMAL64(0), PG_GETARG_DECIMAL64(1)) == 0);
+}
+
+Datum
+decimal64_ne(PG_FUNCTION_ARGS)
+{
+  PG_RETURN_BOOL(decimal64_compare(PG_GETARG_DECIMAL64(0), PG_GETARG_DECIMAL64(1)) != 0);
+}
+
+Datum
+decimal64_lt(PG_FUNCTION_ARGS)
+{
+  PG_RETURN_BOOL(decimal64_compare(PG_GETARG_DECIMAL64(0), PG_GETARG_DECIMAL64(1)) < 0);
+}
+
+Datum
+decimal64_le(PG_FUNCTION_ARGS)
+{
+  PG_RETURN_BOOL(decimal64_compare(PG_GETARG_DECIMAL64(0), PG_GETARG_DECIMAL64(1)) <= 0);
+}
+
+Datum
+decimal64_gt(PG_FUNCTION_ARGS)
+{
+  PG_RETURN_BOOL(decimal64_compare(PG_GETARG_DECIMAL64(0), PG_GETARG_DECIMAL64(1)) > 0);
+}
+
+Datum
+decimal64_ge(PG_FUNCTION_ARGS)
+{
+  PG_RETURN_BOOL(decimal64_compare(PG_GETARG_DECIMAL64(0), PG_GETARG_DECIMAL64(1)) >= 0);
+}
+
+Datum
+decimal64_cmp(PG_FUNCTION_ARGS)
+{
+  PG_RETURN_INT32(decimal64_compare(PG_GETARG_DECIMAL64(0), PG_GETARG_DECIMAL64(1)));
+}
+
+Datum
+decimal64_hash(PG_FUNCTION_ARGS)
+{
+  Decimal64 valeur = decimal64_normalise(PG_GETARG_DECIMAL64(0));
+
+  return DirectFunctionCall1(hashint8, Int64GetDatum(valeur));
+}
+
+Datum
+decimal64_hash_extended(PG_FUNCTION_ARGS)
+{
+  Decimal64 valeur = decimal64_normalise(PG_GETARG_DECIMAL64(0));
+
+  return DirectFunctionCall2(hashint8extended, Int64GetDatum(valeur),
+                             PG_GETARG_DATUM(1));
+}
+
+/*
+ * Aggregates. sum() and avg() share a transition state holding the sum in
+ * an int128, see somme128.h, so that it cannot overflow before the final
+ * function, which checks that the result fits in a decimal64.
+ */
+
+/*
+ * decimal64_etat_ajoute
+ *
+ * Adds a sum of the given scale to the state, moving the state to the
+ * biggest of both scales.
+ */
+static void
+decimal64_etat_ajoute(Decimal64AggState *etat, int128 somme, int echelle)
+{
+  if (echelle > etat->echelle)
+  {
+    if (__builtin_mul_overflow(etat->base.somme,
+                               puissance_de_10(echelle - etat->echelle),
+                               &etat->base.somme))
+      decimal64_depassement();
+    etat->echelle = echelle;
+  }
+  else if (echelle < etat->echelle)
+  {
+    if (__builtin_mul_overflow(somme,
+                               puissance_de_10(etat->echelle - echelle),
+                               &somme))
+      decimal64_depassement();
+  }
+
+  if (__builtin_add_overflow(etat->base.somme, somme, &etat->base.somme))
+    decimal64_depassement();
+}
+
+/* adds the sum of another state, for somme128_combine() */
+static void
+decimal64_etat_combine(Somme128 *etat, const Somme128 *autre)
+{
+  const Decimal64AggState *etat2 = (const Decimal64AggState *) autre;
+
+  decimal64_etat_ajoute((Decimal64AggState *) etat, etat2->base.somme,
+                        etat2->echelle);
+}
+
+Datum
+decimal64_accum(PG_FUNCTION_ARGS)
+{
+  Decimal64AggState *etat;
+
+  etat = (Decimal64AggState *) somme128_etat(fcinfo, sizeof(Decimal64AggState));
+
+  if (!PG_ARGISNULL(1))
+  {
+    Decimal64 valeur = PG_GETARG_DECIMAL64(1);
+
+    decimal64_etat_ajoute(etat, decimal64_mantisse(valeur),
+                          decimal64_echelle(valeur));
+    etat->base.nombre++;
+  }
+
+  PG_RETURN_POINTER(etat);
+}
+
+Datum
+decimal64_combine(PG_FUNCTION_ARGS)
+{
+  return somme128_combine(fcinfo, sizeof(Decimal64AggState),
+                          decimal64_etat_combine);
+}
+
+/*
+ * decimal64_serialize
+ *
+ * The scale follows the count and the sum.
+ */
+Datum
+decimal64_serialize(PG_FUNCTION_ARGS)
+{
+  Decimal64AggState *etat;
+  StringInfoData     buf;
+
+  etat = (Decimal64AggState *) somme128_serialise(fcinfo, &buf);
+  pq_sendint32(&buf, etat->echelle);
+
+  PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum
+decimal64_deserialize(PG_FUNCTION_ARGS)
+{
+  Decimal64AggState *etat;
+  StringInfoData     buf;
+
+  etat = (Decimal64AggState *) somme128_deserialise(fcinfo, &buf,
+                                                    sizeof(Decimal64AggState));
+  etat->echelle = pq_getmsgint(&buf, 4);
+
+  pq_getmsgend(&buf);
+  pfree(buf.data);
+
+  PG_RETURN_POINTER(etat);
+}
+
+Datum
+decimal64_sum(PG_FUNCTION_ARGS)
+{
+  Decimal64AggState *etat;
+
+  etat = PG_ARGISNULL(0) ? NULL : (Decimal64AggState *) PG_GETARG_POINTER(0);
+  if (etat == NULL || etat->base.nombre == 0)
+    PG_RETURN_NULL();
+
+  PG_RETURN_DECIMAL64(decimal64_construit(etat->base.somme, etat->echelle,
+                                          etat->echelle));
+}
+
+Datum
+decimal64_avg(PG_FUNCTION_ARGS)
+{
+  Decimal64AggState *etat;
+
+  etat = PG_ARGISNULL(0) ? NULL : (Decimal64AggState *) PG_GETARG_POINTER(0);
+  if (etat == NULL || etat->base.nombre == 0)
+    PG_RETURN_NULL();
+
+  PG_RETURN_DECIMAL64(decimal64_divise(etat->base.somme, etat->echelle,
+                                       etat->base.nombre, 0));
+}
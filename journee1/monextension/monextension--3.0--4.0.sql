@@ -0,0 +1,17 @@
+\echo Ne pas exécuter ce script, mais passer par CREATE EXTENSION
+
+CREATE OR REPLACE FUNCTION incremente(int4[])
+RETURNS int4[]
+AS '$libdir/monextension', 'incremente_int4_tableau'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION incremente(int8[])
+RETURNS int8[]
+AS '$libdir/monextension', 'incremente_int8_tableau'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
@@ -0,0 +1,68 @@
+\echo Ne pas exécuter ce script, mais passer par CREATE EXTENSION
+
+CREATE OR REPLACE FUNCTION division_sans_erreur(numeric, numeric)
+RETURNS numeric
+AS '$libdir/monextension', 'division_sans_erreur'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION division_sans_erreur(int4, int4)
+RETURNS int4
+AS '$libdir/monextension', 'division_sans_erreur_int4'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION division_sans_erreur(int8, int8)
+RETURNS int8
+AS '$libdir/monextension', 'division_sans_erreur_int8'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION division_sans_erreur(float8, float8)
+RETURNS float8
+AS '$libdir/monextension', 'division_sans_erreur_float8'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+-- Attention : jusqu'en 4.0, deux entiers passaient par la version numeric
+-- de //. Après cette mise à jour, 7 // 2 ne vaut plus 3.5 mais 3 : la
+-- division d'entiers est tronquée, comme int4div(). Convertir un des deux
+-- opérandes en numeric pour garder l'ancien résultat. Voir le README.
+--
+-- Le script passe aussi par CREATE EXTENSION, qui n'a rien à prévenir :
+-- l'opérateur sur numeric n'a été créé par une transaction précédente que
+-- lors d'une mise à jour.
+
+DO $$
+BEGIN
+  IF (SELECT xmin FROM pg_operator
+      WHERE oid = '//(numeric,numeric)'::regoperator) <> pg_current_xact_id()::xid
+  THEN
+    RAISE WARNING 'the // operator on two integers now returns a truncated integer'
+      USING HINT = 'Cast an operand to numeric to keep the previous result, as in 7::numeric // 2.';
+  END IF;
+END
+$$;
+
+CREATE OPERATOR //
+  (FUNCTION=division_sans_erreur,
+   LEFTARG=int4,
+   RIGHTARG=int4);
+
+CREATE OPERATOR //
+  (FUNCTION=division_sans_erreur,
+   LEFTARG=int8,
+   RIGHTARG=int8);
+
+CREATE OPERATOR //
+  (FUNCTION=division_sans_erreur,
+   LEFTARG=float8,
+   RIGHTARG=float8);
@@ -0,0 +1,16 @@
+\echo Ne pas exécuter ce script, mais passer par CREATE EXTENSION
+
+CREATE OR REPLACE FUNCTION division_sans_erreur_support(internal)
+RETURNS internal
+AS '$libdir/monextension', 'division_sans_erreur_support'
+STRICT
+LANGUAGE C;
+
+ALTER FUNCTION division_sans_erreur(numeric, numeric)
+  SUPPORT division_sans_erreur_support;
+ALTER FUNCTION division_sans_erreur(int4, int4)
+  SUPPORT division_sans_erreur_support;
+ALTER FUNCTION division_sans_erreur(int8, int8)
+  SUPPORT division_sans_erreur_support;
+ALTER FUNCTION division_sans_erreur(float8, float8)
+  SUPPORT division_sans_erreur_support;
@@ -0,0 +1,397 @@
+\echo Ne pas exécuter ce script, mais passer par CREATE EXTENSION
+
+CREATE TYPE decimal64;
+
+CREATE OR REPLACE FUNCTION decimal64_in(cstring, oid, int4)
+RETURNS decimal64
+AS '$libdir/monextension', 'decimal64_in'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_out(decimal64)
+RETURNS cstring
+AS '$libdir/monextension', 'decimal64_out'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_recv(internal, oid, int4)
+RETURNS decimal64
+AS '$libdir/monextension', 'decimal64_recv'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_send(decimal64)
+RETURNS bytea
+AS '$libdir/monextension', 'decimal64_send'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_typmod_in(cstring[])
+RETURNS int4
+AS '$libdir/monextension', 'decimal64_typmod_in'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_typmod_out(int4)
+RETURNS cstring
+AS '$libdir/monextension', 'decimal64_typmod_out'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE TYPE decimal64 (
+  INPUT = decimal64_in,
+  OUTPUT = decimal64_out,
+  RECEIVE = decimal64_recv,
+  SEND = decimal64_send,
+  TYPMOD_IN = decimal64_typmod_in,
+  TYPMOD_OUT = decimal64_typmod_out,
+  INTERNALLENGTH = 8,
+  PASSEDBYVALUE,
+  ALIGNMENT = double,
+  STORAGE = plain,
+  CATEGORY = 'N');
+
+-- conversions
+
+CREATE OR REPLACE FUNCTION decimal64(decimal64, int4)
+RETURNS decimal64
+AS '$libdir/monextension', 'decimal64'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64(int4)
+RETURNS decimal64
+AS '$libdir/monextension', 'int4_decimal64'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64(int8)
+RETURNS decimal64
+AS '$libdir/monextension', 'int8_decimal64'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE CAST (decimal64 AS decimal64)
+  WITH FUNCTION decimal64(decimal64, int4)
+  AS IMPLICIT;
+
+CREATE CAST (int4 AS decimal64)
+  WITH FUNCTION decimal64(int4)
+  AS IMPLICIT;
+
+CREATE CAST (int8 AS decimal64)
+  WITH FUNCTION decimal64(int8)
+  AS IMPLICIT;
+
+-- both text representations are the same
+CREATE CAST (numeric AS decimal64)
+  WITH INOUT
+  AS ASSIGNMENT;
+
+CREATE CAST (decimal64 AS numeric)
+  WITH INOUT
+  AS ASSIGNMENT;
+
+-- opérateurs arithmétiques
+
+CREATE OR REPLACE FUNCTION decimal64_pl(decimal64, decimal64)
+RETURNS decimal64
+AS '$libdir/monextension', 'decimal64_pl'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_mi(decimal64, decimal64)
+RETURNS decimal64
+AS '$libdir/monextension', 'decimal64_mi'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_mul(decimal64, decimal64)
+RETURNS decimal64
+AS '$libdir/monextension', 'decimal64_mul'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_div(decimal64, decimal64)
+RETURNS decimal64
+AS '$libdir/monextension', 'decimal64_div'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION division_sans_erreur(decimal64, decimal64)
+RETURNS decimal64
+AS '$libdir/monextension', 'decimal64_division_sans_erreur'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_um(decimal64)
+RETURNS decimal64
+AS '$libdir/monextension', 'decimal64_um'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OPERATOR +
+  (FUNCTION=decimal64_pl,
+   LEFTARG=decimal64,
+   RIGHTARG=decimal64,
+   COMMUTATOR= +);
+
+CREATE OPERATOR -
+  (FUNCTION=decimal64_mi,
+   LEFTARG=decimal64,
+   RIGHTARG=decimal64);
+
+CREATE OPERATOR *
+  (FUNCTION=decimal64_mul,
+   LEFTARG=decimal64,
+   RIGHTARG=decimal64,
+   COMMUTATOR= *);
+
+CREATE OPERATOR /
+  (FUNCTION=decimal64_div,
+   LEFTARG=decimal64,
+   RIGHTARG=decimal64);
+
+CREATE OPERATOR //
+  (FUNCTION=division_sans_erreur,
+   LEFTARG=decimal64,
+   RIGHTARG=decimal64);
+
+CREATE OPERATOR -
+  (FUNCTION=decimal64_um,
+   RIGHTARG=decimal64);
+
+-- comparaisons
+
+CREATE OR REPLACE FUNCTION decimal64_eq(decimal64, decimal64)
+RETURNS bool
+AS '$libdir/monextension', 'decimal64_eq'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_ne(decimal64, decimal64)
+RETURNS bool
+AS '$libdir/monextension', 'decimal64_ne'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_lt(decimal64, decimal64)
+RETURNS bool
+AS '$libdir/monextension', 'decimal64_lt'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_le(decimal64, decimal64)
+RETURNS bool
+AS '$libdir/monextension', 'decimal64_le'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_gt(decimal64, decimal64)
+RETURNS bool
+AS '$libdir/monextension', 'decimal64_gt'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_ge(decimal64, decimal64)
+RETURNS bool
+AS '$libdir/monextension', 'decimal64_ge'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_cmp(decimal64, decimal64)
+RETURNS int4
+AS '$libdir/monextension', 'decimal64_cmp'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_hash(decimal64)
+RETURNS int4
+AS '$libdir/monextension', 'decimal64_hash'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_hash_extended(decimal64, int8)
+RETURNS int8
+AS '$libdir/monextension', 'decimal64_hash_extended'
+IMMUTABLE
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OPERATOR =
+  (FUNCTION=decimal64_eq,
+   LEFTARG=decimal64,
+   RIGHTARG=decimal64,
+   COMMUTATOR= =,
+   NEGATOR= <>,
+   RESTRICT=eqsel,
+   JOIN=eqjoinsel,
+   HASHES,
+   MERGES);
+
+CREATE OPERATOR <>
+  (FUNCTION=decimal64_ne,
+   LEFTARG=decimal64,
+   RIGHTARG=decimal64,
+   COMMUTATOR= <>,
+   NEGATOR= =,
+   RESTRICT=neqsel,
+   JOIN=neqjoinsel);
+
+CREATE OPERATOR <
+  (FUNCTION=decimal64_lt,
+   LEFTARG=decimal64,
+   RIGHTARG=decimal64,
+   COMMUTATOR= >,
+   NEGATOR= >=,
+   RESTRICT=scalarltsel,
+   JOIN=scalarltjoinsel);
+
+CREATE OPERATOR <=
+  (FUNCTION=decimal64_le,
+   LEFTARG=decimal64,
+   RIGHTARG=decimal64,
+   COMMUTATOR= >=,
+   NEGATOR= >,
+   RESTRICT=scalarlesel,
+   JOIN=scalarlejoinsel);
+
+CREATE OPERATOR >
+  (FUNCTION=decimal64_gt,
+   LEFTARG=decimal64,
+   RIGHTARG=decimal64,
+   COMMUTATOR= <,
+   NEGATOR= <=,
+   RESTRICT=scalargtsel,
+   JOIN=scalargtjoinsel);
+
+CREATE OPERATOR >=
+  (FUNCTION=decimal64_ge,
+   LEFTARG=decimal64,
+   RIGHTARG=decimal64,
+   COMMUTATOR= <=,
+   NEGATOR= <,
+   RESTRICT=scalargesel,
+   JOIN=scalargejoinsel);
+
+CREATE OPERATOR CLASS decimal64_ops
+  DEFAULT FOR TYPE decimal64 USING btree AS
+    OPERATOR 1 <,
+    OPERATOR 2 <=,
+    OPERATOR 3 =,
+    OPERATOR 4 >=,
+    OPERATOR 5 >,
+    FUNCTION 1 decimal64_cmp(decimal64, decimal64);
+
+CREATE OPERATOR CLASS decimal64_ops
+  DEFAULT FOR TYPE decimal64 USING hash AS
+    OPERATOR 1 =,
+    FUNCTION 1 decimal64_hash(decimal64),
+    FUNCTION 2 decimal64_hash_extended(decimal64, int8);
+
+-- agrégats
+
+CREATE OR REPLACE FUNCTION decimal64_accum(internal, decimal64)
+RETURNS internal
+AS '$libdir/monextension', 'decimal64_accum'
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_combine(internal, internal)
+RETURNS internal
+AS '$libdir/monextension', 'decimal64_combine'
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_serialize(internal)
+RETURNS bytea
+AS '$libdir/monextension', 'decimal64_serialize'
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_deserialize(bytea, internal)
+RETURNS internal
+AS '$libdir/monextension', 'decimal64_deserialize'
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_sum(internal)
+RETURNS decimal64
+AS '$libdir/monextension', 'decimal64_sum'
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION decimal64_avg(internal)
+RETURNS decimal64
+AS '$libdir/monextension', 'decimal64_avg'
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE AGGREGATE sum(decimal64)
+  (SFUNC=decimal64_accum,
+   STYPE=internal,
+   SSPACE=48,
+   FINALFUNC=decimal64_sum,
+   COMBINEFUNC=decimal64_combine,
+   SERIALFUNC=decimal64_serialize,
+   DESERIALFUNC=decimal64_deserialize,
+   PARALLEL=SAFE);
+
+CREATE AGGREGATE avg(decimal64)
+  (SFUNC=decimal64_accum,
+   STYPE=internal,
+   SSPACE=48,
+   FINALFUNC=decimal64_avg,
+   COMBINEFUNC=decimal64_combine,
+   SERIALFUNC=decimal64_serialize,
+   DESERIALFUNC=decimal64_deserialize,
+   PARALLEL=SAFE);
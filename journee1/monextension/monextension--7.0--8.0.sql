@@ -0,0 +1,127 @@
+\echo Ne pas exécuter ce script, mais passer par CREATE EXTENSION
+
+CREATE OR REPLACE FUNCTION safe_sum_int4_accum(internal, int4)
+RETURNS internal
+AS '$libdir/monextension', 'safe_sum_int4_accum'
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION safe_sum_int8_accum(internal, int8)
+RETURNS internal
+AS '$libdir/monextension', 'safe_sum_int8_accum'
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION safe_sum_int4_inv(internal, int4)
+RETURNS internal
+AS '$libdir/monextension', 'safe_sum_int4_inv'
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION safe_sum_int8_inv(internal, int8)
+RETURNS internal
+AS '$libdir/monextension', 'safe_sum_int8_inv'
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION safe_agg_combine(internal, internal)
+RETURNS internal
+AS '$libdir/monextension', 'safe_agg_combine'
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION safe_agg_serialize(internal)
+RETURNS bytea
+AS '$libdir/monextension', 'safe_agg_serialize'
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION safe_agg_deserialize(bytea, internal)
+RETURNS internal
+AS '$libdir/monextension', 'safe_agg_deserialize'
+STRICT
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION safe_sum_final(internal)
+RETURNS int8
+AS '$libdir/monextension', 'safe_sum_final'
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION safe_avg_final(internal)
+RETURNS numeric
+AS '$libdir/monextension', 'safe_avg_final'
+PARALLEL SAFE
+LANGUAGE C;
+
+CREATE AGGREGATE safe_sum(int4)
+  (SFUNC=safe_sum_int4_accum,
+   STYPE=internal,
+   SSPACE=32,
+   FINALFUNC=safe_sum_final,
+   COMBINEFUNC=safe_agg_combine,
+   SERIALFUNC=safe_agg_serialize,
+   DESERIALFUNC=safe_agg_deserialize,
+   MSFUNC=safe_sum_int4_accum,
+   MINVFUNC=safe_sum_int4_inv,
+   MSTYPE=internal,
+   MSSPACE=32,
+   MFINALFUNC=safe_sum_final,
+   PARALLEL=SAFE);
+
+CREATE AGGREGATE safe_sum(int8)
+  (SFUNC=safe_sum_int8_accum,
+   STYPE=internal,
+   SSPACE=32,
+   FINALFUNC=safe_sum_final,
+   COMBINEFUNC=safe_agg_combine,
+   SERIALFUNC=safe_agg_serialize,
+   DESERIALFUNC=safe_agg_deserialize,
+   MSFUNC=safe_sum_int8_accum,
+   MINVFUNC=safe_sum_int8_inv,
+   MSTYPE=internal,
+   MSSPACE=32,
+   MFINALFUNC=safe_sum_final,
+   PARALLEL=SAFE);
+
+CREATE AGGREGATE safe_avg(int4)
+  (SFUNC=safe_sum_int4_accum,
+   STYPE=internal,
+   SSPACE=32,
+   FINALFUNC=safe_avg_final,
+   COMBINEFUNC=safe_agg_combine,
+   SERIALFUNC=safe_agg_serialize,
+   DESERIALFUNC=safe_agg_deserialize,
+   MSFUNC=safe_sum_int4_accum,
+   MINVFUNC=safe_sum_int4_inv,
+   MSTYPE=internal,
+   MSSPACE=32,
+   MFINALFUNC=safe_avg_final,
+   PARALLEL=SAFE);
+
+CREATE AGGREGATE safe_avg(int8)
+  (SFUNC=safe_sum_int8_accum,
+   STYPE=internal,
+   SSPACE=32,
+   FINALFUNC=safe_avg_final,
+   COMBINEFUNC=safe_agg_combine,
+   SERIALFUNC=safe_agg_serialize,
+   DESERIALFUNC=safe_agg_deserialize,
+   MSFUNC=safe_sum_int8_accum,
+   MINVFUNC=safe_sum_int8_inv,
+   MSTYPE=internal,
+   MSSPACE=32,
+   MFINALFUNC=safe_avg_final,
+   PARALLEL=SAFE);
+
+-- simplification de // sur decimal64, comme pour les types natifs en 6.0
+CREATE OR REPLACE FUNCTION decimal64_division_sans_erreur_support(internal)
+RETURNS internal
+AS '$libdir/monextension', 'decimal64_division_sans_erreur_support'
+STRICT
+LANGUAGE C;
+
+ALTER FUNCTION division_sans_erreur(decimal64, decimal64)
+  SUPPORT decimal64_division_sans_erreur_support;
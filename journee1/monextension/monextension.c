@@ -1,9 +1,90 @@
 #include "postgres.h"
 #include "fmgr.h"
+#include "catalog/pg_type.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/supportnodes.h"
+#include "libpq/pqformat.h"
+#include "optimizer/cost.h"
+#include "port/pg_bitutils.h"
+#include "utils/array.h"
+#include "utils/float.h"
+#include "utils/fmgroids.h"
+#include "utils/fmgrprotos.h"
+#include "utils/numeric.h"
+
+#include "somme128.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define USE_SIMD_INCREMENTE
+#endif
 
 PG_MODULE_MAGIC;
 
+/*
+ * Implementations of the array variants of incremente, chosen in _PG_init()
+ * according to the CPU.
+ */
+typedef void (*incremente_int4_fn) (int32 *valeurs, int nombre);
+typedef void (*incremente_int8_fn) (int64 *valeurs, int nombre);
+
+void        _PG_init(void);
+static int  nombre_non_nulls(ArrayType *tableau, int nombre);
+static bool numeric_est_zero(Numeric valeur);
+static bool constante_est_zero(Const *constante);
+static Numeric int128_vers_numeric(int128 valeur);
+static void incremente_int4_scalaire(int32 *valeurs, int nombre);
+static void incremente_int8_scalaire(int64 *valeurs, int nombre);
+#ifdef USE_SIMD_INCREMENTE
+static void incremente_int4_sse2(int32 *valeurs, int nombre);
+static void incremente_int4_avx2(int32 *valeurs, int nombre);
+static void incremente_int8_avx2(int64 *valeurs, int nombre);
+#endif
+
+static incremente_int4_fn incremente_int4 = incremente_int4_scalaire;
+static incremente_int8_fn incremente_int8 = incremente_int8_scalaire;
+
 PG_FUNCTION_INFO_V1(incremente);
+PG_FUNCTION_INFO_V1(incremente_int4_tableau);
+PG_FUNCTION_INFO_V1(incremente_int8_tableau);
+PG_FUNCTION_INFO_V1(division_sans_erreur);
+PG_FUNCTION_INFO_V1(division_sans_erreur_int4);
+PG_FUNCTION_INFO_V1(division_sans_erreur_int8);
+PG_FUNCTION_INFO_V1(division_sans_erreur_float8);
+PG_FUNCTION_INFO_V1(division_sans_erreur_support);
+PG_FUNCTION_INFO_V1(safe_sum_int4_accum);
+PG_FUNCTION_INFO_V1(safe_sum_int8_accum);
+PG_FUNCTION_INFO_V1(safe_sum_int4_inv);
+PG_FUNCTION_INFO_V1(safe_sum_int8_inv);
+PG_FUNCTION_INFO_V1(safe_agg_combine);
+PG_FUNCTION_INFO_V1(safe_agg_serialize);
+PG_FUNCTION_INFO_V1(safe_agg_deserialize);
+PG_FUNCTION_INFO_V1(safe_sum_final);
+PG_FUNCTION_INFO_V1(safe_avg_final);
+
+/*
+ * _PG_init
+ *
+ * Chooses the array implementations supported by the CPU.
+ */
+void
+_PG_init(void)
+{
+#ifdef USE_SIMD_INCREMENTE
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    incremente_int4 = incremente_int4_avx2;
+    incremente_int8 = incremente_int8_avx2;
+  }
+  else
+  {
+    /* SSE2 is always there on x86_64, but has no 64-bit comparison */
+    incremente_int4 = incremente_int4_sse2;
+  }
+#endif
+}
 
 Datum
 incremente(PG_FUNCTION_ARGS)
@@ -22,3 +103,569 @@ incremente(PG_FUNCTION_ARGS)
 
   PG_RETURN_INT32(valeur + 1);
 }
+
+/*
+ * incremente_int4_tableau
+ *
+ * Increments every element of an int4 array. The array is detoasted into a
+ * copy that we can modify in place.
+ */
+Datum
+incremente_int4_tableau(PG_FUNCTION_ARGS)
+{
+  ArrayType *tableau = PG_GETARG_ARRAYTYPE_P_COPY(0);
+  int        nombre;
+
+  Assert(ARR_ELEMTYPE(tableau) == INT4OID);
+
+  nombre = ArrayGetNItems(ARR_NDIM(tableau), ARR_DIMS(tableau));
+  incremente_int4((int32 *) ARR_DATA_PTR(tableau),
+                  nombre_non_nulls(tableau, nombre));
+
+  PG_RETURN_ARRAYTYPE_P(tableau);
+}
+
+/*
+ * incremente_int8_tableau
+ *
+ * Same as incremente_int4_tableau, for an int8 array.
+ */
+Datum
+incremente_int8_tableau(PG_FUNCTION_ARGS)
+{
+  ArrayType *tableau = PG_GETARG_ARRAYTYPE_P_COPY(0);
+  int        nombre;
+
+  Assert(ARR_ELEMTYPE(tableau) == INT8OID);
+
+  nombre = ArrayGetNItems(ARR_NDIM(tableau), ARR_DIMS(tableau));
+  incremente_int8((int64 *) ARR_DATA_PTR(tableau),
+                  nombre_non_nulls(tableau, nombre));
+
+  PG_RETURN_ARRAYTYPE_P(tableau);
+}
+
+/*
+ * nombre_non_nulls
+ *
+ * Returns the number of non-NULL elements of the array. NULL elements take
+ * no room in the data area, so the non-NULL values of a fixed-length type
+ * are contiguous and can be processed as a plain C array.
+ */
+static int
+nombre_non_nulls(ArrayType *tableau, int nombre)
+{
+  bits8 *bitmap = ARR_NULLBITMAP(tableau);
+  int    non_nulls;
+
+  if (bitmap == NULL)
+    return nombre;
+
+  /* a set bit is a non-NULL element, the last byte may be partial */
+  non_nulls = (int) pg_popcount((const char *) bitmap, nombre / BITS_PER_BYTE);
+  if (nombre % BITS_PER_BYTE != 0)
+    non_nulls += pg_popcount32(bitmap[nombre / BITS_PER_BYTE] &
+                               ((1 << (nombre % BITS_PER_BYTE)) - 1));
+
+  return non_nulls;
+}
+
+static void
+incremente_int4_scalaire(int32 *valeurs, int nombre)
+{
+  for (int i = 0 ; i < nombre ; i++)
+  {
+    if (valeurs[i] == PG_INT32_MAX)
+    {
+      elog(ERROR, "valeur maximale dépassée après incrément");
+    }
+    valeurs[i]++;
+  }
+}
+
+static void
+incremente_int8_scalaire(int64 *valeurs, int nombre)
+{
+  for (int i = 0 ; i < nombre ; i++)
+  {
+    if (valeurs[i] == PG_INT64_MAX)
+    {
+      elog(ERROR, "valeur maximale dépassée après incrément");
+    }
+    valeurs[i]++;
+  }
+}
+
+/*
+ * division_sans_erreur
+ *
+ * Divides two numerics, returns NULL instead of a division by zero error.
+ *
+ * numeric_div_opt_error() reports a division by zero without throwing it,
+ * so the divisor is checked by numeric.c itself, without another comparison
+ * with zero. It reports the same way an overflow, that we raise again.
+ */
+Datum
+division_sans_erreur(PG_FUNCTION_ARGS)
+{
+  Numeric dividende = PG_GETARG_NUMERIC(0);
+  Numeric diviseur = PG_GETARG_NUMERIC(1);
+  Numeric quotient;
+  bool    erreur = false;
+
+  /* NaN / 0 gives NaN, but the SQL version of // returned NULL */
+  if (numeric_is_nan(dividende) && numeric_est_zero(diviseur))
+    PG_RETURN_NULL();
+
+  quotient = numeric_div_opt_error(dividende, diviseur, &erreur);
+
+  if (erreur)
+  {
+    if (numeric_est_zero(diviseur))
+      PG_RETURN_NULL();
+
+    /* not a division by zero, get the real error */
+    return DirectFunctionCall2(numeric_div,
+                               NumericGetDatum(dividende),
+                               NumericGetDatum(diviseur));
+  }
+
+  PG_RETURN_NUMERIC(quotient);
+}
+
+/*
+ * numeric_est_zero
+ *
+ * Checks if a numeric is zero. Only used on the slow paths.
+ */
+static bool
+numeric_est_zero(Numeric valeur)
+{
+  return DatumGetInt32(DirectFunctionCall2(numeric_cmp,
+                                           NumericGetDatum(valeur),
+                                           NumericGetDatum(int64_to_numeric(0)))) == 0;
+}
+
+/*
+ * division_sans_erreur_int4
+ *
+ * Same as division_sans_erreur, for int4. Like int4div(), the quotient is
+ * truncated toward zero.
+ */
+Datum
+division_sans_erreur_int4(PG_FUNCTION_ARGS)
+{
+  int32 dividende = PG_GETARG_INT32(0);
+  int32 diviseur = PG_GETARG_INT32(1);
+
+  if (diviseur == 0)
+    PG_RETURN_NULL();
+
+  /* PG_INT32_MIN / -1 does not fit, and would crash on some platforms */
+  if (diviseur == -1)
+  {
+    if (unlikely(dividende == PG_INT32_MIN))
+      ereport(ERROR,
+          (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+           errmsg("integer out of range")));
+    PG_RETURN_INT32(-dividende);
+  }
+
+  PG_RETURN_INT32(dividende / diviseur);
+}
+
+/*
+ * division_sans_erreur_int8
+ *
+ * Same as division_sans_erreur_int4, for int8.
+ */
+Datum
+division_sans_erreur_int8(PG_FUNCTION_ARGS)
+{
+  int64 dividende = PG_GETARG_INT64(0);
+  int64 diviseur = PG_GETARG_INT64(1);
+
+  if (diviseur == 0)
+    PG_RETURN_NULL();
+
+  if (diviseur == -1)
+  {
+    if (unlikely(dividende == PG_INT64_MIN))
+      ereport(ERROR,
+          (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+           errmsg("bigint out of range")));
+    PG_RETURN_INT64(-dividende);
+  }
+
+  PG_RETURN_INT64(dividende / diviseur);
+}
+
+/*
+ * division_sans_erreur_float8
+ *
+ * Same as division_sans_erreur, for float8. float8_div() still checks the
+ * overflow and underflow.
+ */
+Datum
+division_sans_erreur_float8(PG_FUNCTION_ARGS)
+{
+  float8 dividende = PG_GETARG_FLOAT8(0);
+  float8 diviseur = PG_GETARG_FLOAT8(1);
+
+  if (diviseur == 0.0)
+    PG_RETURN_NULL();
+
+  PG_RETURN_FLOAT8(float8_div(dividende, diviseur));
+}
+
+/*
+ * division_sans_erreur_support
+ *
+ * Planner support function of the division_sans_erreur functions.
+ *
+ * With a constant divisor, the call is simplified: dividing by zero is
+ * replaced with a NULL constant, and dividing by anything else with the
+ * builtin division function, which raises the same errors.
+ *
+ * The cost depends on the type: the numeric division works digit by digit,
+ * the other ones are a single machine instruction.
+ *
+ * SupportRequestSelectivity is only sent for functions returning a boolean,
+ * which is not the case here. For a clause like "a // b > c", the planner
+ * uses the statistics of the expression, which can be gathered with
+ * CREATE STATISTICS ... ON (a // b) since the functions are immutable.
+ */
+Datum
+division_sans_erreur_support(PG_FUNCTION_ARGS)
+{
+  Node *requete = (Node *) PG_GETARG_POINTER(0);
+  Node *resultat = NULL;
+
+  if (IsA(requete, SupportRequestSimplify))
+  {
+    SupportRequestSimplify *simplification = (SupportRequestSimplify *) requete;
+    FuncExpr *appel = simplification->fcall;
+    Node     *diviseur;
+    Oid       division;
+
+    Assert(list_length(appel->args) == 2);
+    diviseur = (Node *) lsecond(appel->args);
+
+    if (IsA(diviseur, Const) && !((Const *) diviseur)->constisnull)
+    {
+      if (constante_est_zero((Const *) diviseur))
+      {
+        resultat = (Node *) makeNullConst(appel->funcresulttype, -1,
+                                          appel->funccollid);
+      }
+      else
+      {
+        switch (appel->funcresulttype)
+        {
+          case INT4OID:
+            division = F_INT4DIV;
+            break;
+          case INT8OID:
+            division = F_INT8DIV;
+            break;
+          case FLOAT8OID:
+            division = F_FLOAT8DIV;
+            break;
+          case NUMERICOID:
+            division = F_NUMERIC_DIV;
+            break;
+          default:
+            division = InvalidOid;
+            break;
+        }
+
+        if (OidIsValid(division))
+          resultat = (Node *) makeFuncExpr(division, appel->funcresulttype,
+                                           appel->args, appel->funccollid,
+                                           appel->inputcollid,
+                                           COERCE_EXPLICIT_CALL);
+      }
+    }
+  }
+  else if (IsA(requete, SupportRequestCost))
+  {
+    SupportRequestCost *cout = (SupportRequestCost *) requete;
+
+    if (cout->node != NULL)
+    {
+      cout->startup = 0;
+      if (exprType(cout->node) == NUMERICOID)
+        cout->per_tuple = 10 * cpu_operator_cost;
+      else
+        cout->per_tuple = cpu_operator_cost;
+      resultat = (Node *) cout;
+    }
+  }
+
+  PG_RETURN_POINTER(resultat);
+}
+
+/*
+ * constante_est_zero
+ *
+ * Checks if a non-NULL divisor constant is zero.
+ */
+static bool
+constante_est_zero(Const *constante)
+{
+  switch (constante->consttype)
+  {
+    case INT4OID:
+      return DatumGetInt32(constante->constvalue) == 0;
+    case INT8OID:
+      return DatumGetInt64(constante->constvalue) == 0;
+    case FLOAT8OID:
+      return DatumGetFloat8(constante->constvalue) == 0.0;
+    case NUMERICOID:
+      return numeric_est_zero(DatumGetNumeric(constante->constvalue));
+    default:
+      return false;
+  }
+}
+
+/*
+ * safe_sum() and safe_avg() aggregates. Their transition state keeps the
+ * sum in an int128, which cannot overflow: even 2^63 int8 values fit. The
+ * final functions check that the result fits in its type.
+ *
+ * The same state serves the normal and the moving aggregates, whose
+ * inverse functions remove the values leaving the window frame.
+ */
+
+Datum
+safe_sum_int4_accum(PG_FUNCTION_ARGS)
+{
+  Somme128 *etat = somme128_etat(fcinfo, sizeof(Somme128));
+
+  if (!PG_ARGISNULL(1))
+  {
+    etat->somme += PG_GETARG_INT32(1);
+    etat->nombre++;
+  }
+
+  PG_RETURN_POINTER(etat);
+}
+
+Datum
+safe_sum_int8_accum(PG_FUNCTION_ARGS)
+{
+  Somme128 *etat = somme128_etat(fcinfo, sizeof(Somme128));
+
+  if (!PG_ARGISNULL(1))
+  {
+    etat->somme += PG_GETARG_INT64(1);
+    etat->nombre++;
+  }
+
+  PG_RETURN_POINTER(etat);
+}
+
+Datum
+safe_sum_int4_inv(PG_FUNCTION_ARGS)
+{
+  Somme128 *etat = somme128_etat(fcinfo, sizeof(Somme128));
+
+  if (!PG_ARGISNULL(1))
+  {
+    etat->somme -= PG_GETARG_INT32(1);
+    etat->nombre--;
+  }
+
+  PG_RETURN_POINTER(etat);
+}
+
+Datum
+safe_sum_int8_inv(PG_FUNCTION_ARGS)
+{
+  Somme128 *etat = somme128_etat(fcinfo, sizeof(Somme128));
+
+  if (!PG_ARGISNULL(1))
+  {
+    etat->somme -= PG_GETARG_INT64(1);
+    etat->nombre--;
+  }
+
+  PG_RETURN_POINTER(etat);
+}
+
+Datum
+safe_agg_combine(PG_FUNCTION_ARGS)
+{
+  return somme128_combine(fcinfo, sizeof(Somme128), NULL);
+}
+
+Datum
+safe_agg_serialize(PG_FUNCTION_ARGS)
+{
+  StringInfoData buf;
+
+  somme128_serialise(fcinfo, &buf);
+
+  PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum
+safe_agg_deserialize(PG_FUNCTION_ARGS)
+{
+  StringInfoData buf;
+  Somme128      *etat;
+
+  etat = somme128_deserialise(fcinfo, &buf, sizeof(Somme128));
+
+  pq_getmsgend(&buf);
+  pfree(buf.data);
+
+  PG_RETURN_POINTER(etat);
+}
+
+/*
+ * safe_sum_final
+ *
+ * Returns the sum as an int8, or raises an error when it does not fit,
+ * instead of wrapping around.
+ */
+Datum
+safe_sum_final(PG_FUNCTION_ARGS)
+{
+  Somme128 *etat;
+
+  etat = PG_ARGISNULL(0) ? NULL : (Somme128 *) PG_GETARG_POINTER(0);
+  if (etat == NULL || etat->nombre == 0)
+    PG_RETURN_NULL();
+
+  if (etat->somme > PG_INT64_MAX || etat->somme < PG_INT64_MIN)
+    ereport(ERROR,
+        (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+         errmsg("bigint out of range")));
+
+  PG_RETURN_INT64((int64) etat->somme);
+}
+
+/*
+ * safe_avg_final
+ *
+ * Returns the average as a numeric, like avg(int8), so that the sum may
+ * exceed an int8.
+ */
+Datum
+safe_avg_final(PG_FUNCTION_ARGS)
+{
+  Somme128 *etat;
+
+  etat = PG_ARGISNULL(0) ? NULL : (Somme128 *) PG_GETARG_POINTER(0);
+  if (etat == NULL || etat->nombre == 0)
+    PG_RETURN_NULL();
+
+  PG_RETURN_NUMERIC(numeric_div_opt_error(int128_vers_numeric(etat->somme),
+                                          int64_to_numeric(etat->nombre),
+                                          NULL));
+}
+
+/*
+ * int128_vers_numeric
+ *
+ * numeric.c keeps its int128 conversion to itself. The value is rebuilt
+ * from 32-bit pieces when it does not fit in an int64.
+ */
+static Numeric
+int128_vers_numeric(int128 valeur)
+{
+  Numeric resultat;
+  Numeric base;
+
+  if (valeur >= PG_INT64_MIN && valeur <= PG_INT64_MAX)
+    return int64_to_numeric((int64) valeur);
+
+  base = int64_to_numeric(INT64CONST(1) << 32);
+  resultat = int64_to_numeric((int64) (valeur >> 64));
+  resultat = numeric_mul_opt_error(resultat, base, NULL);
+  resultat = numeric_add_opt_error(resultat,
+                                   int64_to_numeric((int64) ((uint64) valeur >> 32)),
+                                   NULL);
+  resultat = numeric_mul_opt_error(resultat, base, NULL);
+  resultat = numeric_add_opt_error(resultat,
+                                   int64_to_numeric((int64) ((uint64) valeur & 0xFFFFFFFF)),
+                                   NULL);
+
+  return resultat;
+}
+
+#ifdef USE_SIMD_INCREMENTE
+
+/*
+ * The vector versions compare each vector with the maximum value before
+ * adding 1 to it: a non-zero comparison mask means an overflow. The tail of
+ * the array is left to the scalar version.
+ */
+
+static void
+incremente_int4_sse2(int32 *valeurs, int nombre)
+{
+  const __m128i maximum = _mm_set1_epi32(PG_INT32_MAX);
+  const __m128i un = _mm_set1_epi32(1);
+  int           i = 0;
+
+  for (; i + 4 <= nombre ; i += 4)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *) (valeurs + i));
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, maximum)) != 0)
+    {
+      elog(ERROR, "valeur maximale dépassée après incrément");
+    }
+    _mm_storeu_si128((__m128i *) (valeurs + i), _mm_add_epi32(v, un));
+  }
+
+  incremente_int4_scalaire(valeurs + i, nombre - i);
+}
+
+__attribute__((target("avx2")))
+static void
+incremente_int4_avx2(int32 *valeurs, int nombre)
+{
+  const __m256i maximum = _mm256_set1_epi32(PG_INT32_MAX);
+  const __m256i un = _mm256_set1_epi32(1);
+  int           i = 0;
+
+  for (; i + 8 <= nombre ; i += 8)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (valeurs + i));
+
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(v, maximum)) != 0)
+    {
+      elog(ERROR, "valeur maximale dépassée après incrément");
+    }
+    _mm256_storeu_si256((__m256i *) (valeurs + i), _mm256_add_epi32(v, un));
+  }
+
+  incremente_int4_scalaire(valeurs + i, nombre - i);
+}
+
+__attribute__((target("avx2")))
+static void
+incremente_int8_avx2(int64 *valeurs, int nombre)
+{
+  const __m256i maximum = _mm256_set1_epi64x(PG_INT64_MAX);
+  const __m256i un = _mm256_set1_epi64x(1);
+  int           i = 0;
+
+  for (; i + 4 <= nombre ; i += 4)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (valeurs + i));
+
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(v, maximum)) != 0)
+    {
+      elog(ERROR, "valeur maximale dépassée après incrément");
+    }
+    _mm256_storeu_si256((__m256i *) (valeurs + i), _mm256_add_epi64(v, un));
+  }
+
+  incremente_int8_scalaire(valeurs + i, nombre - i);
+}
+
+#endif                          /* USE_SIMD_INCREMENTE */
@@ -0,0 +1,129 @@
+/*
+ * somme128.h
+ *
+ * Transition state of the aggregates keeping their sum in an int128, which
+ * cannot overflow before the final function: safe_sum() and safe_avg() in
+ * monextension.c, sum() and avg() of decimal64 in decimal64.c. A state may
+ * extend Somme128 by starting with it.
+ */
+#ifndef SOMME128_H
+#define SOMME128_H
+
+#include "fmgr.h"
+#include "libpq/pqformat.h"
+
+typedef struct
+{
+  int64   nombre;
+  int128  somme;
+} Somme128;
+
+/*
+ * somme128_etat
+ *
+ * Returns the state of the aggregate, allocated in its memory context at the
+ * first call.
+ */
+static inline Somme128 *
+somme128_etat(FunctionCallInfo fcinfo, Size taille)
+{
+  MemoryContext contexte_agregat;
+
+  if (!AggCheckCallContext(fcinfo, &contexte_agregat))
+    elog(ERROR, "aggregate function called in non-aggregate context");
+
+  if (!PG_ARGISNULL(0))
+    return (Somme128 *) PG_GETARG_POINTER(0);
+
+  return (Somme128 *) MemoryContextAllocZero(contexte_agregat, taille);
+}
+
+/*
+ * somme128_combine
+ *
+ * Adds the second state to the first one. ajoute adds the sum of a state to
+ * another, NULL for a plain addition.
+ */
+static inline Datum
+somme128_combine(FunctionCallInfo fcinfo, Size taille,
+                 void (*ajoute) (Somme128 *etat, const Somme128 *autre))
+{
+  Somme128 *etat1;
+  Somme128 *etat2;
+
+  etat2 = PG_ARGISNULL(1) ? NULL : (Somme128 *) PG_GETARG_POINTER(1);
+  if (etat2 == NULL)
+  {
+    if (PG_ARGISNULL(0))
+      PG_RETURN_NULL();
+    PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+  }
+
+  etat1 = somme128_etat(fcinfo, taille);
+  if (ajoute)
+    ajoute(etat1, etat2);
+  else
+    etat1->somme += etat2->somme;
+  etat1->nombre += etat2->nombre;
+
+  PG_RETURN_POINTER(etat1);
+}
+
+/*
+ * somme128_serialise
+ *
+ * Starts the serialized state in buf with the count and the sum, the int128
+ * being sent as two int64, like numeric.c does. The caller may append the
+ * rest of its state before pq_endtypsend().
+ */
+static inline Somme128 *
+somme128_serialise(FunctionCallInfo fcinfo, StringInfo buf)
+{
+  Somme128 *etat;
+
+  if (!AggCheckCallContext(fcinfo, NULL))
+    elog(ERROR, "aggregate function called in non-aggregate context");
+
+  etat = (Somme128 *) PG_GETARG_POINTER(0);
+
+  pq_begintypsend(buf);
+  pq_sendint64(buf, etat->nombre);
+  pq_sendint64(buf, (uint64) (etat->somme >> 64));
+  pq_sendint64(buf, (uint64) etat->somme);
+
+  return etat;
+}
+
+/*
+ * somme128_deserialise
+ *
+ * Reads back the count and the sum into a new state of the given size. The
+ * caller reads the rest of its state from buf, then ends the message.
+ */
+static inline Somme128 *
+somme128_deserialise(FunctionCallInfo fcinfo, StringInfo buf, Size taille)
+{
+  bytea    *serialise;
+  Somme128 *etat;
+  uint64    poids_fort;
+  uint64    poids_faible;
+
+  if (!AggCheckCallContext(fcinfo, NULL))
+    elog(ERROR, "aggregate function called in non-aggregate context");
+
+  serialise = PG_GETARG_BYTEA_PP(0);
+
+  initStringInfo(buf);
+  appendBinaryStringInfo(buf, VARDATA_ANY(serialise),
+                         VARSIZE_ANY_EXHDR(serialise));
+
+  etat = palloc0(taille);
+  etat->nombre = pq_getmsgint64(buf);
+  poids_fort = pq_getmsgint64(buf);
+  poids_faible = pq_getmsgint64(buf);
+  etat->somme = (int128) (((uint128) poids_fort << 64) | poids_faible);
+
+  return etat;
+}
+
+#endif                          /* SOMME128_H */
@@ -0,0 +1,22 @@
+SELECT safe_sum(x), safe_avg(x) FROM (VALUES (1), (2), (4), (NULL)) v(x);
+SELECT safe_sum(x), safe_avg(x) FROM (VALUES (NULL::int4)) v(x);
+SELECT safe_sum(x) FROM (VALUES (2147483647), (2147483647)) v(x);
+SELECT safe_sum(x) FROM (VALUES (9223372036854775807), (1)) v(x);
+SELECT safe_avg(x) FROM (VALUES (9223372036854775807), (9223372036854775807)) v(x);
+SELECT x, safe_sum(x) OVER w, safe_avg(x) OVER w
+  FROM generate_series(1, 5) x
+  WINDOW w AS (ORDER BY x ROWS BETWEEN 1 PRECEDING AND CURRENT ROW);
+CREATE TABLE agregats_test AS SELECT x FROM generate_series(1, 10000) x;
+ANALYZE agregats_test;
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+EXPLAIN (COSTS OFF)
+  SELECT safe_sum(x), safe_avg(x) FROM agregats_test;
+SELECT safe_sum(x), safe_avg(x) FROM agregats_test;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+DROP TABLE agregats_test;
@@ -0,0 +1,28 @@
+SELECT '123.456'::decimal64, '-0.05'::decimal64, '.5'::decimal64, ' 42 '::decimal64;
+SELECT '1.005'::decimal64(2), '-1.005'::decimal64(2), '3'::decimal64(2);
+SELECT '576460752303423487'::decimal64;
+SELECT '576460752303423488'::decimal64;
+SELECT 'abc'::decimal64;
+SELECT '1e3'::decimal64;
+SELECT '1'::decimal64(16);
+SELECT '1.5'::decimal64 + '2.25'::decimal64, '1.5'::decimal64 - '2.25'::decimal64,
+       '1.5'::decimal64 * '2.25'::decimal64, - '1.25'::decimal64;
+SELECT '10.00'::decimal64 / 3, '-2'::decimal64 / 3;
+SELECT '1'::decimal64 / 0;
+SELECT '7.50'::decimal64 // '2.5', '1'::decimal64 // '0.00';
+SELECT '576460752303423487'::decimal64 + 1;
+SELECT '1.0'::decimal64 = '1.00', '-1.5'::decimal64 < 1, '2'::decimal64 > '1.99';
+SELECT 12.345::decimal64(2)::numeric, pg_typeof(1::decimal64 // 2);
+CREATE TABLE decimal64_test (id int4, prix decimal64(2));
+INSERT INTO decimal64_test VALUES (1, 1.5), (2, 2.25), (3, 3), (4, NULL), (5, 1.50);
+SELECT * FROM decimal64_test ORDER BY prix, id;
+EXPLAIN (VERBOSE, COSTS OFF)
+  SELECT prix // '0', prix // '2.5' FROM decimal64_test;
+SELECT prix, count(*) FROM decimal64_test GROUP BY prix ORDER BY prix;
+SELECT sum(prix), avg(prix), sum(prix) FILTER (WHERE id > 10) FROM decimal64_test;
+CREATE INDEX ON decimal64_test USING btree (prix);
+CREATE INDEX ON decimal64_test USING hash (prix);
+SET enable_seqscan = off;
+SELECT id FROM decimal64_test WHERE prix = '1.5' ORDER BY id;
+RESET enable_seqscan;
+DROP TABLE decimal64_test;
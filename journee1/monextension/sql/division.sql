@@ -0,0 +1,33 @@
+SET client_min_messages = warning;
+DROP EXTENSION IF EXISTS monextension;
+RESET client_min_messages;
+CREATE EXTENSION monextension VERSION '4.0';
+SELECT 7 // 2, pg_typeof(7 // 2);
+ALTER EXTENSION monextension UPDATE TO '5.0';
+SELECT 7 // 2, pg_typeof(7 // 2);
+SELECT 7::numeric // 2;
+ALTER EXTENSION monextension UPDATE;
+SELECT 7.5 // 2.5;
+SELECT 1.0 // 0;
+SELECT 'NaN'::numeric // 2;
+SELECT 'NaN'::numeric // 0;
+SELECT 'Infinity'::numeric // 0;
+SELECT 7 // 2;
+SELECT (-7) // 2;
+SELECT 7 // 0;
+SELECT (-2147483647 - 1) // (-1);
+SELECT 7::int8 // 2::int8;
+SELECT 7::int8 // 0::int8;
+SELECT (-9223372036854775807 - 1) // (-1)::int8;
+SELECT 7::float8 // 2::float8;
+SELECT 7::float8 // 0::float8;
+SELECT 1e308::float8 // 1e-10::float8;
+SELECT NULL::int4 // 2;
+SELECT pg_typeof(7 // 2), pg_typeof(7::int8 // 2::int8),
+       pg_typeof(7.0 // 2.0), pg_typeof(7::float8 // 2::float8);
+CREATE TABLE division_test (a int4, b numeric);
+INSERT INTO division_test VALUES (7, 7.5), (-7, NULL);
+EXPLAIN (VERBOSE, COSTS OFF)
+  SELECT a // 0, a // 2 FROM division_test;
+SELECT a // 0, a // 2, b // 0, b // 2.5 FROM division_test ORDER BY a;
+DROP TABLE division_test;
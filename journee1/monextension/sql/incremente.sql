@@ -1,2 +1,16 @@
 CREATE EXTENSION monextension;
 SELECT incremente(10);
+SELECT incremente(ARRAY[1, 2, 3]);
+SELECT incremente('{{1,2},{3,4}}'::int4[]);
+SELECT incremente(ARRAY[1, NULL, 3, NULL]);
+SELECT incremente('{}'::int4[]);
+SELECT incremente(ARRAY[9223372036854775806, NULL, -1]::int8[]);
+SELECT incremente(array_agg(i)) = array_agg(i + 1)
+  FROM generate_series(-1000, 1000) i;
+SELECT incremente(array_agg(CASE WHEN i % 7 = 0 THEN NULL ELSE i END))
+     = array_agg(CASE WHEN i % 7 = 0 THEN NULL ELSE i + 1 END)
+  FROM generate_series(1, 1000) i;
+SELECT incremente(array_agg(i::int8)) = array_agg(i::int8 + 1)
+  FROM generate_series(1, 1000) i;
+SELECT incremente(ARRAY[1, 2, 3, 4, 5, 6, 7, 8, 2147483647]);
+SELECT incremente(ARRAY[9223372036854775807]::int8[]);
@@ -0,0 +1,68 @@
+-- Checks that the libzip handles do not leak: calls the functions of the
+-- extension in a loop, half of them interrupted by an error or a LIMIT,
+-- and prints the RSS and the file descriptors of the backend, which must
+-- stay flat. Fails when, from the first sample to the last one, the RSS
+-- grew by more than max_growth_kB or a file descriptor was left open.
+-- Needs a superuser and an archive of at least two segments.
+--
+--   psql -f leaks.sql [-v iterations=5000] [-v max_growth_kb=1024]
+
+\if :{?iterations}
+\else
+  \set iterations 5000
+\endif
+\if :{?max_growth_kb}
+\else
+  \set max_growth_kb 1024
+\endif
+
+-- psql does not substitute its variables in a DO block
+SET leaks.iterations = :iterations;
+SET leaks.max_growth_kb = :max_growth_kb;
+
+CREATE TEMP VIEW ressources AS
+  SELECT (regexp_match(pg_read_file('/proc/self/status'), 'VmRSS:\s+(\d+)'))[1]::int AS rss_kb,
+         (SELECT count(*) FROM pg_ls_dir('/proc/self/fd')) AS fds;
+
+DO $$
+DECLARE
+  iterations int := current_setting('leaks.iterations')::int;
+  max_growth int := current_setting('leaks.max_growth_kb')::int;
+  -- ten samples, the first one after the caches are warm
+  intervalle int := GREATEST(iterations / 10, 1);
+  rss_debut  int;
+  fds_debut  bigint;
+  r          record;
+BEGIN
+  FOR i IN 1..iterations LOOP
+    -- SRF stopped before its end
+    PERFORM get_archived_wals() LIMIT 1;
+
+    -- error while the SRF is read
+    BEGIN
+      PERFORM 1 / ((w).index - 1) FROM (SELECT get_archived_wals() AS w) s;
+    EXCEPTION WHEN division_by_zero THEN
+      NULL;
+    END;
+
+    PERFORM * FROM get_archive_stats();
+
+    IF i % intervalle = 0 OR i = iterations THEN
+      SELECT * INTO r FROM ressources;
+      RAISE NOTICE 'iteration %: rss % kB, % fds', i, r.rss_kb, r.fds;
+      IF rss_debut IS NULL THEN
+        rss_debut := r.rss_kb;
+        fds_debut := r.fds;
+      END IF;
+    END IF;
+  END LOOP;
+
+  IF r.rss_kb - rss_debut > max_growth THEN
+    RAISE EXCEPTION 'rss grew by % kB, more than % kB',
+      r.rss_kb - rss_debut, max_growth;
+  END IF;
+  IF r.fds > fds_debut THEN
+    RAISE EXCEPTION '% file descriptors left open', r.fds - fds_debut;
+  END IF;
+END
+$$;
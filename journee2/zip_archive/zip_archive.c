@@ -6,10 +6,32 @@
 #include "utils/guc.h"
 #include "funcapi.h"
 #include "utils/timestamp.h"
+#include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "libpq/pqformat.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "postmaster/postmaster.h"
+#include "replication/slot.h"
+#include "replication/walreceiver.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* libzip header */
 #include <zip.h>
 
+/* USDT probes */
+#include "zip_archive_probes.h"
+
 /* module declaration */
 PG_MODULE_MAGIC;
 
@@ -36,22 +58,87 @@ static const struct config_enum_entry compression_methods[] = {
   {NULL, 0, false}
 };
 
+typedef enum EncryptionMethods
+{
+  NO_ENCRYPTION,
+  AES128,
+  AES192,
+  AES256
+} EncryptionMethod;
+
+static const struct config_enum_entry encryption_methods[] = {
+  {"none", NO_ENCRYPTION, false},
+  {"aes128", AES128, false},
+  {"aes192", AES192, false},
+  {"aes256", AES256, false},
+  {NULL, 0, false}
+};
+
+/*
+ * An open archive, discarded by a reset callback of the memory context it
+ * lives in unless it was closed before: an error, or an SRF that is not
+ * read until its end, does not leave the archive and its descriptor open.
+ */
+typedef struct
+{
+  zip_t                *ziparchive;
+  MemoryContextCallback callback;
+} ZipArchiveHandle;
+
 typedef struct
 {
-  TupleDesc  tupdesc;
-  zip_t     *ziparchive;
+  TupleDesc         tupdesc;
+  ZipArchiveHandle *handle;
 } ZipArchiveContext;
 
 /* variable definitions */
 static char *archive_directory = NULL;
 static int   compression_method = ZLIB;
+static int   encryption_method = NO_ENCRYPTION;
+static char *encryption_key = NULL;
+static char *encryption_key_file = NULL;
 static char  destination[MAXPGPATH];
+static MemoryContext archive_context = NULL;
+static bool  streaming = false;
+static char *streaming_conninfo = NULL;
+static char *streaming_slot = NULL;
+static int   streaming_flush_interval = 1000;
+
+/* set when the archiver and the streamer share the archive */
+static bool  archive_locked = false;
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+
+/* state of the streamer */
+static WalReceiverConn *stream_conn = NULL;
+static int        partial_fd = -1;
+static XLogSegNo  partial_segno = 0;
+static TimeLineID partial_tli = 0;
+static char       partial_name[MAXFNAMELEN];
+static char       partial_path[MAXPGPATH];
+static XLogRecPtr written_upto = InvalidXLogRecPtr;
+static XLogRecPtr flushed_upto = InvalidXLogRecPtr;
 
 /* function definitions */
 void        _PG_init(void);
 void        _PG_archive_module_init(ArchiveModuleCallbacks *cb);
 static bool zip_archive_configured(void);
 static bool zip_archive_file(const char *file, const char *path);
+static ZipArchiveHandle *zip_archive_open(MemoryContext context);
+static void zip_archive_close(ZipArchiveHandle *handle);
+static void zip_archive_discard(void *arg);
+static bool check_encryption_method(int *newval, void **extra, GucSource source);
+static zip_uint16_t zip_encryption(int method);
+static char *encryption_password(void);
+static void zip_archive_shmem_request(void);
+PGDLLEXPORT void zip_archive_stream_main(Datum main_arg) pg_attribute_noreturn();
+static XLogRecPtr stream_start_point(TimeLineID tli);
+static bool stream_read_slot(XLogRecPtr *restart_lsn, bool *logical);
+static void stream_process_message(char *buf, int len);
+static void stream_write(char *data, Size len, XLogRecPtr recptr);
+static void stream_open_segment(XLogRecPtr recptr);
+static void stream_close_segment(void);
+static void stream_flush(void);
+static void stream_send_feedback(void);
 PG_FUNCTION_INFO_V1(get_libzip_version);
 PG_FUNCTION_INFO_V1(get_archive_stats);
 PG_FUNCTION_INFO_V1(get_archived_wals);
@@ -61,7 +148,7 @@ PG_FUNCTION_INFO_V1(get_archived_wals);
 /*
  * _PG_init
  *
- * Declares our GUCs.
+ * Declares our GUCs, and registers the streamer when asked to.
  */
 void
 _PG_init(void)
@@ -85,9 +172,107 @@ _PG_init(void)
     0,
     NULL, NULL, NULL);
 
+  DefineCustomEnumVariable("zip_archive.encryption_method",
+    gettext_noop("Méthode utilisée pour le chiffrement."),
+    gettext_noop("Chiffrement AES de WinZip, la clé vient de encryption_key ou de encryption_key_file."),
+    &encryption_method,
+    NO_ENCRYPTION,
+    encryption_methods,
+    PGC_SIGHUP,
+    0,
+    check_encryption_method, NULL, NULL);
+
+  DefineCustomStringVariable("zip_archive.encryption_key",
+    gettext_noop("Mot de passe du chiffrement."),
+    NULL,
+    &encryption_key,
+    "",
+    PGC_SIGHUP,
+    GUC_SUPERUSER_ONLY | GUC_NO_SHOW_ALL,
+    NULL, NULL, NULL);
+
+  DefineCustomStringVariable("zip_archive.encryption_key_file",
+    gettext_noop("Fichier contenant le mot de passe du chiffrement."),
+    gettext_noop("Utilisé quand encryption_key est vide, seule sa première ligne est lue."),
+    &encryption_key_file,
+    "",
+    PGC_SIGHUP,
+    GUC_SUPERUSER_ONLY,
+    NULL, NULL, NULL);
+
+  DefineCustomBoolVariable("zip_archive.streaming",
+    gettext_noop("Archive en continu les journaux reçus du walsender local."),
+    gettext_noop("Nécessite de charger zip_archive via shared_preload_libraries."),
+    &streaming,
+    false,
+    PGC_POSTMASTER,
+    0,
+    NULL, NULL, NULL);
+
+  DefineCustomStringVariable("zip_archive.streaming_conninfo",
+    gettext_noop("Chaîne de connexion au walsender local."),
+    gettext_noop("Par défaut, le port de l'instance sur le socket Unix."),
+    &streaming_conninfo,
+    "",
+    PGC_SIGHUP,
+    GUC_SUPERUSER_ONLY,
+    NULL, NULL, NULL);
+
+  DefineCustomStringVariable("zip_archive.streaming_slot",
+    gettext_noop("Slot de réplication physique utilisé par l'archivage en continu."),
+    NULL,
+    &streaming_slot,
+    "zip_archive",
+    PGC_POSTMASTER,
+    0,
+    NULL, NULL, NULL);
+
+  DefineCustomIntVariable("zip_archive.streaming_flush_interval",
+    gettext_noop("Délai entre deux synchronisations sur disque du segment partiel."),
+    NULL,
+    &streaming_flush_interval,
+    1000,
+    10,
+    60000,
+    PGC_SIGHUP,
+    GUC_UNIT_MS,
+    NULL, NULL, NULL);
+
   MarkGUCPrefixReserved("zip_archive");
 
   zip_archive_configured();
+
+  /*
+   * The streamer writes the archive besides the archiver, a lock in shared
+   * memory serializes them.
+   */
+  if (streaming && process_shared_preload_libraries_in_progress)
+  {
+    BackgroundWorker worker;
+
+    archive_locked = true;
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = zip_archive_shmem_request;
+
+    memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+    worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+    worker.bgw_restart_time = 10;
+    strcpy(worker.bgw_library_name, "zip_archive");
+    strcpy(worker.bgw_function_name, "zip_archive_stream_main");
+    strcpy(worker.bgw_name, "zip_archive streamer");
+    strcpy(worker.bgw_type, "zip_archive streamer");
+    RegisterBackgroundWorker(&worker);
+  }
+}
+
+static void
+zip_archive_shmem_request(void)
+{
+  if (prev_shmem_request_hook)
+    prev_shmem_request_hook();
+
+  RequestNamedLWLockTranche("zip_archive", 1);
 }
 
 /*
@@ -143,6 +328,25 @@ zip_archive_file(const char *file, const char *path)
   int           index;
   int           compression;
   char          comment[200];
+  LWLock       *lock = NULL;
+  struct zip_stat zipstat;
+  ZipArchiveHandle *handle;
+
+  ZIP_ARCHIVE_PROBE1(archive__start, file);
+
+  /* the process may survive an error of the previous call */
+  if (archive_context == NULL)
+    archive_context = AllocSetContextCreate(TopMemoryContext,
+                                            "zip_archive",
+                                            ALLOCSET_SMALL_SIZES);
+  else
+    MemoryContextReset(archive_context);
+
+  if (archive_locked)
+  {
+    lock = &(GetNamedLWLockTranche("zip_archive"))->lock;
+    LWLockAcquire(lock, LW_EXCLUSIVE);
+  }
 
   elog(LOG, "archiving \"%s\" via zip_archive", file);
 
@@ -152,21 +356,47 @@ zip_archive_file(const char *file, const char *path)
     snprintf(comment, strlen(comment)+14+strlen(cluster_name), "%s for %s cluster", comment, cluster_name);
   }
 
-  ziparchive = zip_open(destination, ZIP_CREATE, &error);
-  if (!ziparchive)
-  {
-    zip_error_t ziperror;
-    zip_error_init_with_code(&ziperror, error);
-    elog(ERROR, "cannot open zip archive '%s': %s\n", destination, zip_error_strerror(&ziperror));
-    // ne va pas être exécuté
-    zip_error_fini(&ziperror);
-  }
+  ZIP_ARCHIVE_PROBE1(open__start, destination);
+  handle = zip_archive_open(archive_context);
+  ziparchive = handle->ziparchive;
 
   error = zip_set_archive_comment(ziparchive, comment, strlen(comment));
   if (error)
   {
     elog(ERROR, "cannot set archive comment %s: %s\n", comment, zip_strerror(ziparchive));
   }
+  ZIP_ARCHIVE_PROBE1(open__done, destination);
+
+  /*
+   * The streamer and the archiver both archive complete segments, the
+   * second one finds the entry of the first one.
+   */
+  if (zip_stat(ziparchive, file, 0, &zipstat) == 0)
+  {
+    struct stat filestat;
+
+    if (stat(path, &filestat) != 0)
+      ereport(ERROR,
+          (errcode_for_file_access(),
+           errmsg("could not stat file \"%s\": %m", path)));
+
+    if ((zipstat.valid & ZIP_STAT_SIZE) && zipstat.size == (zip_uint64_t) filestat.st_size)
+    {
+      MemoryContextReset(archive_context);
+      if (lock)
+        LWLockRelease(lock);
+
+      elog(LOG, "\"%s\" already archived via zip_archive", file);
+
+      ZIP_ARCHIVE_PROBE1(archive__done, file);
+
+      return true;
+    }
+
+    elog(ERROR, "\"%s\" already archived in '%s' with another size", file, destination);
+  }
+
+  ZIP_ARCHIVE_PROBE1(add__start, file);
 
   // arg3, start at index 0
   // arg4, len 0 for the whole file
@@ -179,8 +409,13 @@ zip_archive_file(const char *file, const char *path)
   index = zip_file_add(ziparchive, file, zipsource, ZIP_FL_ENC_GUESS);
   if (index < 0)
   {
+    /* the archive only owns the source once added */
+    zip_source_free(zipsource);
     elog(ERROR, "cannot add file '%s': %s\n", file, zip_strerror(ziparchive));
   }
+  ZIP_ARCHIVE_PROBE2(add__done, file, index);
+
+  ZIP_ARCHIVE_PROBE1(compression__start, compression_method);
 
   switch(compression_method)
   {
@@ -209,18 +444,188 @@ zip_archive_file(const char *file, const char *path)
       (compression_methods[compression_method]).name,
       zip_strerror(ziparchive));
   }
+  ZIP_ARCHIVE_PROBE1(compression__done, compression_method);
 
-  error = zip_close(ziparchive);
-  if (error)
+  /*
+   * libzip encrypts each compressed block as it leaves the compression
+   * layer, in zip_close, so both run as one pass over the segment.
+   */
+  if (encryption_method != NO_ENCRYPTION)
   {
-    elog(ERROR, "cannot close zip archive '%s': %s\n", destination, zip_strerror(ziparchive));
+    char *password = encryption_password();
+
+    error = zip_file_set_encryption(ziparchive, index,
+                                    zip_encryption(encryption_method), password);
+    explicit_bzero(password, strlen(password));
+    pfree(password);
+    if (error)
+    {
+      elog(ERROR, "cannot set encryption method '%s': %s\n",
+        (encryption_methods[encryption_method]).name,
+        zip_strerror(ziparchive));
+    }
   }
 
+  /* the file is only read, compressed and written here */
+  ZIP_ARCHIVE_PROBE1(close__start, destination);
+  zip_archive_close(handle);
+  ZIP_ARCHIVE_PROBE1(close__done, destination);
+
+  if (lock)
+    LWLockRelease(lock);
+
   elog(LOG, "archived \"%s\" via zip_archive", file);
 
+  ZIP_ARCHIVE_PROBE1(archive__done, file);
+
+  return true;
+}
+
+/*
+ * zip_archive_open
+ *
+ * Opens the archive, which is discarded at the latest when the memory
+ * context is reset or deleted.
+ */
+static ZipArchiveHandle *
+zip_archive_open(MemoryContext context)
+{
+  ZipArchiveHandle *handle;
+  int               error;
+
+  handle = MemoryContextAllocZero(context, sizeof(ZipArchiveHandle));
+
+  handle->ziparchive = zip_open(destination, ZIP_CREATE, &error);
+  if (!handle->ziparchive)
+  {
+    zip_error_t ziperror;
+    char       *message;
+
+    zip_error_init_with_code(&ziperror, error);
+    message = pstrdup(zip_error_strerror(&ziperror));
+    zip_error_fini(&ziperror);
+    elog(ERROR, "cannot open zip archive '%s': %s\n", destination, message);
+  }
+
+  handle->callback.func = zip_archive_discard;
+  handle->callback.arg = handle;
+  MemoryContextRegisterResetCallback(context, &handle->callback);
+
+  return handle;
+}
+
+/*
+ * zip_archive_close
+ *
+ * Writes the changes of the archive. On failure, the archive stays open
+ * for the reset callback.
+ */
+static void
+zip_archive_close(ZipArchiveHandle *handle)
+{
+  if (zip_close(handle->ziparchive) != 0)
+  {
+    elog(ERROR, "cannot close zip archive '%s': %s\n", destination, zip_strerror(handle->ziparchive));
+  }
+  handle->ziparchive = NULL;
+}
+
+/*
+ * zip_archive_discard
+ *
+ * Closes the archive without writing its changes, if still open.
+ */
+static void
+zip_archive_discard(void *arg)
+{
+  ZipArchiveHandle *handle = (ZipArchiveHandle *) arg;
+
+  if (handle->ziparchive)
+  {
+    zip_discard(handle->ziparchive);
+    handle->ziparchive = NULL;
+  }
+}
+
+/*
+ * check_encryption_method
+ *
+ * Checks that libzip was built with a crypto library able to encrypt.
+ */
+static bool
+check_encryption_method(int *newval, void **extra, GucSource source)
+{
+  if (*newval != NO_ENCRYPTION &&
+      !zip_encryption_method_supported(zip_encryption(*newval), 1))
+  {
+    GUC_check_errdetail("libzip %s cannot encrypt with %s.",
+                        zip_libzip_version(),
+                        (encryption_methods[*newval]).name);
+    return false;
+  }
+
   return true;
 }
 
+static zip_uint16_t
+zip_encryption(int method)
+{
+  switch (method)
+  {
+    case AES128:
+      return ZIP_EM_AES_128;
+    case AES192:
+      return ZIP_EM_AES_192;
+    case AES256:
+      return ZIP_EM_AES_256;
+  }
+
+  return ZIP_EM_NONE;
+}
+
+/*
+ * encryption_password
+ *
+ * Returns the password, from encryption_key or else from the first line
+ * of encryption_key_file, read at each archive so that it can be rotated.
+ */
+static char *
+encryption_password(void)
+{
+  FILE *file;
+  char  line[1024];
+  char *password;
+
+  if (encryption_key != NULL && encryption_key[0] != '\0')
+    return pstrdup(encryption_key);
+
+  if (encryption_key_file == NULL || encryption_key_file[0] == '\0')
+    ereport(ERROR,
+        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+         errmsg("zip_archive.encryption_method is set but no key is given")));
+
+  file = AllocateFile(encryption_key_file, "r");
+  if (file == NULL)
+    ereport(ERROR,
+        (errcode_for_file_access(),
+         errmsg("could not open file \"%s\": %m", encryption_key_file)));
+
+  if (fgets(line, sizeof(line), file) == NULL)
+    line[0] = '\0';
+  FreeFile(file);
+
+  line[strcspn(line, "\r\n")] = '\0';
+  if (line[0] == '\0')
+    ereport(ERROR,
+        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+         errmsg("key file \"%s\" is empty", encryption_key_file)));
+
+  password = pstrdup(line);
+  explicit_bzero(line, sizeof(line));
+
+  return password;
+}
+
 /*
  * get_libzip_version
  *
@@ -248,8 +653,8 @@ get_archive_stats(PG_FUNCTION_ARGS)
   bool            nulls[5];
   HeapTuple       tuple;
   Datum           result;
+  ZipArchiveHandle *handle;
   zip_t          *ziparchive;
-  int             error;
   zip_int64_t     entries_count;
   struct zip_stat zipstat;
 
@@ -259,16 +664,9 @@ get_archive_stats(PG_FUNCTION_ARGS)
         (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
          errmsg("function returning record called in context that cannot accept type record")));
 
-  /* open ZIP archive */
-  ziparchive = zip_open(destination, ZIP_CREATE, &error);
-  if (!ziparchive)
-  {
-    zip_error_t ziperror;
-    zip_error_init_with_code(&ziperror, error);
-    elog(ERROR, "cannot open zip archive '%s': %s\n", destination, zip_error_strerror(&ziperror));
-    // ne va pas être exécuté
-    zip_error_fini(&ziperror);
-  }
+  /* open ZIP archive, discarded by the end of the query on error */
+  handle = zip_archive_open(CurrentMemoryContext);
+  ziparchive = handle->ziparchive;
 
   /* get number of files in ZIP archive */
   entries_count = zip_get_num_entries(ziparchive, 0);
@@ -304,6 +702,9 @@ get_archive_stats(PG_FUNCTION_ARGS)
     values[4] = TimestampTzGetDatum(time_t_to_timestamptz(zipstat.mtime));
   }
 
+  /* the values are copies, the archive is no longer needed */
+  zip_archive_discard(handle);
+
   /* build tuple */
   tuple = heap_form_tuple(tupdesc, values, nulls);
   result = HeapTupleGetDatum(tuple);
@@ -325,7 +726,6 @@ get_archived_wals(PG_FUNCTION_ARGS)
   ZipArchiveContext *fctx;
   int                call_cntr;
   int                max_calls;
-  int                error;
   struct zip_stat    zipstat;
 
   if (SRF_IS_FIRSTCALL())
@@ -348,19 +748,14 @@ get_archived_wals(PG_FUNCTION_ARGS)
            errmsg("function returning record called in context that cannot accept type record")));
     fctx->tupdesc = BlessTupleDesc(tupdesc);
 
-    /* open ZIP archive */
-    fctx->ziparchive = zip_open(destination, ZIP_CREATE, &error);
-    if (!(fctx->ziparchive))
-    {
-      zip_error_t ziperror;
-      zip_error_init_with_code(&ziperror, error);
-      elog(ERROR, "cannot open zip archive '%s': %s\n", destination, zip_error_strerror(&ziperror));
-      // ne va pas être exécuté
-      zip_error_fini(&ziperror);
-    }
+    /*
+     * open ZIP archive, discarded with the multi-call context at the end of
+     * the SRF, on error or when the SRF is not read until its end
+     */
+    fctx->handle = zip_archive_open(funcctx->multi_call_memory_ctx);
 
     /* set max_calls as a count of files in ZIP archive */
-    max_calls = zip_get_num_entries(fctx->ziparchive, 0);
+    max_calls = zip_get_num_entries(fctx->handle->ziparchive, 0);
 
     if (max_calls > 0)
     {
@@ -397,7 +792,7 @@ get_archived_wals(PG_FUNCTION_ARGS)
     int       compression;
 
     /* get file stats in ZIP archive */
-    zip_stat_index(fctx->ziparchive, call_cntr, 0, &zipstat);
+    zip_stat_index(fctx->handle->ziparchive, call_cntr, 0, &zipstat);
 
     /* column 1 is index number */
     nulls[0] = !(zipstat.valid && ZIP_STAT_INDEX);
@@ -486,3 +881,391 @@ get_archived_wals(PG_FUNCTION_ARGS)
   /* all done */
   SRF_RETURN_DONE(funcctx);
 }
+
+/*
+ * zip_archive_stream_main
+ *
+ * Main loop of the streamer: receives the WAL from the local walsender
+ * through a physical slot, writes it in a partial segment of the archive
+ * directory synchronized every streaming_flush_interval, and adds the
+ * segment to the ZIP archive as soon as it is complete. A partial segment
+ * is a plain file, since libzip can only write an entry at once.
+ */
+void
+zip_archive_stream_main(Datum main_arg)
+{
+  char                conninfo[MAXCONNINFO];
+  char               *err;
+  TimeLineID          tli;
+  WalRcvStreamOptions options;
+  TimestampTz         last_flush;
+
+  pqsignal(SIGHUP, SignalHandlerForConfigReload);
+  pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+  BackgroundWorkerUnblockSignals();
+
+  if (!zip_archive_configured())
+    ereport(ERROR,
+        (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+         errmsg("zip_archive.archive_directory is not set")));
+
+  load_file("libpqwalreceiver", false);
+  if (WalReceiverFunctions == NULL)
+    elog(ERROR, "libpqwalreceiver didn't initialize correctly");
+
+  if (streaming_conninfo[0] != '\0')
+    strlcpy(conninfo, streaming_conninfo, sizeof(conninfo));
+  else
+    snprintf(conninfo, sizeof(conninfo), "port=%d", PostPortNumber);
+
+  stream_conn = walrcv_connect(conninfo, false, "zip_archive", &err);
+  if (stream_conn == NULL)
+    ereport(ERROR,
+        (errcode(ERRCODE_CONNECTION_FAILURE),
+         errmsg("could not connect to the walsender: %s", err)));
+
+  (void) walrcv_identify_system(stream_conn, &tli);
+
+  options.logical = false;
+  options.slotname = streaming_slot;
+  options.startpoint = stream_start_point(tli);
+  options.proto.physical.startpointTLI = tli;
+
+  if (!walrcv_startstreaming(stream_conn, &options))
+    ereport(ERROR,
+        (errmsg("timeline %u ended before %X/%X", tli,
+                LSN_FORMAT_ARGS(options.startpoint))));
+
+  elog(LOG, "zip_archive streaming from %X/%X on timeline %u",
+       LSN_FORMAT_ARGS(options.startpoint), tli);
+
+  partial_tli = tli;
+  written_upto = flushed_upto = options.startpoint;
+  last_flush = GetCurrentTimestamp();
+
+  while (!ShutdownRequestPending)
+  {
+    char          *buf;
+    pgsocket       wait_fd;
+    int            len;
+    long           timeout;
+    TimestampTz    now;
+
+    ResetLatch(MyLatch);
+
+    if (ConfigReloadPending)
+    {
+      ConfigReloadPending = false;
+      ProcessConfigFile(PGC_SIGHUP);
+      zip_archive_configured();
+    }
+
+    while ((len = walrcv_receive(stream_conn, &buf, &wait_fd)) != 0)
+    {
+      if (len < 0)
+        ereport(ERROR,
+            (errmsg("replication terminated by the walsender at %X/%X",
+                    LSN_FORMAT_ARGS(written_upto))));
+
+      stream_process_message(buf, len);
+    }
+
+    /* the feedback also keeps the connection alive */
+    now = GetCurrentTimestamp();
+    if (TimestampDifferenceExceeds(last_flush, now, streaming_flush_interval))
+    {
+      stream_flush();
+      stream_send_feedback();
+      last_flush = now;
+    }
+
+    timeout = TimestampDifferenceMilliseconds(now,
+                TimestampTzPlusMilliseconds(last_flush, streaming_flush_interval));
+
+    (void) WaitLatchOrSocket(MyLatch,
+                             WL_LATCH_SET | WL_SOCKET_READABLE | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                             wait_fd,
+                             timeout,
+                             PG_WAIT_EXTENSION);
+  }
+
+  /* the partial segment is taken back by the next start */
+  stream_flush();
+  stream_send_feedback();
+  if (partial_fd >= 0)
+    CloseTransientFile(partial_fd);
+  walrcv_disconnect(stream_conn);
+
+  proc_exit(0);
+}
+
+/*
+ * stream_start_point
+ *
+ * Archives the complete segments left by a previous run, then returns the
+ * end of the last partial segment of the timeline. Without one, streaming
+ * starts at the segment of the restart point of the slot, created if
+ * needed.
+ */
+static XLogRecPtr
+stream_start_point(TimeLineID tli)
+{
+  DIR              *dir;
+  struct dirent    *de;
+  XLogRecPtr        startpoint = InvalidXLogRecPtr;
+  bool              logical;
+  XLogSegNo         segno;
+
+  dir = AllocateDir(archive_directory);
+  while ((de = ReadDir(dir, archive_directory)) != NULL)
+  {
+    char        path[MAXPGPATH];
+    char        name[MAXFNAMELEN];
+    struct stat filestat;
+    TimeLineID  file_tli;
+    XLogRecPtr  end;
+
+    if (!IsPartialXLogFileName(de->d_name))
+      continue;
+
+    snprintf(path, sizeof(path), "%s/%s", archive_directory, de->d_name);
+    if (stat(path, &filestat) != 0)
+      ereport(ERROR,
+          (errcode_for_file_access(),
+           errmsg("could not stat file \"%s\": %m", path)));
+
+    strlcpy(name, de->d_name, XLOG_FNAME_LEN + 1);
+    XLogFromFileName(name, &file_tli, &segno, wal_segment_size);
+
+    if (filestat.st_size >= wal_segment_size)
+    {
+      zip_archive_file(name, path);
+      if (unlink(path) != 0)
+        ereport(ERROR,
+            (errcode_for_file_access(),
+             errmsg("could not remove file \"%s\": %m", path)));
+      continue;
+    }
+
+    XLogSegNoOffsetToRecPtr(segno, filestat.st_size, wal_segment_size, end);
+    if (file_tli == tli && end > startpoint)
+      startpoint = end;
+  }
+  FreeDir(dir);
+
+  if (!XLogRecPtrIsInvalid(startpoint))
+    return startpoint;
+
+  if (!stream_read_slot(&startpoint, &logical))
+  {
+    /*
+     * CREATE_REPLICATION_SLOT returns no position for a physical slot: the
+     * WAL it reserved starts at its restart_lsn.
+     */
+    walrcv_create_slot(stream_conn, streaming_slot, false, false,
+                       CRS_NOEXPORT_SNAPSHOT, NULL);
+    elog(LOG, "zip_archive created replication slot \"%s\"", streaming_slot);
+
+    if (!stream_read_slot(&startpoint, &logical))
+      ereport(ERROR,
+          (errcode(ERRCODE_UNDEFINED_OBJECT),
+           errmsg("replication slot \"%s\" does not exist", streaming_slot)));
+  }
+
+  if (logical || XLogRecPtrIsInvalid(startpoint))
+    ereport(ERROR,
+        (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+         errmsg("replication slot \"%s\" is not a physical slot reserving WAL",
+                streaming_slot)));
+
+  XLByteToSeg(startpoint, segno, wal_segment_size);
+  XLogSegNoOffsetToRecPtr(segno, 0, wal_segment_size, startpoint);
+
+  return startpoint;
+}
+
+/*
+ * stream_read_slot
+ *
+ * Copies the restart point and the kind of the streaming slot, read under
+ * the locks, and returns whether it exists.
+ */
+static bool
+stream_read_slot(XLogRecPtr *restart_lsn, bool *logical)
+{
+  ReplicationSlot *slot;
+
+  LWLockAcquire(ReplicationSlotControlLock, LW_SHARED);
+  slot = SearchNamedReplicationSlot(streaming_slot, false);
+  if (slot != NULL)
+  {
+    SpinLockAcquire(&slot->mutex);
+    *restart_lsn = slot->data.restart_lsn;
+    *logical = SlotIsLogical(slot);
+    SpinLockRelease(&slot->mutex);
+  }
+  LWLockRelease(ReplicationSlotControlLock);
+
+  return slot != NULL;
+}
+
+/*
+ * stream_process_message
+ *
+ * Handles a message of the walsender: WAL data or keepalive.
+ */
+static void
+stream_process_message(char *buf, int len)
+{
+  StringInfoData message;
+  XLogRecPtr     data_start;
+
+  message.data = buf;
+  message.len = len;
+  message.maxlen = len;
+  message.cursor = 1;
+
+  switch (buf[0])
+  {
+    case 'w':
+      data_start = pq_getmsgint64(&message);
+      (void) pq_getmsgint64(&message);    /* walEnd */
+      (void) pq_getmsgint64(&message);    /* sendTime */
+      stream_write(buf + message.cursor, len - message.cursor, data_start);
+      break;
+    case 'k':
+      (void) pq_getmsgint64(&message);    /* walEnd */
+      (void) pq_getmsgint64(&message);    /* sendTime */
+      if (pq_getmsgbyte(&message))
+        stream_send_feedback();
+      break;
+    default:
+      ereport(ERROR,
+          (errcode(ERRCODE_PROTOCOL_VIOLATION),
+           errmsg("unexpected message type \"%c\" from the walsender", buf[0])));
+  }
+}
+
+/*
+ * stream_write
+ *
+ * Writes WAL in the partial segments, archiving each one as it becomes
+ * complete.
+ */
+static void
+stream_write(char *data, Size len, XLogRecPtr recptr)
+{
+  while (len > 0)
+  {
+    uint32 offset;
+    Size   count;
+
+    if (partial_fd < 0)
+      stream_open_segment(recptr);
+
+    offset = XLogSegmentOffset(recptr, wal_segment_size);
+    count = Min(len, wal_segment_size - offset);
+
+    errno = 0;
+    if (pg_pwrite(partial_fd, data, count, offset) != (ssize_t) count)
+    {
+      if (errno == 0)
+        errno = ENOSPC;
+      ereport(ERROR,
+          (errcode_for_file_access(),
+           errmsg("could not write to file \"%s\": %m", partial_path)));
+    }
+
+    data += count;
+    len -= count;
+    recptr += count;
+    written_upto = recptr;
+
+    if (XLogSegmentOffset(recptr, wal_segment_size) == 0)
+      stream_close_segment();
+  }
+}
+
+static void
+stream_open_segment(XLogRecPtr recptr)
+{
+  XLByteToSeg(recptr, partial_segno, wal_segment_size);
+  XLogFileName(partial_name, partial_tli, partial_segno, wal_segment_size);
+  snprintf(partial_path, sizeof(partial_path), "%s/%s.partial",
+           archive_directory, partial_name);
+
+  partial_fd = OpenTransientFile(partial_path, O_RDWR | O_CREAT | PG_BINARY);
+  if (partial_fd < 0)
+    ereport(ERROR,
+        (errcode_for_file_access(),
+         errmsg("could not open file \"%s\": %m", partial_path)));
+
+  fsync_fname(archive_directory, true);
+}
+
+/*
+ * stream_close_segment
+ *
+ * Archives a complete segment, then removes its partial file.
+ */
+static void
+stream_close_segment(void)
+{
+  if (pg_fsync(partial_fd) != 0)
+    ereport(ERROR,
+        (errcode_for_file_access(),
+         errmsg("could not fsync file \"%s\": %m", partial_path)));
+  CloseTransientFile(partial_fd);
+  partial_fd = -1;
+
+  zip_archive_file(partial_name, partial_path);
+
+  if (unlink(partial_path) != 0)
+    ereport(ERROR,
+        (errcode_for_file_access(),
+         errmsg("could not remove file \"%s\": %m", partial_path)));
+
+  flushed_upto = written_upto;
+}
+
+/*
+ * stream_flush
+ *
+ * Makes the partial segment durable, the slot may then release its WAL.
+ */
+static void
+stream_flush(void)
+{
+  if (partial_fd < 0 || flushed_upto >= written_upto)
+    return;
+
+  if (pg_fsync(partial_fd) != 0)
+    ereport(ERROR,
+        (errcode_for_file_access(),
+         errmsg("could not fsync file \"%s\": %m", partial_path)));
+
+  flushed_upto = written_upto;
+}
+
+/*
+ * stream_send_feedback
+ *
+ * Sends a standby status update. The flush position is what the archive
+ * directory holds durably, it advances the slot.
+ */
+static void
+stream_send_feedback(void)
+{
+  StringInfoData reply;
+
+  initStringInfo(&reply);
+  pq_sendbyte(&reply, 'r');
+  pq_sendint64(&reply, written_upto);
+  pq_sendint64(&reply, flushed_upto);
+  pq_sendint64(&reply, InvalidXLogRecPtr);
+  pq_sendint64(&reply, GetCurrentTimestamp());
+  pq_sendbyte(&reply, 0);
+
+  walrcv_send(stream_conn, reply.data, reply.len);
+  pfree(reply.data);
+}
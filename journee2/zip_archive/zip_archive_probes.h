@@ -0,0 +1,26 @@
+/*
+ * zip_archive_probes.h
+ *
+ * USDT probes of zip_archive, used by the scripts of bpftrace/. They need
+ * <sys/sdt.h> (systemtap-sdt-dev or systemtap-sdt-devel), and are compiled
+ * out without it. An enabled probe is a single nop until a tracer attaches.
+ */
+#ifndef ZIP_ARCHIVE_PROBES_H
+#define ZIP_ARCHIVE_PROBES_H
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define ZIP_ARCHIVE_USDT
+#endif
+#endif
+
+#ifdef ZIP_ARCHIVE_USDT
+#define ZIP_ARCHIVE_PROBE1(name, a) DTRACE_PROBE1(zip_archive, name, a)
+#define ZIP_ARCHIVE_PROBE2(name, a, b) DTRACE_PROBE2(zip_archive, name, a, b)
+#else
+#define ZIP_ARCHIVE_PROBE1(name, a) ((void) 0)
+#define ZIP_ARCHIVE_PROBE2(name, a, b) ((void) 0)
+#endif
+
+#endif                          /* ZIP_ARCHIVE_PROBES_H */
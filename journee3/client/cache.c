@@ -0,0 +1,235 @@
+/*
+ * cache, results of read-only queries kept by client
+ *
+ * The results are kept in memory, keyed by the text of the query and the
+ * values of its parameters. The connection listens on channels declared by
+ * the user, notified by triggers on the tables read by the queries: any
+ * notification on one of them drops every result, and the next call runs
+ * the query again.
+ *
+ * The notifications are read before looking up a result, and LISTEN is run
+ * before the first query, so that no notification sent after the snapshot
+ * of a kept result is missed. One still on its way when the input is read
+ * is only seen at the next call: until then, the stale result is returned.
+ *
+ * The connection runs its transactions read-only, so that the server
+ * rejects the queries that write, a data-modifying WITH included. The
+ * queries must not depend on anything else than the tables of the
+ * channels, like now() or random().
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include "postgres_fe.h"
+#include "common/hashfn.h"
+#include "common/logging.h"
+#include "lib/stringinfo.h"
+
+#include "cache.h"
+
+/* number of buckets, a power of 2 */
+#define CACHE_BUCKETS 64
+
+typedef struct CacheEntry
+{
+  struct CacheEntry *next;
+  uint32        hash;
+  char         *key;            /* query, then each value, ended by '\0' */
+  int           keylen;
+  PGresult     *result;
+} CacheEntry;
+
+struct ResultCache
+{
+  PGconn       *conn;
+  CacheEntry   *buckets[CACHE_BUCKETS];
+  PGresult     *uncached;       /* last result not kept */
+  int64         hits;
+  int64         misses;
+};
+
+static void cache_invalidate(ResultCache *cache);
+static bool cache_poll(ResultCache *cache);
+
+/*
+ * cache_create
+ *
+ * Makes the connection read-only and listens on the channels, exits on
+ * error.
+ */
+ResultCache *
+cache_create(PGconn *conn, const SimpleStringList *channels)
+{
+  ResultCache *cache = pg_malloc0(sizeof(ResultCache));
+  PGresult    *res;
+
+  cache->conn = conn;
+
+  res = PQexec(conn, "SET default_transaction_read_only = on");
+  if (PQresultStatus(res) != PGRES_COMMAND_OK)
+    pg_fatal("could not make the connection read-only: %s", PQerrorMessage(conn));
+  PQclear(res);
+
+  for (SimpleStringListCell *cell = channels->head; cell; cell = cell->next)
+  {
+    char     *channel;
+    char     *sql;
+
+    channel = PQescapeIdentifier(conn, cell->val, strlen(cell->val));
+    if (channel == NULL)
+      pg_fatal("could not quote channel \"%s\": %s", cell->val, PQerrorMessage(conn));
+
+    sql = psprintf("LISTEN %s", channel);
+    res = PQexec(conn, sql);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+      pg_fatal("could not listen on channel \"%s\": %s", cell->val, PQerrorMessage(conn));
+
+    pg_log_debug("listening on channel \"%s\"", cell->val);
+
+    PQclear(res);
+    pg_free(sql);
+    PQfreemem(channel);
+  }
+
+  return cache;
+}
+
+/*
+ * cache_poll
+ *
+ * Reads the pending notifications, drops every result if there is one.
+ * Returns false if the connection is broken.
+ */
+static bool
+cache_poll(ResultCache *cache)
+{
+  PGnotify *notify;
+  bool      notified = false;
+
+  if (!PQconsumeInput(cache->conn))
+    return false;
+
+  while ((notify = PQnotifies(cache->conn)) != NULL)
+  {
+    pg_log_debug("notification on channel \"%s\" from backend %d",
+                 notify->relname, notify->be_pid);
+    notified = true;
+    PQfreemem(notify);
+  }
+
+  if (notified)
+    cache_invalidate(cache);
+
+  return true;
+}
+
+static void
+cache_invalidate(ResultCache *cache)
+{
+  for (int i = 0; i < CACHE_BUCKETS; i++)
+  {
+    CacheEntry *entry = cache->buckets[i];
+
+    while (entry)
+    {
+      CacheEntry *next = entry->next;
+
+      PQclear(entry->result);
+      pg_free(entry->key);
+      pg_free(entry);
+      entry = next;
+    }
+    cache->buckets[i] = NULL;
+  }
+}
+
+/*
+ * cache_exec
+ *
+ * Returns the result of the query, run only if it is not kept. The result
+ * belongs to the cache and stays valid until the next call. Returns NULL
+ * with the error of the connection on failure.
+ */
+const PGresult *
+cache_exec(ResultCache *cache, const char *query, int nparams,
+           const char *const *values)
+{
+  StringInfoData   key;
+  uint32           hash;
+  CacheEntry     **bucket;
+  CacheEntry      *entry;
+  PGresult        *res;
+
+  PQclear(cache->uncached);
+  cache->uncached = NULL;
+
+  if (!cache_poll(cache))
+    return NULL;
+
+  initStringInfo(&key);
+  appendBinaryStringInfo(&key, query, strlen(query) + 1);
+  for (int i = 0; i < nparams; i++)
+  {
+    /* NULL and '' differ by a marker */
+    if (values[i] == NULL)
+      appendStringInfoChar(&key, '\1');
+    else
+      appendBinaryStringInfo(&key, values[i], strlen(values[i]) + 1);
+  }
+
+  hash = hash_bytes((const unsigned char *) key.data, key.len);
+  bucket = &cache->buckets[hash & (CACHE_BUCKETS - 1)];
+
+  for (entry = *bucket; entry; entry = entry->next)
+  {
+    if (entry->hash == hash && entry->keylen == key.len &&
+        memcmp(entry->key, key.data, key.len) == 0)
+    {
+      cache->hits++;
+      pfree(key.data);
+      return entry->result;
+    }
+  }
+
+  cache->misses++;
+  res = PQexecParams(cache->conn, query, nparams, NULL, values, NULL, NULL, 0);
+  if (PQresultStatus(res) != PGRES_TUPLES_OK)
+  {
+    pfree(key.data);
+    if (PQresultStatus(res) == PGRES_COMMAND_OK)
+    {
+      cache->uncached = res;
+      return res;
+    }
+    PQclear(res);
+    return NULL;
+  }
+
+  entry = pg_malloc(sizeof(CacheEntry));
+  entry->hash = hash;
+  entry->key = key.data;
+  entry->keylen = key.len;
+  entry->result = res;
+  entry->next = *bucket;
+  *bucket = entry;
+
+  return res;
+}
+
+void
+cache_stats(const ResultCache *cache, int64 *hits, int64 *misses)
+{
+  *hits = cache->hits;
+  *misses = cache->misses;
+}
+
+void
+cache_destroy(ResultCache *cache)
+{
+  cache_invalidate(cache);
+  PQclear(cache->uncached);
+  pg_free(cache);
+}
@@ -0,0 +1,22 @@
+/*
+ * cache, results of read-only queries kept by client
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "libpq-fe.h"
+#include "fe_utils/simple_list.h"
+
+typedef struct ResultCache ResultCache;
+
+extern ResultCache *cache_create(PGconn *conn, const SimpleStringList *channels);
+extern const PGresult *cache_exec(ResultCache *cache, const char *query,
+                                  int nparams, const char *const *values);
+extern void cache_stats(const ResultCache *cache, int64 *hits, int64 *misses);
+extern void cache_destroy(ResultCache *cache);
+
+#endif                          /* CACHE_H */
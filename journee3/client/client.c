@@ -1,6 +1,14 @@
 /*
  * client, testing software
  *
+ * Without a script, runs a query every second. With -l, its result is kept
+ * until a notification on one of the channels (see cache.c). With -f, runs
+ * a script (see script.c) in a loop on CLIENTS connections, one thread
+ * each, during SECS seconds, then reports the throughput. With -w, samples
+ * the wait events of the instance instead (see sampler.c). With -x or -b,
+ * exports a large value on JOBS connections (see export.c). With -L,
+ * benchmarks LISTEN/NOTIFY with CLIENTS notifiers (see notify.c).
+ *
  * This software is released under the PostgreSQL Licence.
  *
  * Guillaume Lelarge, guillaume@lelarge.info, 2023.
@@ -9,37 +17,251 @@
 
 // #include
 #include "libpq-fe.h"
+#include <pthread.h>
 #include "postgres_fe.h"
 #include "common/logging.h"
 #include "common/string.h"
+#include "fe_utils/option_utils.h"
+#include "fe_utils/simple_list.h"
+#include "getopt_long.h"
+#include "portability/instr_time.h"
+
+#include "cache.h"
+#include "export.h"
+#include "notify.h"
+#include "sampler.h"
+#include "script.h"
+
+/* a thread running one client of a script */
+typedef struct ClientThread
+{
+  pthread_t     thread;
+  ScriptClient *client;
+  double        duration;
+  bool          failed;
+} ClientThread;
+
+static void help(const char *progname);
+static PGconn *connect_client(const char *conninfo, char **password);
+static void run_query(PGconn *conn, const char *query);
+static void run_cached_query(PGconn *conn, const char *query,
+                             const SimpleStringList *channels);
+static bool run_script(const char *path, const char *conninfo, int nclients,
+                       int duration);
+static void *client_thread(void *arg);
 
 int
 main(int argc, char **argv)
 {
-  char     *conninfo;
-  PGconn   *conn;
-  char     *password = NULL;
-  bool      new_password;
-  char     *query;
-  PGresult *res;
-  int       res_async;
+  const char *progname;
+  static struct option long_options[] = {
+    {"file", required_argument, NULL, 'f'},
+    {"listen", required_argument, NULL, 'l'},
+    {"clients", required_argument, NULL, 'c'},
+    {"time", required_argument, NULL, 'T'},
+    {"wait-sampling", required_argument, NULL, 'w'},
+    {"output", required_argument, NULL, 'o'},
+    {"report-interval", required_argument, NULL, 'r'},
+    {"export", required_argument, NULL, 'x'},
+    {"export-bytea", required_argument, NULL, 'b'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"chunk-size", required_argument, NULL, 1},
+    {"listeners", required_argument, NULL, 'L'},
+    {"rate", required_argument, NULL, 'R'},
+    {NULL, 0, NULL, 0}
+  };
+  int         optindex;
+  int         c;
+  char       *file = NULL;
+  int         nclients = 1;
+  int         duration = 10;
+  int         frequency = 0;
+  int         report_interval = 1;
+  char       *output = NULL;
+  Oid         export_oid = InvalidOid;
+  char       *export_query = NULL;
+  int         njobs = 1;
+  int         chunk_size = 1024;
+  int         nlisteners = 0;
+  int         rate = 0;
+  const char *conninfo = "";
+  const char *query = "SELECT version()";
+  char       *password = NULL;
+  PGconn     *conn;
+  SimpleStringList channels = {NULL, NULL};
 
   pg_logging_init(argv[0]);
+  progname = get_progname(argv[0]);
+
+  handle_help_version_opts(argc, argv, "client", help);
+
+  // Get options
+  while ((c = getopt_long(argc, argv, "b:c:f:j:l:L:o:r:R:T:w:x:", long_options, &optindex)) != -1)
+  {
+    switch (c)
+    {
+      case 'b':
+        export_query = pg_strdup(optarg);
+        break;
+      case 'c':
+        if (!option_parse_int(optarg, "-c/--clients", 1, 1024, &nclients))
+          exit(1);
+        break;
+      case 'f':
+        file = pg_strdup(optarg);
+        break;
+      case 'j':
+        if (!option_parse_int(optarg, "-j/--jobs", 1, 64, &njobs))
+          exit(1);
+        break;
+      case 'l':
+        simple_string_list_append(&channels, optarg);
+        break;
+      case 'L':
+        if (!option_parse_int(optarg, "-L/--listeners", 1, 1024, &nlisteners))
+          exit(1);
+        break;
+      case 'o':
+        output = pg_strdup(optarg);
+        break;
+      case 'r':
+        if (!option_parse_int(optarg, "-r/--report-interval", 0, INT_MAX, &report_interval))
+          exit(1);
+        break;
+      case 'R':
+        if (!option_parse_int(optarg, "-R/--rate", 0, INT_MAX, &rate))
+          exit(1);
+        break;
+      case 'T':
+        if (!option_parse_int(optarg, "-T/--time", 1, INT_MAX, &duration))
+          exit(1);
+        break;
+      case 'w':
+        if (!option_parse_int(optarg, "-w/--wait-sampling", 1, 1000, &frequency))
+          exit(1);
+        break;
+      case 'x':
+        export_oid = strtoul(optarg, NULL, 10);
+        if (export_oid == InvalidOid)
+          pg_fatal("invalid large object \"%s\"", optarg);
+        break;
+      case 1:
+        if (!option_parse_int(optarg, "--chunk-size", 1, 1024 * 1024, &chunk_size))
+          exit(1);
+        break;
+      default:
+        /* getopt_long already emitted a complaint */
+        pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+        exit(1);
+    }
+  }
+
+  if (optind < argc)
+    conninfo = argv[optind++];
+  if (optind < argc && !file && frequency == 0 &&
+      export_oid == InvalidOid && !export_query && nlisteners == 0)
+    query = argv[optind++];
+  if (optind < argc)
+  {
+    pg_log_error("too many command-line arguments (first is \"%s\")",
+                 argv[optind]);
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (export_oid != InvalidOid || export_query)
+  {
+    PGconn **conns = pg_malloc(njobs * sizeof(PGconn *));
+
+    if (!output)
+      pg_fatal("an export needs -o/--output");
+
+    for (int i = 0; i < njobs; i++)
+      conns[i] = connect_client(conninfo, &password);
+
+    if (export_oid != InvalidOid)
+      export_large_object(conns, njobs, export_oid, output, chunk_size * 1024);
+    else
+      export_bytea(conns, njobs, export_query, output, chunk_size * 1024);
+
+    for (int i = 0; i < njobs; i++)
+      PQfinish(conns[i]);
+    pg_free(conns);
+    return 0;
+  }
+
+  if (nlisteners > 0)
+  {
+    PGconn **listeners = pg_malloc(nlisteners * sizeof(PGconn *));
+    PGconn **notifiers = pg_malloc(nclients * sizeof(PGconn *));
+
+    for (int i = 0; i < nlisteners; i++)
+      listeners[i] = connect_client(conninfo, &password);
+    for (int i = 0; i < nclients; i++)
+      notifiers[i] = connect_client(conninfo, &password);
+
+    benchmark_notify(listeners, nlisteners, notifiers, nclients, rate, duration);
+
+    for (int i = 0; i < nlisteners; i++)
+      PQfinish(listeners[i]);
+    for (int i = 0; i < nclients; i++)
+      PQfinish(notifiers[i]);
+    pg_free(listeners);
+    pg_free(notifiers);
+    return 0;
+  }
+
+  if (frequency > 0)
+  {
+    conn = connect_client(conninfo, &password);
+    sample_wait_events(conn, frequency, duration, report_interval, output);
+    PQfinish(conn);
+    return 0;
+  }
+
+  if (file)
+    return run_script(file, conninfo, nclients, duration) ? 0 : 2;
+
   pg_logging_set_level(PG_LOG_DEBUG);
 
+  conn = connect_client(conninfo, &password);
+  pg_log_debug("Connection successfull! (backend PID is %d)", PQbackendPID(conn));
+
+  if (channels.head)
+    run_cached_query(conn, query, &channels);
+  else
+    run_query(conn, query);
+
+  PQfinish(conn);
+
+  return 0;
+}
+
+/*
+ * connect_client
+ *
+ * Connects, asking for the password once if needed. The password is kept
+ * for the next connections.
+ */
+static PGconn *
+connect_client(const char *conninfo, char **password)
+{
+  PGconn *conn;
+  bool    new_password;
+
   // Trying to connect
   do
   {
-    if (argc > 1)
-      conninfo = argv[1];
-    else
-      conninfo = "";
+    char *info;
 
-    if (password)
-      sprintf(conninfo, "%s password=%s", conninfo, password);
+    if (*password)
+      info = psprintf("%s password=%s", conninfo, *password);
+    else
+      info = pg_strdup(conninfo);
 
     new_password = false;
-    conn = PQconnectdb(conninfo);
+    conn = PQconnectdb(info);
+    pg_free(info);
 
     if (!conn)
     {
@@ -48,10 +270,10 @@ main(int argc, char **argv)
 
     if (PQstatus(conn) == CONNECTION_BAD &&
         PQconnectionNeedsPassword(conn)  &&
-        !password)
+        !*password)
     {
       PQfinish(conn);
-      password = simple_prompt("Password: ", false);
+      *password = simple_prompt("Password: ", false);
       new_password = true;
     }
   } while (new_password);
@@ -59,15 +281,17 @@ main(int argc, char **argv)
   if (PQstatus(conn) == CONNECTION_BAD)
   {
     pg_log_error("could not connect: %s", PQerrorMessage(conn));
-    return 2;
+    exit(2);
   }
 
-  pg_log_debug("Connection successfull! (backend PID is %d)", PQbackendPID(conn));
+  return conn;
+}
 
-  if (argc > 2)
-    query = argv[2];
-  else
-    query = "SELECT version()";
+static void
+run_query(PGconn *conn, const char *query)
+{
+  PGresult *res;
+  int       res_async;
 
   // Trying to execute query
   while (true)
@@ -100,8 +324,168 @@ main(int argc, char **argv)
 
     sleep(1);
   }
+}
 
-  PQfinish(conn);
+/*
+ * run_cached_query
+ *
+ * Same loop as run_query, but the query is only run again after a
+ * notification on one of the channels.
+ */
+static void
+run_cached_query(PGconn *conn, const char *query,
+                 const SimpleStringList *channels)
+{
+  ResultCache    *cache = cache_create(conn, channels);
+  const PGresult *res;
+  int64           hits;
+  int64           misses;
 
-  return 0;
+  while (true)
+  {
+    res = cache_exec(cache, query, 0, NULL);
+
+    if (!res)
+    {
+      pg_log_error("query failed: %s", PQerrorMessage(conn));
+    }
+    else
+    {
+      for (int ligne = 0 ; ligne < PQntuples(res) ; ligne++)
+      {
+        for (int colonne = 0 ; colonne < PQnfields(res) ; colonne++)
+        {
+          printf("%s - ", PQgetvalue(res, ligne, colonne));
+        }
+        printf("\n");
+      }
+    }
+
+    cache_stats(cache, &hits, &misses);
+    pg_log_debug("cache: " INT64_FORMAT " hits, " INT64_FORMAT " queries run",
+                 hits, misses);
+
+    printf("\n");
+
+    sleep(1);
+  }
+}
+
+/*
+ * run_script
+ *
+ * Parses the script once, connects and prepares every client, then runs
+ * them in parallel. Returns false if a client failed, like pgbench.
+ */
+static bool
+run_script(const char *path, const char *conninfo, int nclients, int duration)
+{
+  Script       *script = script_parse(path);
+  ClientThread *threads = pg_malloc0(nclients * sizeof(ClientThread));
+  char         *password = NULL;
+  int64         transactions = 0;
+  int64         evaluations = 0;
+  int           failed = 0;
+  instr_time    start;
+  instr_time    elapsed;
+
+  for (int i = 0; i < nclients; i++)
+  {
+    PGconn *conn = connect_client(conninfo, &password);
+
+    threads[i].client = script_client_create(script, conn, i);
+    threads[i].duration = duration;
+    if (!script_client_prepare(threads[i].client))
+      exit(1);
+  }
+
+  INSTR_TIME_SET_CURRENT(start);
+
+  for (int i = 0; i < nclients; i++)
+  {
+    errno = pthread_create(&threads[i].thread, NULL, client_thread, &threads[i]);
+    if (errno != 0)
+      pg_fatal("could not create thread: %m");
+  }
+
+  for (int i = 0; i < nclients; i++)
+  {
+    pthread_join(threads[i].thread, NULL);
+    transactions += threads[i].client->transactions;
+    evaluations += threads[i].client->evaluations;
+    if (threads[i].failed)
+      failed++;
+    PQfinish(threads[i].client->conn);
+  }
+
+  INSTR_TIME_SET_CURRENT(elapsed);
+  INSTR_TIME_SUBTRACT(elapsed, start);
+
+  printf("script: %s\n", path);
+  printf("clients: %d (%d failed)\n", nclients, failed);
+  printf("duration: %.3f s\n", INSTR_TIME_GET_DOUBLE(elapsed));
+  printf("transactions: " INT64_FORMAT "\n", transactions);
+  printf("tps: %.1f\n", transactions / INSTR_TIME_GET_DOUBLE(elapsed));
+  printf("expressions per second: %.0f\n", evaluations / INSTR_TIME_GET_DOUBLE(elapsed));
+
+  pg_free(threads);
+
+  return failed == 0;
+}
+
+static void *
+client_thread(void *arg)
+{
+  ClientThread *thread = (ClientThread *) arg;
+  instr_time    start;
+  instr_time    now;
+
+  INSTR_TIME_SET_CURRENT(start);
+
+  do
+  {
+    if (!script_run(thread->client))
+    {
+      thread->failed = true;
+      break;
+    }
+
+    INSTR_TIME_SET_CURRENT(now);
+    INSTR_TIME_SUBTRACT(now, start);
+  } while (INSTR_TIME_GET_DOUBLE(now) < thread->duration);
+
+  return NULL;
+}
+
+static void
+help(const char *progname)
+{
+	printf("%s runs a query or a script on PostgreSQL.\n\n", progname);
+	printf("Usage:\n");
+	printf("  %s [OPTION]... [CONNINFO [QUERY]]\n", progname);
+	printf("\nWithout a script, QUERY is run every second (default: SELECT version()).\n");
+	printf("\nOptions:\n");
+	printf("  -b, --export-bytea=QUERY  export the bytea value returned by QUERY\n");
+	printf("  -c, --clients=NUM         number of clients running the script, or of\n");
+	printf("                            notifiers (default: 1)\n");
+	printf("  -f, --file=FILENAME       script to run: SQL commands, \\set, \\sleep, \\if\n");
+	printf("  -j, --jobs=NUM            connections exporting in parallel (default: 1)\n");
+	printf("  -l, --listen=CHANNEL      run QUERY read-only and keep its result until a\n");
+	printf("                            notification on CHANNEL (can be repeated)\n");
+	printf("  -L, --listeners=NUM       benchmark LISTEN/NOTIFY with NUM listeners\n");
+	printf("  -o, --output=FILENAME     exported value, or folded profile of the wait\n");
+	printf("                            events (default: stdout)\n");
+	printf("  -r, --report-interval=SECS  seconds between reports of the wait events\n");
+	printf("                            (default: 1, 0 to disable)\n");
+	printf("  -R, --rate=NUM            notifications per second, 0 to find the maximum\n");
+	printf("                            rate sustained (default: 0)\n");
+	printf("  -T, --time=SECS           duration of the script run, of the sampling, or\n");
+	printf("                            of each rate of the benchmark (default: 10)\n");
+	printf("  -w, --wait-sampling=HZ    sample the wait events of pg_stat_activity HZ\n");
+	printf("                            times per second\n");
+	printf("  -x, --export=OID          export the large object OID\n");
+	printf("      --chunk-size=KB       size of the chunks of an export (default: 1024)\n");
+	printf("  -V, --version             output version information, then exit\n");
+	printf("  -?, --help                show this help, then exit\n");
+	printf("\nReport bugs to <guillaume@lelarge.info>.\n");
 }
@@ -9,14 +9,50 @@
 
 // #include
 #include "libpq-fe.h"
+#include <time.h>
+#include <unistd.h>
 #include "postgres_fe.h"
 #include "common/logging.h"
 #include "fe_utils/connect_utils.h"
 #include "fe_utils/option_utils.h"
+#include "fe_utils/parallel_slot.h"
 #include "fe_utils/string_utils.h"
 #include "getopt_long.h"
 
+/*
+ * Templates bigger than this are copied with STRATEGY FILE_COPY (two
+ * checkpoints, but no WAL for the data), smaller ones with STRATEGY WAL_LOG
+ * (no checkpoint, but every block goes through WAL).
+ */
+#define DEFAULT_FILE_COPY_THRESHOLD 512
+
+/*
+ * Databases dropped with --deferred are renamed with this prefix, then
+ * really dropped by --reap.
+ */
+#define TRASH_PREFIX "dropdb_trash_"
+#define DEFAULT_REAP_DELAY 10
+
+/* Time given to each terminated session to exit, in seconds */
+#define DEFAULT_TIMEOUT 5
+
 static void help(const char *progname);
+static bool drain_and_execute(PGconn *conn, const char *dbname,
+                              const char *command, bool terminate,
+                              int timeout, bool echo);
+static int  defer_drop(PGconn *conn, const char *dbname, bool echo,
+                       bool force, int timeout);
+static int  reap_databases(PGconn *conn, bool echo, int delay);
+static int  reset_databases(PGconn *conn, ConnParams *cparams,
+                            const char *progname, bool echo, bool force,
+                            char **dbnames, int ndbnames,
+                            const char *template, int jobs, int spares,
+                            int file_copy_threshold);
+static void spare_name(char *dest, const char *dbname, int number);
+static bool send_reset_command(ParallelSlotArray *sa, const char *dbname,
+                               const char *sql, bool echo);
+static bool ResetCommandResultHandler(PGresult *res, PGconn *conn,
+                                      void *context);
 
 int
 main(int argc, char **argv)
@@ -32,6 +68,15 @@ main(int argc, char **argv)
     {"username", required_argument, NULL, 'U'},
     {"echo", no_argument, NULL, 'e'},
     {"force", no_argument, NULL, 'f'},
+    {"timeout", required_argument, NULL, 't'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"reset", no_argument, NULL, 'r'},
+    {"template", required_argument, NULL, 'T'},
+    {"spares", required_argument, NULL, 1},
+    {"file-copy-threshold", required_argument, NULL, 2},
+    {"deferred", no_argument, NULL, 3},
+    {"reap", no_argument, NULL, 4},
+    {"reap-delay", required_argument, NULL, 5},
     {NULL, 0, NULL, 0}
   };
   int           optindex;
@@ -40,15 +85,25 @@ main(int argc, char **argv)
   char         *host = NULL;
   char         *port = NULL;
   char         *username = NULL;
+  char         *template = NULL;
   bool          echo = false;
   bool          force = false;
+  bool          reset = false;
+  bool          deferred = false;
+  bool          reap = false;
+  bool          dropped;
+  int           jobs = 1;
+  int           spares = 0;
+  int           file_copy_threshold = DEFAULT_FILE_COPY_THRESHOLD;
+  int           reap_delay = DEFAULT_REAP_DELAY;
+  int           timeout = DEFAULT_TIMEOUT;
 
   pg_logging_init(argv[0]);
   progname = get_progname(argv[0]);
 
   handle_help_version_opts(argc, argv, "dropdb", help);
 
-  while ((c = getopt_long(argc, argv, "efh:ip:U:wW", long_options, &optindex)) != -1)
+  while ((c = getopt_long(argc, argv, "efh:ij:p:rt:T:U:wW", long_options, &optindex)) != -1)
   {
     switch (c)
     {
@@ -61,12 +116,45 @@ main(int argc, char **argv)
       case 'h':
         host = pg_strdup(optarg);
         break;
+      case 'j':
+        if (!option_parse_int(optarg, "-j/--jobs", 1, INT_MAX, &jobs))
+          exit(1);
+        break;
       case 'p':
         port = pg_strdup(optarg);
         break;
+      case 'r':
+        reset = true;
+        break;
+      case 't':
+        if (!option_parse_int(optarg, "-t/--timeout", 1, INT_MAX / 1000, &timeout))
+          exit(1);
+        break;
+      case 'T':
+        template = pg_strdup(optarg);
+        break;
       case 'U':
         username = pg_strdup(optarg);
         break;
+      case 1:
+        if (!option_parse_int(optarg, "--spares", 0, 100, &spares))
+          exit(1);
+        break;
+      case 2:
+        if (!option_parse_int(optarg, "--file-copy-threshold", 0, INT_MAX,
+                              &file_copy_threshold))
+          exit(1);
+        break;
+      case 3:
+        deferred = true;
+        break;
+      case 4:
+        reap = true;
+        break;
+      case 5:
+        if (!option_parse_int(optarg, "--reap-delay", 0, INT_MAX, &reap_delay))
+          exit(1);
+        break;
       case 0:
         /* this covers the long options */
         break;
@@ -77,16 +165,51 @@ main(int argc, char **argv)
     }
   }
 
+  if (reset && !template)
+  {
+    pg_log_error("option %s requires option %s", "-r/--reset", "-T/--template");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (!reset && (template || spares > 0 || jobs > 1))
+  {
+    pg_log_error("options %s, %s and %s require option %s",
+                 "-T/--template", "--spares", "-j/--jobs", "-r/--reset");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if ((reset && deferred) || (reset && reap) || (deferred && reap))
+  {
+    pg_log_error("options %s, %s and %s cannot be used together",
+                 "-r/--reset", "--deferred", "--reap");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
   switch (argc - optind)
   {
     case 0:
+      /* the reaper drops the databases found in the trash */
+      if (reap)
+        break;
       pg_log_error("missing required argument database name");
       pg_log_error_hint("Try \"%s --help\" for more information.", progname);
       exit(1);
     case 1:
+      if (reap)
+      {
+        pg_log_error("option %s does not accept a database name", "--reap");
+        pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+        exit(1);
+      }
       dbname = argv[optind];
       break;
     default:
+      /* the reset mode accepts several databases */
+      if (reset)
+        break;
       pg_log_error("too many command-line arguments (first is \"%s\")",
              argv[optind + 1]);
       pg_log_error_hint("Try \"%s --help\" for more information.", progname);
@@ -104,60 +227,662 @@ main(int argc, char **argv)
 
   conn = connectMaintenanceDatabase(&cparams, progname, echo);
 
-  // Disconnect users from the to-be-dropped database
+  // Reset databases from a template
+
+  if (reset)
+    exit(reset_databases(conn, &cparams, progname, echo, force,
+                         argv + optind, argc - optind,
+                         template, jobs, spares, file_copy_threshold));
+
+  // Drop databases put in the trash by --deferred
+
+  if (reap)
+    exit(reap_databases(conn, echo, reap_delay));
+
+  // Put the database in the trash, the reaper will drop it later
+
+  if (deferred)
+    exit(defer_drop(conn, dbname, echo, force, timeout));
+
+  // Drop database
+
+  initPQExpBuffer(&sql);
+
+  appendPQExpBuffer(&sql,
+    "DROP DATABASE %s;",
+    fmtId(dbname));
+
+  // Disconnect users from the to-be-dropped database first
 
   if (force)
+    dropped = drain_and_execute(conn, dbname, sql.data, true, timeout, echo);
+  else
   {
-    initPQExpBuffer(&sql);
-
-    appendPQExpBuffer(&sql,
-      "SELECT pg_terminate_backend(pid) FROM pg_stat_activity WHERE datname='%s';",
-      fmtId(dbname));
     if (echo)
       printf("%s\n", sql.data);
     result = PQexec(conn, sql.data);
-    if (PQresultStatus(result) != PGRES_TUPLES_OK)
+    dropped = PQresultStatus(result) == PGRES_COMMAND_OK;
+    if (!dropped)
+      pg_log_error("database removal failed: %s", PQerrorMessage(conn));
+    PQclear(result);
+  }
+
+  termPQExpBuffer(&sql);
+
+  PQfinish(conn);
+
+  if (!dropped)
+    exit(1);
+
+  pg_log_info("database dropped");
+
+  exit(0);
+}
+
+/*
+ * drain_and_execute
+ *
+ * Runs a command that needs the database to be free of any session (DROP
+ * DATABASE, ALTER DATABASE ... RENAME) after:
+ *  - forbidding new connections,
+ *  - if terminate is set, terminating the current sessions and waiting for
+ *    each of them to exit, up to timeout seconds,
+ *  - looking for the prepared transactions, replication slots and
+ *    subscriptions that would make the command fail.
+ *
+ * All these queries are sent in a single pipeline, each one followed by its
+ * own synchronisation point since DROP DATABASE cannot run in a transaction
+ * block. The drain then costs one round trip, and no new session can slip in
+ * between the termination and the command.
+ *
+ * If the command fails, connections are allowed again, and the objects
+ * blocking the database are reported.
+ */
+static bool
+drain_and_execute(PGconn *conn, const char *dbname, const char *command,
+                  bool terminate, int timeout, bool echo)
+{
+  enum
+  {
+    STEP_BLOCK,
+    STEP_TERMINATE,
+    STEP_BLOCKERS,
+    STEP_COMMAND,
+    NUM_STEPS
+  };
+  PQExpBufferData block;
+  const char   *queries[NUM_STEPS];
+  const char   *params[2];
+  char          timeout_ms[32];
+  PGresult     *result;
+  PGresult     *blockers = NULL;
+  bool          failed[NUM_STEPS] = {false};
+  int           disconnected = 0;
+  int           lingering = 0;
+  int           step;
+
+  initPQExpBuffer(&block);
+  appendPQExpBuffer(&block,
+    "ALTER DATABASE %s ALLOW_CONNECTIONS false;",
+    fmtId(dbname));
+
+  queries[STEP_BLOCK] = block.data;
+  queries[STEP_TERMINATE] =
+    "SELECT pid, pg_terminate_backend(pid, $2::bigint) "
+    "FROM pg_stat_activity "
+    "WHERE datname = $1 AND pid <> pg_backend_pid();";
+  queries[STEP_BLOCKERS] =
+    "SELECT 'prepared transaction', gid "
+    "FROM pg_prepared_xacts WHERE database = $1 "
+    "UNION ALL "
+    "SELECT 'replication slot', slot_name "
+    "FROM pg_replication_slots WHERE database = $1 "
+    "UNION ALL "
+    "SELECT 'subscription', s.subname "
+    "FROM pg_subscription s JOIN pg_database d ON d.oid = s.subdbid "
+    "WHERE d.datname = $1;";
+  queries[STEP_COMMAND] = command;
+
+  snprintf(timeout_ms, sizeof(timeout_ms), "%d", timeout * 1000);
+  params[0] = dbname;
+  params[1] = timeout_ms;
+
+  // Send every query at once
+
+  if (!PQenterPipelineMode(conn))
+  {
+    pg_log_error("could not enter pipeline mode: %s", PQerrorMessage(conn));
+    termPQExpBuffer(&block);
+    return false;
+  }
+
+  for (step = 0 ; step < NUM_STEPS ; step++)
+  {
+    int         nparams;
+
+    if (step == STEP_TERMINATE && !terminate)
+      continue;
+
+    if (echo)
+      printf("%s\n", queries[step]);
+
+    nparams = step == STEP_TERMINATE ? 2 : step == STEP_BLOCKERS ? 1 : 0;
+    if (!PQsendQueryParams(conn, queries[step], nparams, NULL, params,
+                           NULL, NULL, 0) ||
+        !PQpipelineSync(conn))
     {
-      pg_log_error("users termination failed: %s", PQerrorMessage(conn));
-      PQfinish(conn);
-      exit(1);
+      pg_log_error("could not send query: %s", PQerrorMessage(conn));
+      termPQExpBuffer(&block);
+      return false;
     }
+  }
 
-    if (PQntuples(result) > 0)
-      pg_log_info("%d user%s disconnected",
-        PQntuples(result),
-        PQntuples(result) == 1 ? "":"s");
+  // Then read their results, each one ended by its synchronisation point
 
+  step = 0;
+  while (step < NUM_STEPS)
+  {
+    if (step == STEP_TERMINATE && !terminate)
+    {
+      step++;
+      continue;
+    }
+
+    result = PQgetResult(conn);
+    if (result == NULL)
+    {
+      /* end of the results of a query, unless the connection is lost */
+      if (PQstatus(conn) == CONNECTION_BAD)
+      {
+        pg_log_error("connection lost: %s", PQerrorMessage(conn));
+        termPQExpBuffer(&block);
+        return false;
+      }
+      continue;
+    }
+
+    switch (PQresultStatus(result))
+    {
+      case PGRES_PIPELINE_SYNC:
+        step++;
+        break;
+      case PGRES_TUPLES_OK:
+        if (step == STEP_TERMINATE)
+        {
+          disconnected = PQntuples(result);
+          for (int ligne = 0 ; ligne < PQntuples(result) ; ligne++)
+          {
+            if (strcmp(PQgetvalue(result, ligne, 1), "t") != 0)
+            {
+              pg_log_warning("session %s did not exit within %d second%s",
+                PQgetvalue(result, ligne, 0),
+                timeout, timeout == 1 ? "" : "s");
+              lingering++;
+            }
+          }
+        }
+        else if (step == STEP_BLOCKERS)
+        {
+          blockers = result;
+          continue;
+        }
+        break;
+      case PGRES_COMMAND_OK:
+        break;
+      default:
+        failed[step] = true;
+        if (step == STEP_BLOCK)
+          pg_log_error("could not block connections: %s",
+                       PQresultErrorMessage(result));
+        else if (step == STEP_TERMINATE)
+          pg_log_error("users termination failed: %s",
+                       PQresultErrorMessage(result));
+        else if (step == STEP_BLOCKERS)
+          pg_log_error("could not look for blocking objects: %s",
+                       PQresultErrorMessage(result));
+        else
+          pg_log_error("database removal failed: %s",
+                       PQresultErrorMessage(result));
+        break;
+    }
     PQclear(result);
+  }
+
+  if (!PQexitPipelineMode(conn))
+    pg_log_error("could not exit pipeline mode: %s", PQerrorMessage(conn));
+
+  termPQExpBuffer(&block);
+
+  if (disconnected - lingering > 0)
+    pg_log_info("%d user%s disconnected",
+      disconnected - lingering,
+      disconnected - lingering == 1 ? "":"s");
 
+  if (blockers)
+  {
+    if (failed[STEP_COMMAND])
+    {
+      for (int ligne = 0 ; ligne < PQntuples(blockers) ; ligne++)
+        pg_log_error_detail("Database is used by %s \"%s\".",
+          PQgetvalue(blockers, ligne, 0),
+          PQgetvalue(blockers, ligne, 1));
+    }
+    PQclear(blockers);
+  }
+
+  // Allow connections again if the database is still there
+
+  if (failed[STEP_COMMAND] && !failed[STEP_BLOCK])
+  {
+    PQExpBufferData sql;
+
+    initPQExpBuffer(&sql);
+    appendPQExpBuffer(&sql,
+      "ALTER DATABASE %s ALLOW_CONNECTIONS true;",
+      fmtId(dbname));
+    if (echo)
+      printf("%s\n", sql.data);
+    result = PQexec(conn, sql.data);
+    if (PQresultStatus(result) != PGRES_COMMAND_OK)
+      pg_log_error("could not allow connections again: %s",
+                   PQerrorMessage(conn));
+    PQclear(result);
     termPQExpBuffer(&sql);
   }
 
-  // Drop database
+  return !failed[STEP_COMMAND];
+}
+
+/*
+ * defer_drop
+ *
+ * Forbids new connections to the database, then renames it with
+ * TRASH_PREFIX. Both are catalog-only operations, so this returns at once
+ * whatever the size of the database, which is really dropped later by
+ * reap_databases().
+ *
+ * Returns the exit code of the program.
+ */
+static int
+defer_drop(PGconn *conn, const char *dbname, bool echo, bool force,
+           int timeout)
+{
+  PQExpBufferData sql;
+  char          trash[NAMEDATALEN];
+  int           status = 0;
+
+  /* the epoch in the name keeps the trash in drop order */
+  snprintf(trash, NAMEDATALEN, TRASH_PREFIX "%010ld_%d",
+           (long) time(NULL), (int) getpid());
 
   initPQExpBuffer(&sql);
+  appendPQExpBuffer(&sql, "ALTER DATABASE %s", fmtId(dbname));
+  appendPQExpBuffer(&sql, " RENAME TO %s;", fmtId(trash));
 
-  appendPQExpBuffer(&sql,
-    "DROP DATABASE %s;",
-    fmtId(dbname));
+  if (drain_and_execute(conn, dbname, sql.data, force, timeout, echo))
+    pg_log_info("database moved to trash as \"%s\"", trash);
+  else
+    status = 1;
+
+  termPQExpBuffer(&sql);
+
+  PQfinish(conn);
+
+  return status;
+}
+
+/*
+ * reap_databases
+ *
+ * Drops the databases put in the trash by defer_drop(), oldest first,
+ * waiting "delay" seconds between two drops so that unlinking their files
+ * does not hog the I/O of the server.
+ *
+ * Returns the exit code of the program.
+ */
+static int
+reap_databases(PGconn *conn, bool echo, int delay)
+{
+  PGresult     *trash;
+  PGresult     *result;
+  PQExpBufferData sql;
+  int           status = 0;
+
+  initPQExpBuffer(&sql);
+  appendPQExpBufferStr(&sql,
+    "SELECT datname FROM pg_database WHERE starts_with(datname, '"
+    TRASH_PREFIX "') ORDER BY datname;");
+  if (echo)
+    printf("%s\n", sql.data);
+  trash = PQexec(conn, sql.data);
+  if (PQresultStatus(trash) != PGRES_TUPLES_OK)
+  {
+    pg_log_error("could not list databases in trash: %s",
+                 PQerrorMessage(conn));
+    PQfinish(conn);
+    return 1;
+  }
+  termPQExpBuffer(&sql);
+
+  for (int ligne = 0 ; ligne < PQntuples(trash) ; ligne++)
+  {
+    if (ligne > 0 && delay > 0)
+      pg_usleep(delay * 1000000L);
+
+    initPQExpBuffer(&sql);
+    appendPQExpBuffer(&sql,
+      "DROP DATABASE IF EXISTS %s;",
+      fmtId(PQgetvalue(trash, ligne, 0)));
+    if (echo)
+      printf("%s\n", sql.data);
+    result = PQexec(conn, sql.data);
+    if (PQresultStatus(result) != PGRES_COMMAND_OK)
+    {
+      pg_log_error("database removal failed: %s", PQerrorMessage(conn));
+      status = 1;
+    }
+    else
+      pg_log_info("database \"%s\" dropped", PQgetvalue(trash, ligne, 0));
+    PQclear(result);
+    termPQExpBuffer(&sql);
+  }
+
+  if (PQntuples(trash) == 0)
+    pg_log_info("trash is empty");
+
+  PQclear(trash);
+  PQfinish(conn);
+
+  return status;
+}
+
+/*
+ * reset_databases
+ *
+ * Drops each database and recreates it from the template. When spare copies
+ * of a database exist (created by a previous run with --spares), the first
+ * one is renamed instead of copying the template, which makes the reset
+ * itself almost instantaneous. Missing spare copies are then created again,
+ * so that the next reset finds them.
+ *
+ * Every step is spread over "jobs" connections. Steps are separated by a
+ * wait for completion because a database cannot be recreated before its
+ * previous incarnation is dropped.
+ *
+ * Returns the exit code of the program.
+ */
+static int
+reset_databases(PGconn *conn, ConnParams *cparams, const char *progname,
+                bool echo, bool force, char **dbnames, int ndbnames,
+                const char *template, int jobs, int spares,
+                int file_copy_threshold)
+{
+  ParallelSlotArray *sa;
+  PGresult     *result;
+  PQExpBufferData sql;
+  const char   *strategy;
+  int64         template_size;
+  int          *spare_found;   /* number of spare copies of each database */
+  bool          failed = false;
+  char          name[NAMEDATALEN];
+
+  for (int i = 0 ; i < ndbnames ; i++)
+  {
+    if (strcmp(dbnames[i], template) == 0)
+    {
+      pg_log_error("cannot reset template database \"%s\"", template);
+      PQfinish(conn);
+      return 1;
+    }
+    if (spares > 0 && strlen(dbnames[i]) + strlen("_spare_100") >= NAMEDATALEN)
+    {
+      pg_log_error("database name \"%s\" is too long to have spare copies",
+                   dbnames[i]);
+      PQfinish(conn);
+      return 1;
+    }
+  }
+
+  // Choose the copy strategy from the template size
+
+  initPQExpBuffer(&sql);
+  appendPQExpBufferStr(&sql, "SELECT pg_database_size(");
+  appendStringLiteralConn(&sql, template, conn);
+  appendPQExpBufferStr(&sql, ");");
   if (echo)
     printf("%s\n", sql.data);
   result = PQexec(conn, sql.data);
-  if (PQresultStatus(result) != PGRES_COMMAND_OK)
+  if (PQresultStatus(result) != PGRES_TUPLES_OK)
   {
-    pg_log_error("database removal failed: %s", PQerrorMessage(conn));
+    pg_log_error("could not get size of template \"%s\": %s",
+                 template, PQerrorMessage(conn));
     PQfinish(conn);
-    exit(1);
+    return 1;
   }
-  else
-    pg_log_info("database dropped");
+  template_size = strtoi64(PQgetvalue(result, 0, 0), NULL, 10);
   PQclear(result);
-
   termPQExpBuffer(&sql);
 
-  PQfinish(conn);
+  if (template_size > (int64) file_copy_threshold * 1024 * 1024)
+    strategy = "FILE_COPY";
+  else
+    strategy = "WAL_LOG";
+  pg_log_info("template \"%s\" is " INT64_FORMAT " bytes, using strategy %s",
+              template, template_size, strategy);
 
-  exit(0);
+  // Look for the spare copies created by a previous run
+
+  spare_found = pg_malloc0(ndbnames * sizeof(int));
+  if (spares > 0)
+  {
+    for (int i = 0 ; i < ndbnames ; i++)
+    {
+      initPQExpBuffer(&sql);
+      appendPQExpBufferStr(&sql,
+        "SELECT count(*) FROM pg_database WHERE datname = ");
+      spare_name(name, dbnames[i], 1);
+      appendStringLiteralConn(&sql, name, conn);
+      appendPQExpBufferStr(&sql, ";");
+      if (echo)
+        printf("%s\n", sql.data);
+      result = PQexec(conn, sql.data);
+      if (PQresultStatus(result) != PGRES_TUPLES_OK)
+      {
+        pg_log_error("could not look for spare databases: %s",
+                     PQerrorMessage(conn));
+        PQfinish(conn);
+        return 1;
+      }
+      spare_found[i] = atoi(PQgetvalue(result, 0, 0)) > 0;
+      PQclear(result);
+      termPQExpBuffer(&sql);
+    }
+  }
+
+  sa = ParallelSlotsSetup(jobs, cparams, progname, echo, NULL);
+  ParallelSlotsAdoptConn(sa, conn);
+
+  // Drop databases
+
+  for (int i = 0 ; i < ndbnames && !failed ; i++)
+  {
+    initPQExpBuffer(&sql);
+    appendPQExpBuffer(&sql, "DROP DATABASE IF EXISTS %s%s;",
+      fmtId(dbnames[i]), force ? " WITH (FORCE)" : "");
+    failed = !send_reset_command(sa, dbnames[i], sql.data, echo);
+    termPQExpBuffer(&sql);
+  }
+  if (!failed && !ParallelSlotsWaitCompletion(sa))
+    failed = true;
+
+  // Recreate them, from a spare copy when there is one
+
+  for (int i = 0 ; i < ndbnames && !failed ; i++)
+  {
+    initPQExpBuffer(&sql);
+    if (spare_found[i])
+    {
+      spare_name(name, dbnames[i], 1);
+      appendPQExpBuffer(&sql, "ALTER DATABASE %s", fmtId(name));
+      appendPQExpBuffer(&sql, " RENAME TO %s;", fmtId(dbnames[i]));
+    }
+    else
+    {
+      appendPQExpBuffer(&sql, "CREATE DATABASE %s", fmtId(dbnames[i]));
+      appendPQExpBuffer(&sql, " TEMPLATE %s STRATEGY %s;",
+        fmtId(template), strategy);
+    }
+    failed = !send_reset_command(sa, dbnames[i], sql.data, echo);
+    termPQExpBuffer(&sql);
+  }
+  if (!failed && !ParallelSlotsWaitCompletion(sa))
+    failed = true;
+
+  if (!failed)
+    pg_log_info("%d database%s reset", ndbnames, ndbnames == 1 ? "" : "s");
+
+  // Shift the remaining spare copies and create the missing ones
+
+  if (spares > 0 && !failed)
+  {
+    for (int i = 0 ; i < ndbnames && !failed ; i++)
+    {
+      PQExpBufferData renames;
+
+      /*
+       * Spare copies are numbered from 1 without holes, so the one we just
+       * used is replaced by the next one and so on.
+       */
+      initPQExpBuffer(&sql);
+      snprintf(name, NAMEDATALEN, "%s_spare_", dbnames[i]);
+      /* only a number after the prefix, not the spares of "<db>_spare_1" */
+      appendPQExpBufferStr(&sql,
+        "SELECT datname FROM pg_database WHERE starts_with(datname, ");
+      appendStringLiteralConn(&sql, name, conn);
+      appendPQExpBufferStr(&sql, ") AND substr(datname, length(");
+      appendStringLiteralConn(&sql, name, conn);
+      appendPQExpBufferStr(&sql, ") + 1) ~ '^[0-9]+$' ORDER BY length(datname), datname;");
+      if (echo)
+        printf("%s\n", sql.data);
+      result = PQexec(conn, sql.data);
+      termPQExpBuffer(&sql);
+      if (PQresultStatus(result) != PGRES_TUPLES_OK)
+      {
+        pg_log_error("could not look for spare databases: %s",
+                     PQerrorMessage(conn));
+        PQclear(result);
+        failed = true;
+        break;
+      }
+
+      spare_found[i] = PQntuples(result);
+      initPQExpBuffer(&renames);
+      for (int ligne = 0 ; ligne < PQntuples(result) ; ligne++)
+      {
+        spare_name(name, dbnames[i], ligne + 1);
+        if (strcmp(PQgetvalue(result, ligne, 0), name) != 0)
+        {
+          appendPQExpBuffer(&renames, "ALTER DATABASE %s",
+            fmtId(PQgetvalue(result, ligne, 0)));
+          appendPQExpBuffer(&renames, " RENAME TO %s;", fmtId(name));
+        }
+      }
+      PQclear(result);
+
+      /* renames of a database's spares must happen in order, on one slot */
+      if (renames.len > 0)
+        failed = !send_reset_command(sa, dbnames[i], renames.data, echo);
+      termPQExpBuffer(&renames);
+    }
+    if (!failed && !ParallelSlotsWaitCompletion(sa))
+      failed = true;
+
+    for (int i = 0 ; i < ndbnames && !failed ; i++)
+    {
+      for (int number = spare_found[i] + 1 ; number <= spares && !failed ; number++)
+      {
+        initPQExpBuffer(&sql);
+        spare_name(name, dbnames[i], number);
+        appendPQExpBuffer(&sql, "CREATE DATABASE %s", fmtId(name));
+        appendPQExpBuffer(&sql, " TEMPLATE %s STRATEGY %s;",
+          fmtId(template), strategy);
+        failed = !send_reset_command(sa, dbnames[i], sql.data, echo);
+        termPQExpBuffer(&sql);
+      }
+    }
+    if (!failed && !ParallelSlotsWaitCompletion(sa))
+      failed = true;
+
+    if (!failed)
+      pg_log_info("%d spare cop%s ready per database",
+                  spares, spares == 1 ? "y" : "ies");
+  }
+
+  ParallelSlotsTerminate(sa);
+  pg_free(sa);
+  pg_free(spare_found);
+
+  return failed ? 1 : 0;
+}
+
+/*
+ * spare_name
+ *
+ * Builds the name of a spare copy of a database. dest must be NAMEDATALEN
+ * long.
+ */
+static void
+spare_name(char *dest, const char *dbname, int number)
+{
+  snprintf(dest, NAMEDATALEN, "%s_spare_%d", dbname, number);
+}
+
+/*
+ * send_reset_command
+ *
+ * Sends a command on the first idle connection, without waiting for its
+ * result.
+ */
+static bool
+send_reset_command(ParallelSlotArray *sa, const char *dbname,
+                   const char *sql, bool echo)
+{
+  ParallelSlot *slot;
+
+  slot = ParallelSlotsGetIdle(sa, NULL);
+  if (!slot)
+    return false;
+
+  ParallelSlotSetHandler(slot, ResetCommandResultHandler, (void *) dbname);
+
+  if (echo)
+    printf("%s\n", sql);
+  if (!PQsendQuery(slot->connection, sql))
+  {
+    pg_log_error("reset of database \"%s\" failed: %s",
+                 dbname, PQerrorMessage(slot->connection));
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * ResetCommandResultHandler
+ *
+ * Reports failures of the commands sent by send_reset_command.
+ */
+static bool
+ResetCommandResultHandler(PGresult *res, PGconn *conn, void *context)
+{
+  if (PQresultStatus(res) != PGRES_COMMAND_OK)
+  {
+    pg_log_error("reset of database \"%s\" failed: %s",
+                 (const char *) context, PQerrorMessage(conn));
+    return false;
+  }
+
+  return true;
 }
 
 static void
@@ -166,11 +891,26 @@ help(const char *progname)
 	printf("%s removes a PostgreSQL database.\n\n", progname);
 	printf("Usage:\n");
 	printf("  %s [OPTION]... DBNAME\n", progname);
+	printf("  %s --reset --template=TEMPLATE [OPTION]... DBNAME...\n", progname);
+	printf("  %s --reap [OPTION]...\n", progname);
 	printf("\nOptions:\n");
 	printf("  -e, --echo                show the commands being sent to the server\n");
 	printf("  -f, --force               try to terminate other connections before dropping\n");
+	printf("  -t, --timeout=SECS        wait for terminated connections to exit (default: %d)\n", DEFAULT_TIMEOUT);
+	printf("      --deferred            only move the database to the trash, see --reap\n");
 	printf("  -V, --version             output version information, then exit\n");
 	printf("  -?, --help                show this help, then exit\n");
+	printf("\nReset options:\n");
+	printf("  -r, --reset               recreate the databases once dropped\n");
+	printf("  -T, --template=TEMPLATE   template used to recreate the databases\n");
+	printf("  -j, --jobs=NUM            use this many concurrent connections\n");
+	printf("      --spares=NUM          keep NUM ready copies of each database\n");
+	printf("      --file-copy-threshold=MB\n");
+	printf("                            use FILE_COPY strategy for templates bigger\n");
+	printf("                            than MB (default: %d)\n", DEFAULT_FILE_COPY_THRESHOLD);
+	printf("\nReaper options:\n");
+	printf("      --reap                drop the databases moved to the trash\n");
+	printf("      --reap-delay=SECS     wait between two drops (default: %d)\n", DEFAULT_REAP_DELAY);
 	printf("\nConnection options:\n");
 	printf("  -h, --host=HOSTNAME       database server host or socket directory\n");
 	printf("  -p, --port=PORT           database server port\n");
@@ -0,0 +1,383 @@
+/*
+ * export, large values exported by client
+ *
+ * Exports a large object, or a bytea value, to a file by chunks, on
+ * several connections in parallel, one thread each.
+ *
+ * The first connection exports its snapshot, and the others import it, so
+ * every chunk is read from the same version of the value. The size is read
+ * first and the file is extended to it. Each thread then takes the next
+ * chunk not read yet, reads it with lo_lseek64 and lo_read, or with
+ * substring for a bytea, and writes it at its offset with pwrite. The
+ * memory used is one chunk per connection, whatever the size of the value.
+ *
+ * A bytea value is given by a query returning it. The query is used as a
+ * subquery, so that substring applies directly to the column: for a column
+ * with STORAGE EXTERNAL, a chunk then only fetches its own TOAST chunks.
+ * Otherwise, each chunk decompresses the whole value on the server.
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "postgres_fe.h"
+#include "common/logging.h"
+#include "libpq/libpq-fs.h"
+#include "portability/instr_time.h"
+
+#include "export.h"
+
+typedef struct Export
+{
+  Oid           oid;            /* large object, or InvalidOid */
+  const char   *query;          /* bytea, reading a chunk */
+  int           fd;
+  int64         size;
+  int           chunk_size;
+  int64         next_chunk;
+  pthread_mutex_t lock;
+} Export;
+
+typedef struct ExportJob
+{
+  pthread_t     thread;
+  Export       *export;
+  PGconn       *conn;
+  int64         bytes;
+  bool          failed;
+} ExportJob;
+
+static void begin_snapshot(PGconn **conns, int njobs);
+static void run_export(Export *export, PGconn **conns, int njobs,
+                       const char *output);
+static void *export_thread(void *arg);
+static bool next_chunk(Export *export, int64 *offset, int *length);
+static bool write_chunk(int fd, const char *data, int length, int64 offset);
+
+/*
+ * export_large_object
+ *
+ * Exports a large object to output.
+ */
+void
+export_large_object(PGconn **conns, int njobs, Oid oid, const char *output,
+                    int chunk_size)
+{
+  Export export;
+  int    lo;
+
+  memset(&export, 0, sizeof(export));
+  export.oid = oid;
+  export.chunk_size = chunk_size;
+
+  begin_snapshot(conns, njobs);
+
+  lo = lo_open(conns[0], oid, INV_READ);
+  if (lo < 0)
+    pg_fatal("could not open large object %u: %s", oid, PQerrorMessage(conns[0]));
+  export.size = lo_lseek64(conns[0], lo, 0, SEEK_END);
+  if (export.size < 0)
+    pg_fatal("could not read the size of large object %u: %s", oid,
+             PQerrorMessage(conns[0]));
+  lo_close(conns[0], lo);
+
+  run_export(&export, conns, njobs, output);
+}
+
+/*
+ * export_bytea
+ *
+ * Exports to output the bytea value returned by query, a SELECT of one
+ * column and one row.
+ */
+void
+export_bytea(PGconn **conns, int njobs, const char *query, const char *output,
+             int chunk_size)
+{
+  Export    export;
+  char     *sql;
+  PGresult *res;
+
+  memset(&export, 0, sizeof(export));
+  export.oid = InvalidOid;
+  export.chunk_size = chunk_size;
+
+  begin_snapshot(conns, njobs);
+
+  sql = psprintf("SELECT octet_length(v) FROM (%s) AS s(v)", query);
+  res = PQexec(conns[0], sql);
+  if (PQresultStatus(res) != PGRES_TUPLES_OK)
+    pg_fatal("could not read the size of the value: %s", PQerrorMessage(conns[0]));
+  if (PQntuples(res) != 1 || PQgetisnull(res, 0, 0))
+    pg_fatal("query must return one value, not null");
+  export.size = strtoi64(PQgetvalue(res, 0, 0), NULL, 10);
+  PQclear(res);
+  pg_free(sql);
+
+  export.query = psprintf("SELECT substring(v FROM $1 FOR $2) FROM (%s) AS s(v)",
+                          query);
+
+  for (int i = 0; i < njobs; i++)
+  {
+    res = PQprepare(conns[i], "export_chunk", export.query, 2, NULL);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+      pg_fatal("could not prepare the query: %s", PQerrorMessage(conns[i]));
+    PQclear(res);
+  }
+
+  run_export(&export, conns, njobs, output);
+}
+
+/*
+ * begin_snapshot
+ *
+ * Starts a transaction on each connection, all in the snapshot of the
+ * first one. Large objects need a transaction anyway.
+ */
+static void
+begin_snapshot(PGconn **conns, int njobs)
+{
+  PGresult *res;
+  char     *snapshot;
+
+  res = PQexec(conns[0], "BEGIN ISOLATION LEVEL REPEATABLE READ, READ ONLY");
+  if (PQresultStatus(res) != PGRES_COMMAND_OK)
+    pg_fatal("could not start a transaction: %s", PQerrorMessage(conns[0]));
+  PQclear(res);
+
+  res = PQexec(conns[0], "SELECT pg_export_snapshot()");
+  if (PQresultStatus(res) != PGRES_TUPLES_OK)
+    pg_fatal("could not export the snapshot: %s", PQerrorMessage(conns[0]));
+  snapshot = pg_strdup(PQgetvalue(res, 0, 0));
+  PQclear(res);
+
+  pg_log_debug("snapshot %s", snapshot);
+
+  for (int i = 1; i < njobs; i++)
+  {
+    char *sql = psprintf("BEGIN ISOLATION LEVEL REPEATABLE READ, READ ONLY; "
+                         "SET TRANSACTION SNAPSHOT '%s'", snapshot);
+
+    res = PQexec(conns[i], sql);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+      pg_fatal("could not import the snapshot: %s", PQerrorMessage(conns[i]));
+    PQclear(res);
+    pg_free(sql);
+  }
+
+  pg_free(snapshot);
+}
+
+static void
+run_export(Export *export, PGconn **conns, int njobs, const char *output)
+{
+  ExportJob  *jobs = pg_malloc0(njobs * sizeof(ExportJob));
+  int64       bytes = 0;
+  bool        failed = false;
+  instr_time  start;
+  instr_time  elapsed;
+
+  export->fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY, 0644);
+  if (export->fd < 0)
+    pg_fatal("could not open file \"%s\": %m", output);
+  if (ftruncate(export->fd, export->size) != 0)
+    pg_fatal("could not extend file \"%s\": %m", output);
+  pthread_mutex_init(&export->lock, NULL);
+
+  INSTR_TIME_SET_CURRENT(start);
+
+  for (int i = 0; i < njobs; i++)
+  {
+    jobs[i].export = export;
+    jobs[i].conn = conns[i];
+    errno = pthread_create(&jobs[i].thread, NULL, export_thread, &jobs[i]);
+    if (errno != 0)
+      pg_fatal("could not create thread: %m");
+  }
+
+  for (int i = 0; i < njobs; i++)
+  {
+    pthread_join(jobs[i].thread, NULL);
+    bytes += jobs[i].bytes;
+    failed |= jobs[i].failed;
+  }
+
+  /*
+   * COMMIT of an aborted transaction rolls it back and still succeeds, so
+   * the command tag is checked too. Once something failed, the remaining
+   * transactions are rolled back.
+   */
+  for (int i = 0; i < njobs; i++)
+  {
+    const char *end = failed ? "ROLLBACK" : "COMMIT";
+    PGresult   *res = PQexec(conns[i], end);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+    {
+      pg_log_error("could not end the transaction of connection %d: %s",
+                   i + 1, PQerrorMessage(conns[i]));
+      failed = true;
+    }
+    else if (strcmp(PQcmdStatus(res), end) != 0)
+    {
+      pg_log_error("transaction of connection %d was rolled back", i + 1);
+      failed = true;
+    }
+    PQclear(res);
+  }
+
+  INSTR_TIME_SET_CURRENT(elapsed);
+  INSTR_TIME_SUBTRACT(elapsed, start);
+
+  if (failed)
+    pg_fatal("export failed, \"%s\" is incomplete", output);
+  if (fsync(export->fd) != 0 || close(export->fd) != 0)
+    pg_fatal("could not write file \"%s\": %m", output);
+
+  printf("exported " INT64_FORMAT " bytes to \"%s\" with %d connections "
+         "in %.3f s, %.1f MB/s\n",
+         bytes, output, njobs, INSTR_TIME_GET_DOUBLE(elapsed),
+         bytes / INSTR_TIME_GET_DOUBLE(elapsed) / (1024 * 1024));
+
+  pthread_mutex_destroy(&export->lock);
+  pg_free(jobs);
+}
+
+/*
+ * next_chunk
+ *
+ * Gives the next chunk to read, false when none is left.
+ */
+static bool
+next_chunk(Export *export, int64 *offset, int *length)
+{
+  bool found;
+
+  pthread_mutex_lock(&export->lock);
+  *offset = export->next_chunk * export->chunk_size;
+  found = *offset < export->size;
+  if (found)
+    export->next_chunk++;
+  pthread_mutex_unlock(&export->lock);
+
+  if (found)
+    *length = (int) Min(export->chunk_size, export->size - *offset);
+
+  return found;
+}
+
+static bool
+write_chunk(int fd, const char *data, int length, int64 offset)
+{
+  while (length > 0)
+  {
+    ssize_t written = pwrite(fd, data, length, offset);
+
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      pg_log_error("could not write at offset " INT64_FORMAT ": %m", offset);
+      return false;
+    }
+    data += written;
+    length -= written;
+    offset += written;
+  }
+
+  return true;
+}
+
+static void *
+export_thread(void *arg)
+{
+  ExportJob *job = (ExportJob *) arg;
+  Export    *export = job->export;
+  char      *buffer = NULL;
+  int        lo = -1;
+  int64      offset;
+  int        length;
+
+  if (export->oid != InvalidOid)
+  {
+    buffer = pg_malloc(export->chunk_size);
+    lo = lo_open(job->conn, export->oid, INV_READ);
+    if (lo < 0)
+    {
+      pg_log_error("could not open large object %u: %s", export->oid,
+                   PQerrorMessage(job->conn));
+      job->failed = true;
+      return NULL;
+    }
+  }
+
+  while (!job->failed && next_chunk(export, &offset, &length))
+  {
+    if (lo >= 0)
+    {
+      int done = 0;
+
+      if (lo_lseek64(job->conn, lo, offset, SEEK_SET) < 0)
+      {
+        pg_log_error("could not seek in large object %u: %s", export->oid,
+                     PQerrorMessage(job->conn));
+        job->failed = true;
+        break;
+      }
+
+      while (done < length)
+      {
+        int n = lo_read(job->conn, lo, buffer + done, length - done);
+
+        if (n <= 0)
+        {
+          pg_log_error("could not read large object %u: %s", export->oid,
+                       PQerrorMessage(job->conn));
+          job->failed = true;
+          break;
+        }
+        done += n;
+      }
+
+      if (!job->failed && !write_chunk(export->fd, buffer, length, offset))
+        job->failed = true;
+    }
+    else
+    {
+      char        from[32];
+      char        count[32];
+      const char *values[2] = {from, count};
+      PGresult   *res;
+
+      /* substring counts from 1 */
+      snprintf(from, sizeof(from), INT64_FORMAT, offset + 1);
+      snprintf(count, sizeof(count), "%d", length);
+
+      res = PQexecPrepared(job->conn, "export_chunk", 2, values, NULL, NULL, 1);
+      if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1 ||
+          PQgetlength(res, 0, 0) != length)
+      {
+        pg_log_error("could not read the value at offset " INT64_FORMAT ": %s",
+                     offset, PQerrorMessage(job->conn));
+        job->failed = true;
+      }
+      else if (!write_chunk(export->fd, PQgetvalue(res, 0, 0), length, offset))
+        job->failed = true;
+      PQclear(res);
+    }
+
+    if (!job->failed)
+      job->bytes += length;
+  }
+
+  if (lo >= 0)
+    lo_close(job->conn, lo);
+  pg_free(buffer);
+
+  return NULL;
+}
@@ -0,0 +1,18 @@
+/*
+ * export, large values exported by client
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "libpq-fe.h"
+
+extern void export_large_object(PGconn **conns, int njobs, Oid oid,
+                                const char *output, int chunk_size);
+extern void export_bytea(PGconn **conns, int njobs, const char *query,
+                         const char *output, int chunk_size);
+
+#endif                          /* EXPORT_H */
@@ -0,0 +1,372 @@
+/*
+ * notify, LISTEN/NOTIFY benchmark of client
+ *
+ * Listener connections all LISTEN on one channel and are read by a single
+ * event loop, polling their sockets. Notifier threads, one connection each,
+ * send pg_notify at a fixed rate, each payload holding the number of the
+ * step, of the notifier, a sequence number and the time of the sending.
+ * Notifications left from a previous step are ignored.
+ *
+ * For each listener and notifier, the event loop checks that the sequence
+ * numbers arrive in order, and counts the notifications lost or coalesced
+ * as the ones sent but never received. Each delivery latency goes into a
+ * histogram with a resolution of HISTOGRAM_STEP microseconds, giving the
+ * percentiles with a bounded memory.
+ *
+ * With a rate of 0, the rate starts at RAMP_START notifications per second
+ * and doubles at each step, until the notifiers fall behind, a notification
+ * is lost, or the 99th percentile goes over RAMP_MAX_P99: the last rate
+ * sustained is the one reported.
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include "postgres_fe.h"
+#include "common/logging.h"
+#include "portability/instr_time.h"
+
+#include "notify.h"
+
+#define NOTIFY_CHANNEL "client_benchmark"
+
+/* latency histogram: HISTOGRAM_SIZE buckets of HISTOGRAM_STEP us, then one */
+#define HISTOGRAM_STEP 10
+#define HISTOGRAM_SIZE 100000
+
+/* waiting for the last notifications after the notifiers stopped, in s */
+#define DRAIN_TIMEOUT 5
+
+#define RAMP_START 1000
+#define RAMP_MAX_P99 100000     /* us */
+
+typedef struct Notifier
+{
+  pthread_t     thread;
+  PGconn       *conn;
+  int           id;
+  int           step;
+  double        rate;
+  int           duration;
+  instr_time    start;
+  int64         sent;
+  double        elapsed;        /* time taken to send them, in s */
+  bool          failed;
+} Notifier;
+
+typedef struct Phase
+{
+  int           step;
+  int           rate;
+  int64         sent;
+  int64         expected;
+  int64         received;
+  int64         out_of_order;
+  double        send_rate;
+  double        delivery_rate;
+  int64         p50;
+  int64         p90;
+  int64         p99;
+  int64         max;
+} Phase;
+
+static void run_phase(PGconn **listeners, int nlisteners,
+                      PGconn **notifiers, int nnotifiers,
+                      int rate, int duration, Phase *phase);
+static void *notifier_thread(void *arg);
+static int64 percentile(const int64 *histogram, int64 count, double fraction);
+static void print_phase(const Phase *phase);
+
+static int64
+elapsed_us(instr_time start)
+{
+  instr_time now;
+
+  INSTR_TIME_SET_CURRENT(now);
+  INSTR_TIME_SUBTRACT(now, start);
+  return INSTR_TIME_GET_MICROSEC(now);
+}
+
+/*
+ * benchmark_notify
+ *
+ * Runs the benchmark at rate notifications per second, or ramps the rate
+ * up with 0, each step lasting duration seconds.
+ */
+void
+benchmark_notify(PGconn **listeners, int nlisteners, PGconn **notifiers,
+                 int nnotifiers, int rate, int duration)
+{
+  Phase phase;
+  int   sustained = 0;
+
+  for (int i = 0; i < nlisteners; i++)
+  {
+    PGresult *res = PQexec(listeners[i], "LISTEN " NOTIFY_CHANNEL);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+      pg_fatal("could not listen: %s", PQerrorMessage(listeners[i]));
+    PQclear(res);
+  }
+
+  for (int i = 0; i < nnotifiers; i++)
+  {
+    PGresult *res = PQprepare(notifiers[i], "notify",
+                              "SELECT pg_notify('" NOTIFY_CHANNEL "', $1)", 1, NULL);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+      pg_fatal("could not prepare: %s", PQerrorMessage(notifiers[i]));
+    PQclear(res);
+  }
+
+  printf("%d listeners, %d notifiers\n", nlisteners, nnotifiers);
+
+  if (rate > 0)
+  {
+    run_phase(listeners, nlisteners, notifiers, nnotifiers, rate, duration, &phase);
+    print_phase(&phase);
+    return;
+  }
+
+  for (rate = RAMP_START;; rate *= 2)
+  {
+    run_phase(listeners, nlisteners, notifiers, nnotifiers, rate, duration, &phase);
+    print_phase(&phase);
+
+    if (phase.send_rate < 0.95 * rate || phase.received < phase.expected ||
+        phase.p99 > RAMP_MAX_P99 || rate > INT_MAX / 2)
+      break;
+    sustained = rate;
+  }
+
+  if (sustained > 0)
+    printf("max sustainable rate: %d notifications/s\n", sustained);
+  else
+    printf("max sustainable rate: below %d notifications/s\n", RAMP_START);
+}
+
+/*
+ * run_phase
+ *
+ * Sends notifications at rate per second during duration seconds, and
+ * reads them with the event loop of the listeners, until they all arrived
+ * or DRAIN_TIMEOUT passed.
+ */
+static void
+run_phase(PGconn **listeners, int nlisteners, PGconn **notifiers,
+          int nnotifiers, int rate, int duration, Phase *phase)
+{
+  Notifier      *threads = pg_malloc0(nnotifiers * sizeof(Notifier));
+  struct pollfd *fds = pg_malloc(nlisteners * sizeof(struct pollfd));
+  int64         *last = pg_malloc(nlisteners * nnotifiers * sizeof(int64));
+  int64         *histogram = pg_malloc0((HISTOGRAM_SIZE + 1) * sizeof(int64));
+  instr_time     start;
+  int            running;
+  int64          drain_start = 0;
+  double         elapsed = 0.0;
+  static int     step = 0;
+
+  memset(phase, 0, sizeof(Phase));
+  phase->step = ++step;
+  phase->rate = rate;
+  for (int i = 0; i < nlisteners * nnotifiers; i++)
+    last[i] = -1;
+
+  for (int i = 0; i < nlisteners; i++)
+  {
+    fds[i].fd = PQsocket(listeners[i]);
+    fds[i].events = POLLIN;
+  }
+
+  INSTR_TIME_SET_CURRENT(start);
+
+  for (int i = 0; i < nnotifiers; i++)
+  {
+    threads[i].conn = notifiers[i];
+    threads[i].id = i;
+    threads[i].step = phase->step;
+    threads[i].rate = (double) rate / nnotifiers;
+    threads[i].duration = duration;
+    threads[i].start = start;
+    errno = pthread_create(&threads[i].thread, NULL, notifier_thread, &threads[i]);
+    if (errno != 0)
+      pg_fatal("could not create thread: %m");
+  }
+  running = nnotifiers;
+
+  /* the event loop, the notifiers are joined once their time is over */
+  for (;;)
+  {
+    int64 now = elapsed_us(start);
+
+    if (running > 0 && now >= (int64) duration * 1000000)
+    {
+      for (int i = 0; i < nnotifiers; i++)
+      {
+        pthread_join(threads[i].thread, NULL);
+        if (threads[i].failed)
+          pg_fatal("notifier %d failed", i);
+        phase->sent += threads[i].sent;
+        elapsed = Max(elapsed, threads[i].elapsed);
+      }
+      running = 0;
+      phase->expected = phase->sent * nlisteners;
+      drain_start = elapsed_us(start);
+    }
+
+    if (running == 0 &&
+        (phase->received + phase->out_of_order >= phase->expected ||
+         now - drain_start >= DRAIN_TIMEOUT * 1000000))
+      break;
+
+    if (poll(fds, nlisteners, 100) < 0 && errno != EINTR)
+      pg_fatal("could not poll: %m");
+
+    for (int i = 0; i < nlisteners; i++)
+    {
+      PGnotify *notify;
+
+      if (!(fds[i].revents & POLLIN))
+        continue;
+      if (!PQconsumeInput(listeners[i]))
+        pg_fatal("could not read notifications: %s", PQerrorMessage(listeners[i]));
+
+      now = elapsed_us(start);
+      while ((notify = PQnotifies(listeners[i])) != NULL)
+      {
+        int   notifier_step;
+        int   notifier;
+        int64 seq;
+        int64 sent_us;
+        int64 latency;
+
+        if (sscanf(notify->extra, "%d:%d:" INT64_FORMAT ":" INT64_FORMAT,
+                   &notifier_step, &notifier, &seq, &sent_us) != 4 ||
+            notifier < 0 || notifier >= nnotifiers)
+        {
+          pg_log_warning("unexpected payload \"%s\"", notify->extra);
+          PQfreemem(notify);
+          continue;
+        }
+        if (notifier_step != phase->step)
+        {
+          PQfreemem(notify);
+          continue;
+        }
+
+        /* one sender is delivered in order */
+        if (seq <= last[i * nnotifiers + notifier])
+          phase->out_of_order++;
+        else
+        {
+          last[i * nnotifiers + notifier] = seq;
+          phase->received++;
+        }
+
+        latency = Max(now - sent_us, 0);
+        histogram[Min(latency / HISTOGRAM_STEP, HISTOGRAM_SIZE)]++;
+        phase->max = Max(phase->max, latency);
+
+        PQfreemem(notify);
+      }
+    }
+  }
+
+  phase->send_rate = elapsed > 0 ? phase->sent / elapsed : 0;
+  phase->delivery_rate = (double) phase->received / nlisteners / duration;
+  phase->p50 = percentile(histogram, phase->received + phase->out_of_order, 0.50);
+  phase->p90 = percentile(histogram, phase->received + phase->out_of_order, 0.90);
+  phase->p99 = percentile(histogram, phase->received + phase->out_of_order, 0.99);
+
+  pg_free(histogram);
+  pg_free(last);
+  pg_free(fds);
+  pg_free(threads);
+}
+
+/*
+ * notifier_thread
+ *
+ * Sends at a fixed rate from the start of the phase, as fast as possible
+ * when late: a notifier that cannot keep up shows as a send rate under the
+ * target.
+ */
+static void *
+notifier_thread(void *arg)
+{
+  Notifier *notifier = (Notifier *) arg;
+  int64     end = (int64) notifier->duration * 1000000;
+  int64     now;
+
+  while ((now = elapsed_us(notifier->start)) < end)
+  {
+    char        payload[64];
+    const char *values[1] = {payload};
+    int64       due = (int64) (notifier->sent * 1000000 / notifier->rate);
+    PGresult   *res;
+
+    if (due > now)
+    {
+      pg_usleep(Min(due - now, end - now));
+      continue;
+    }
+
+    snprintf(payload, sizeof(payload), "%d:%d:" INT64_FORMAT ":" INT64_FORMAT,
+             notifier->step, notifier->id, notifier->sent,
+             elapsed_us(notifier->start));
+    res = PQexecPrepared(notifier->conn, "notify", 1, values, NULL, NULL, 0);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK)
+    {
+      pg_log_error("could not notify: %s", PQerrorMessage(notifier->conn));
+      PQclear(res);
+      notifier->failed = true;
+      break;
+    }
+    PQclear(res);
+    notifier->sent++;
+  }
+
+  notifier->elapsed = elapsed_us(notifier->start) / 1000000.0;
+
+  return NULL;
+}
+
+/* upper bound of the bucket holding the percentile, in us */
+static int64
+percentile(const int64 *histogram, int64 count, double fraction)
+{
+  int64 target = (int64) ceil(count * fraction);
+  int64 seen = 0;
+
+  if (count == 0)
+    return 0;
+
+  for (int i = 0; i <= HISTOGRAM_SIZE; i++)
+  {
+    seen += histogram[i];
+    if (seen >= target)
+      return (int64) (i + 1) * HISTOGRAM_STEP;
+  }
+
+  return (int64) (HISTOGRAM_SIZE + 1) * HISTOGRAM_STEP;
+}
+
+static void
+print_phase(const Phase *phase)
+{
+  printf("rate %d/s: sent " INT64_FORMAT " (%.0f/s), delivered " INT64_FORMAT
+         " of " INT64_FORMAT " (%.0f/s per listener), lost or coalesced " INT64_FORMAT
+         ", out of order " INT64_FORMAT "\n",
+         phase->rate, phase->sent, phase->send_rate, phase->received,
+         phase->expected, phase->delivery_rate,
+         phase->expected - phase->received - phase->out_of_order,
+         phase->out_of_order);
+  printf("  latency: p50 " INT64_FORMAT " us, p90 " INT64_FORMAT " us, p99 "
+         INT64_FORMAT " us, max " INT64_FORMAT " us\n",
+         phase->p50, phase->p90, phase->p99, phase->max);
+}
@@ -0,0 +1,17 @@
+/*
+ * notify, LISTEN/NOTIFY benchmark of client
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+#include "libpq-fe.h"
+
+extern void benchmark_notify(PGconn **listeners, int nlisteners,
+                             PGconn **notifiers, int nnotifiers,
+                             int rate, int duration);
+
+#endif                          /* NOTIFY_H */
@@ -0,0 +1,261 @@
+/*
+ * sampler, wait events sampled by client
+ *
+ * Polls pg_stat_activity at a fixed frequency and counts the samples of
+ * each (state, wait_event_type, wait_event, query_id), like the profile of
+ * pg_wait_sampling but without any server extension. A backend without a
+ * wait event is counted as CPU.
+ *
+ * The query is prepared once and its results are read in binary, so a
+ * sample costs the server one Bind/Execute and no output conversion. The
+ * time of each round trip is measured, and its share of the elapsed time
+ * is reported with the profile: it is an upper bound of the cost of the
+ * sampling for the server.
+ *
+ * Every report interval, the samples of the interval are printed. At the
+ * end, the whole profile is written in the folded format of FlameGraph,
+ * one "state;type;event;query_id count" line per key.
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include "postgres_fe.h"
+#include "common/hashfn.h"
+#include "common/logging.h"
+#include "port/pg_bswap.h"
+#include "portability/instr_time.h"
+
+#include "sampler.h"
+
+/* number of buckets, a power of 2 */
+#define SAMPLER_BUCKETS 256
+
+/* number of keys printed at each report */
+#define SAMPLER_REPORT_TOP 10
+
+#define SAMPLER_QUERY \
+  "SELECT coalesce(state, ''), coalesce(wait_event_type, 'CPU'), " \
+  "coalesce(wait_event, 'CPU'), coalesce(query_id, 0) " \
+  "FROM pg_stat_activity " \
+  "WHERE pid <> pg_backend_pid() AND state IS DISTINCT FROM 'idle'"
+
+typedef struct SampleEntry
+{
+  struct SampleEntry *next;
+  uint32        hash;
+  char         *key;            /* state;type;event;query_id */
+  int64         total;
+  int64         interval;
+} SampleEntry;
+
+typedef struct Profile
+{
+  SampleEntry  *buckets[SAMPLER_BUCKETS];
+  int           nentries;
+} Profile;
+
+static void profile_add(Profile *profile, const char *key);
+static void profile_report(Profile *profile, int64 samples);
+static void profile_write(const Profile *profile, const char *output);
+
+/*
+ * sample_wait_events
+ *
+ * Samples during duration seconds, every 1/frequency second. A sample
+ * late by more than a period is skipped, not caught up.
+ */
+void
+sample_wait_events(PGconn *conn, int frequency, int duration,
+                   int report_interval, const char *output)
+{
+  Profile     profile;
+  PGresult   *res;
+  instr_time  start;
+  instr_time  now;
+  instr_time  before;
+  double      period = 1.0 / frequency;
+  double      next = 0.0;
+  double      next_report = report_interval;
+  double      elapsed;
+  double      cost = 0.0;
+  double      max_cost = 0.0;
+  int64       samples = 0;
+  int64       interval_samples = 0;
+  int64       skipped = 0;
+
+  memset(&profile, 0, sizeof(profile));
+
+  res = PQprepare(conn, "wait_sampling", SAMPLER_QUERY, 0, NULL);
+  if (PQresultStatus(res) != PGRES_COMMAND_OK)
+    pg_fatal("could not prepare the sampling query: %s", PQerrorMessage(conn));
+  PQclear(res);
+
+  INSTR_TIME_SET_CURRENT(start);
+
+  for (;;)
+  {
+    double sample_cost;
+
+    INSTR_TIME_SET_CURRENT(before);
+    res = PQexecPrepared(conn, "wait_sampling", 0, NULL, NULL, NULL, 1);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK)
+      pg_fatal("sampling failed: %s", PQerrorMessage(conn));
+
+    for (int i = 0; i < PQntuples(res); i++)
+    {
+      char   key[NAMEDATALEN * 3 + 32];
+      uint64 query_id;
+
+      /* int8 in network order */
+      memcpy(&query_id, PQgetvalue(res, i, 3), sizeof(query_id));
+      query_id = pg_ntoh64(query_id);
+
+      /* binary text is not converted, libpq ends it by '\0' */
+      snprintf(key, sizeof(key), "%s;%s;%s;" INT64_FORMAT,
+               PQgetvalue(res, i, 0), PQgetvalue(res, i, 1),
+               PQgetvalue(res, i, 2), (int64) query_id);
+      profile_add(&profile, key);
+    }
+    PQclear(res);
+
+    INSTR_TIME_SET_CURRENT(now);
+    elapsed = INSTR_TIME_GET_DOUBLE(now) - INSTR_TIME_GET_DOUBLE(start);
+    sample_cost = INSTR_TIME_GET_DOUBLE(now) - INSTR_TIME_GET_DOUBLE(before);
+    cost += sample_cost;
+    max_cost = Max(max_cost, sample_cost);
+    samples++;
+    interval_samples++;
+
+    if (report_interval > 0 && elapsed >= next_report)
+    {
+      printf("%.1f s, " INT64_FORMAT " samples, round trip %.0f us on average\n",
+             elapsed, interval_samples, cost * 1000000 / samples);
+      profile_report(&profile, interval_samples);
+      interval_samples = 0;
+      next_report += report_interval;
+    }
+
+    if (elapsed >= duration)
+      break;
+
+    /* fixed rate, from the start */
+    next += period;
+    if (next < elapsed)
+    {
+      int64 late = (int64) ((elapsed - next) / period) + 1;
+
+      skipped += late;
+      next += late * period;
+    }
+    pg_usleep((long) ((next - elapsed) * 1000000));
+  }
+
+  printf(INT64_FORMAT " samples at %d Hz, " INT64_FORMAT " skipped\n",
+         samples, frequency, skipped);
+  printf("sampling cost: %.0f us per round trip on average, %.0f us at most, "
+         "%.3f%% of the time\n",
+         cost * 1000000 / samples, max_cost * 1000000, cost * 100 / elapsed);
+
+  profile_write(&profile, output);
+}
+
+static void
+profile_add(Profile *profile, const char *key)
+{
+  uint32        hash = hash_bytes((const unsigned char *) key, strlen(key));
+  SampleEntry **bucket = &profile->buckets[hash & (SAMPLER_BUCKETS - 1)];
+  SampleEntry  *entry;
+
+  for (entry = *bucket; entry; entry = entry->next)
+  {
+    if (entry->hash == hash && strcmp(entry->key, key) == 0)
+      break;
+  }
+
+  if (entry == NULL)
+  {
+    entry = pg_malloc0(sizeof(SampleEntry));
+    entry->hash = hash;
+    entry->key = pg_strdup(key);
+    entry->next = *bucket;
+    *bucket = entry;
+    profile->nentries++;
+  }
+
+  entry->total++;
+  entry->interval++;
+}
+
+static int
+compare_interval(const void *a, const void *b)
+{
+  const SampleEntry *ea = *(SampleEntry *const *) a;
+  const SampleEntry *eb = *(SampleEntry *const *) b;
+
+  if (ea->interval != eb->interval)
+    return ea->interval > eb->interval ? -1 : 1;
+  return strcmp(ea->key, eb->key);
+}
+
+/*
+ * profile_report
+ *
+ * Prints the keys seen most during the interval, as the average number of
+ * backends in each, then starts a new interval.
+ */
+static void
+profile_report(Profile *profile, int64 samples)
+{
+  SampleEntry **entries;
+  int           n = 0;
+
+  entries = pg_malloc(Max(profile->nentries, 1) * sizeof(SampleEntry *));
+  for (int i = 0; i < SAMPLER_BUCKETS; i++)
+  {
+    for (SampleEntry *entry = profile->buckets[i]; entry; entry = entry->next)
+    {
+      if (entry->interval > 0)
+        entries[n++] = entry;
+    }
+  }
+
+  qsort(entries, n, sizeof(SampleEntry *), compare_interval);
+
+  for (int i = 0; i < n && i < SAMPLER_REPORT_TOP; i++)
+    printf("  %8.2f  %s\n", (double) entries[i]->interval / samples, entries[i]->key);
+
+  for (int i = 0; i < n; i++)
+    entries[i]->interval = 0;
+
+  pg_free(entries);
+}
+
+/*
+ * profile_write
+ *
+ * Writes the profile in the folded format, to stdout without output.
+ */
+static void
+profile_write(const Profile *profile, const char *output)
+{
+  FILE *file = stdout;
+
+  if (output)
+  {
+    file = fopen(output, "w");
+    if (file == NULL)
+      pg_fatal("could not open file \"%s\": %m", output);
+  }
+
+  for (int i = 0; i < SAMPLER_BUCKETS; i++)
+  {
+    for (SampleEntry *entry = profile->buckets[i]; entry; entry = entry->next)
+      fprintf(file, "%s " INT64_FORMAT "\n", entry->key, entry->total);
+  }
+
+  if (output && fclose(file) != 0)
+    pg_fatal("could not write file \"%s\": %m", output);
+}
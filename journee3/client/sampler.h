@@ -0,0 +1,16 @@
+/*
+ * sampler, wait events sampled by client
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "libpq-fe.h"
+
+extern void sample_wait_events(PGconn *conn, int frequency, int duration,
+                               int report_interval, const char *output);
+
+#endif                          /* SAMPLER_H */
@@ -0,0 +1,1250 @@
+/*
+ * script, scripts run by client
+ *
+ * A script mixes SQL commands, ended by a semicolon, and meta-commands:
+ *
+ *   \set name expression
+ *   \sleep expression [us | ms | s]
+ *   \if expression, \elif expression, \else, \endif
+ *
+ * Expressions use integers, doubles, :variables, + - * / %, comparisons,
+ * and, or, not, and the functions abs, int, double, random(lb, ub),
+ * random_exponential(lb, ub, parameter) and random_zipfian(lb, ub, s). The
+ * variable client_id holds the number of the client.
+ *
+ * The script is parsed once. Variables become indexes in an array of each
+ * client, expressions become code for a small stack machine, \if becomes
+ * jumps between commands, and the variables of a SQL command become the
+ * parameters of a statement prepared once per connection. Running a
+ * transaction then only evaluates this code.
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <ctype.h>
+#include <math.h>
+#include "postgres_fe.h"
+#include "common/int.h"
+#include "common/logging.h"
+#include "common/pg_prng.h"
+#include "common/string.h"
+#include "lib/stringinfo.h"
+
+#include "script.h"
+
+/* depth of the stack of an expression */
+#define MAX_STACK 64
+
+typedef enum OpCode
+{
+  OP_INT,
+  OP_DOUBLE,
+  OP_VARIABLE,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_MOD,
+  OP_NEG,
+  OP_EQ,
+  OP_NE,
+  OP_LT,
+  OP_LE,
+  OP_GT,
+  OP_GE,
+  OP_AND,
+  OP_OR,
+  OP_NOT,
+  OP_ABS,
+  OP_TO_INT,
+  OP_TO_DOUBLE,
+  OP_RANDOM,
+  OP_RANDOM_EXPONENTIAL,
+  OP_RANDOM_ZIPFIAN
+} OpCode;
+
+typedef struct Instruction
+{
+  OpCode        op;
+  union
+  {
+    int64       ival;
+    double      dval;
+    int         variable;
+  }             arg;
+} Instruction;
+
+typedef struct Expression
+{
+  Instruction  *code;
+  int           length;
+} Expression;
+
+typedef enum CommandType
+{
+  CMD_SQL,
+  CMD_SET,
+  CMD_SLEEP,
+  CMD_JUMP_IF_FALSE,
+  CMD_JUMP
+} CommandType;
+
+typedef struct Command
+{
+  CommandType   type;
+  int           line;
+  Expression    expr;           /* SET, SLEEP and JUMP_IF_FALSE */
+  int           variable;       /* SET */
+  int64         unit;           /* SLEEP, microseconds per unit */
+  int           target;         /* JUMP and JUMP_IF_FALSE, next command */
+  char         *sql;            /* SQL, with $n for the variables */
+  int           nparams;
+  int          *params;         /* variable of each $n */
+} Command;
+
+struct Script
+{
+  const char   *path;
+  Command      *commands;
+  int           ncommands;
+  int           size;
+  char        **variables;      /* name of each index */
+  int           nvariables;
+  int           max_params;
+};
+
+/* functions of expressions, with their number of arguments */
+static const struct
+{
+  const char   *name;
+  OpCode        op;
+  int           nargs;
+} functions[] = {
+  {"abs", OP_ABS, 1},
+  {"int", OP_TO_INT, 1},
+  {"double", OP_TO_DOUBLE, 1},
+  {"random", OP_RANDOM, 2},
+  {"random_exponential", OP_RANDOM_EXPONENTIAL, 3},
+  {"random_zipfian", OP_RANDOM_ZIPFIAN, 3},
+  {NULL, 0, 0}
+};
+
+/* state of the compilation of an expression */
+typedef struct ExprParser
+{
+  Script       *script;
+  int           line;
+  const char   *p;
+  Instruction  *code;
+  int           length;
+  int           size;
+  int           depth;
+} ExprParser;
+
+/* an \if being parsed */
+typedef struct IfFrame
+{
+  int           pending;        /* JUMP_IF_FALSE to patch, or -1 */
+  int          *ends;           /* JUMPs to the \endif */
+  int           nends;
+  bool          else_seen;
+} IfFrame;
+
+static Command *add_command(Script *script, CommandType type, int line);
+static int  find_variable(Script *script, const char *name, int len, bool create);
+static void parse_sql(Script *script, int line, const char *text);
+static void parse_meta(Script *script, int line, char *text,
+                       IfFrame **frames, int *nframes);
+static void parse_expression(Script *script, int line, const char *text,
+                             Expression *expr);
+static void parse_or(ExprParser *ep);
+static void parse_and(ExprParser *ep);
+static void parse_not(ExprParser *ep);
+static void parse_comparison(ExprParser *ep);
+static void parse_additive(ExprParser *ep);
+static void parse_multiplicative(ExprParser *ep);
+static void parse_unary(ExprParser *ep);
+static void parse_primary(ExprParser *ep);
+static bool accept_keyword(ExprParser *ep, const char *keyword);
+static void emit(ExprParser *ep, OpCode op, int pushed, int popped);
+static bool evaluate(ScriptClient *client, const Command *cmd,
+                     ScriptValue *result);
+static bool to_int(const ScriptValue *value, int64 *result);
+static double to_double(const ScriptValue *value);
+static int64 random_exponential(pg_prng_state *state, int64 min, int64 max,
+                                double parameter);
+static int64 random_zipfian(pg_prng_state *state, int64 min, int64 max,
+                            double s);
+
+/*
+ * script_parse
+ *
+ * Reads and compiles a script, exits on error.
+ */
+Script *
+script_parse(const char *path)
+{
+  Script       *script;
+  FILE         *file;
+  StringInfoData line;
+  StringInfoData sql;
+  int           lineno = 0;
+  int           sql_line = 0;
+  IfFrame      *frames = NULL;
+  int           nframes = 0;
+
+  file = fopen(path, "r");
+  if (file == NULL)
+    pg_fatal("could not open file \"%s\": %m", path);
+
+  script = pg_malloc0(sizeof(Script));
+  script->path = pg_strdup(path);
+
+  /* first variable, set by script_client_create */
+  find_variable(script, "client_id", 9, true);
+
+  initStringInfo(&line);
+  initStringInfo(&sql);
+
+  while (pg_get_line_buf(file, &line))
+  {
+    char *text = line.data;
+    int   len;
+
+    lineno++;
+    (void) pg_strip_crlf(text);
+    while (isspace((unsigned char) *text))
+      text++;
+
+    if (sql.len == 0 && (*text == '\0' || strncmp(text, "--", 2) == 0))
+      continue;
+
+    if (*text == '\\')
+    {
+      if (sql.len > 0)
+        pg_fatal("%s:%d: SQL command not ended by a semicolon", path, sql_line);
+      parse_meta(script, lineno, text + 1, &frames, &nframes);
+      continue;
+    }
+
+    if (sql.len == 0)
+      sql_line = lineno;
+    else
+      appendStringInfoChar(&sql, '\n');
+    appendStringInfoString(&sql, text);
+
+    len = strlen(text);
+    while (len > 0 && isspace((unsigned char) text[len - 1]))
+      len--;
+    if (len > 0 && text[len - 1] == ';')
+    {
+      parse_sql(script, sql_line, sql.data);
+      resetStringInfo(&sql);
+    }
+  }
+
+  if (ferror(file))
+    pg_fatal("could not read file \"%s\": %m", path);
+  fclose(file);
+
+  if (sql.len > 0)
+    parse_sql(script, sql_line, sql.data);
+  if (nframes > 0)
+    pg_fatal("%s: \\if without \\endif", path);
+
+  pfree(line.data);
+  pfree(sql.data);
+  pg_free(frames);
+
+  return script;
+}
+
+static Command *
+add_command(Script *script, CommandType type, int line)
+{
+  Command *cmd;
+
+  if (script->ncommands == script->size)
+  {
+    script->size = Max(16, script->size * 2);
+    script->commands = pg_realloc(script->commands,
+                                  script->size * sizeof(Command));
+  }
+
+  cmd = &script->commands[script->ncommands++];
+  memset(cmd, 0, sizeof(Command));
+  cmd->type = type;
+  cmd->line = line;
+
+  return cmd;
+}
+
+/*
+ * find_variable
+ *
+ * Returns the index of a variable, -1 if unknown and not created.
+ */
+static int
+find_variable(Script *script, const char *name, int len, bool create)
+{
+  for (int i = 0; i < script->nvariables; i++)
+  {
+    if (strncmp(script->variables[i], name, len) == 0 &&
+        script->variables[i][len] == '\0')
+      return i;
+  }
+
+  if (!create)
+    return -1;
+
+  script->variables = pg_realloc(script->variables,
+                                 (script->nvariables + 1) * sizeof(char *));
+  script->variables[script->nvariables] = pnstrdup(name, len);
+
+  return script->nvariables++;
+}
+
+static bool
+is_variable_char(char c, bool first)
+{
+  return isalpha((unsigned char) c) || c == '_' ||
+         (!first && isdigit((unsigned char) c));
+}
+
+/*
+ * parse_sql
+ *
+ * Replaces the :variables of a SQL command, outside of literals and
+ * quoted identifiers, by parameters. A variable used twice is the same
+ * parameter.
+ */
+static void
+parse_sql(Script *script, int line, const char *text)
+{
+  Command       *cmd = add_command(script, CMD_SQL, line);
+  StringInfoData sql;
+  char           quote = '\0';
+  int            len = strlen(text);
+
+  /* the semicolon would make an empty second statement */
+  while (len > 0 && (isspace((unsigned char) text[len - 1]) || text[len - 1] == ';'))
+    len--;
+
+  initStringInfo(&sql);
+
+  for (const char *p = text; p < text + len; p++)
+  {
+    if (quote != '\0')
+    {
+      if (*p == quote)
+        quote = '\0';
+    }
+    else if (*p == '\'' || *p == '"')
+      quote = *p;
+    else if (*p == ':' && p[1] == ':')
+    {
+      /* a cast */
+      appendStringInfoChar(&sql, *p++);
+    }
+    else if (*p == ':' && is_variable_char(p[1], true))
+    {
+      const char *name = p + 1;
+      int         namelen = 1;
+      int         variable;
+      int         param;
+
+      while (is_variable_char(name[namelen], false))
+        namelen++;
+
+      variable = find_variable(script, name, namelen, false);
+      if (variable < 0)
+        pg_fatal("%s:%d: undefined variable \"%.*s\"",
+                 script->path, line, namelen, name);
+
+      for (param = 0; param < cmd->nparams; param++)
+      {
+        if (cmd->params[param] == variable)
+          break;
+      }
+      if (param == cmd->nparams)
+      {
+        cmd->params = pg_realloc(cmd->params, (cmd->nparams + 1) * sizeof(int));
+        cmd->params[cmd->nparams++] = variable;
+      }
+
+      appendStringInfo(&sql, "$%d", param + 1);
+      p += namelen;
+      continue;
+    }
+
+    appendStringInfoChar(&sql, *p);
+  }
+
+  cmd->sql = sql.data;
+  script->max_params = Max(script->max_params, cmd->nparams);
+}
+
+/*
+ * parse_meta
+ *
+ * Compiles a meta-command. \if, \elif and \else jump to their next branch
+ * when their condition is false, and the end of each branch jumps to the
+ * \endif.
+ */
+static void
+parse_meta(Script *script, int line, char *text,
+           IfFrame **frames, int *nframes)
+{
+  const char *path = script->path;
+  char       *args = text;
+  IfFrame    *frame = *nframes > 0 ? &(*frames)[*nframes - 1] : NULL;
+  Command    *cmd;
+
+  while (*args && !isspace((unsigned char) *args))
+    args++;
+  if (*args)
+    *args++ = '\0';
+  while (isspace((unsigned char) *args))
+    args++;
+
+  if (strcmp(text, "set") == 0)
+  {
+    char *name = args;
+    int   namelen = 0;
+
+    if (*name == ':')
+      name++;
+    while (is_variable_char(name[namelen], namelen == 0))
+      namelen++;
+    if (namelen == 0 || !isspace((unsigned char) name[namelen]))
+      pg_fatal("%s:%d: \\set needs a variable and an expression", path, line);
+
+    /* the expression may read the previous value */
+    cmd = add_command(script, CMD_SET, line);
+    parse_expression(script, line, name + namelen, &cmd->expr);
+    cmd = &script->commands[script->ncommands - 1];
+    cmd->variable = find_variable(script, name, namelen, true);
+  }
+  else if (strcmp(text, "sleep") == 0)
+  {
+    char *end = args + strlen(args);
+    char *unit;
+
+    while (end > args && isspace((unsigned char) end[-1]))
+      end--;
+    *end = '\0';
+    unit = end;
+    while (unit > args && !isspace((unsigned char) unit[-1]))
+      unit--;
+
+    /*
+     * The unit is the last word, after the expression. A word made only of
+     * letters cannot end an expression: a function ends with a parenthesis,
+     * a variable starts with a colon.
+     */
+    cmd = add_command(script, CMD_SLEEP, line);
+    cmd->unit = 1000000;
+    if (unit > args && strspn(unit, "abcdefghijklmnopqrstuvwxyz"
+                                    "ABCDEFGHIJKLMNOPQRSTUVWXYZ") == end - unit)
+    {
+      if (strcmp(unit, "us") == 0)
+        cmd->unit = 1;
+      else if (strcmp(unit, "ms") == 0)
+        cmd->unit = 1000;
+      else if (strcmp(unit, "s") != 0)
+        pg_fatal("%s:%d: unknown time unit \"%s\"", path, line, unit);
+      *unit = '\0';
+    }
+
+    parse_expression(script, line, args, &script->commands[script->ncommands - 1].expr);
+  }
+  else if (strcmp(text, "if") == 0)
+  {
+    *frames = pg_realloc(*frames, (*nframes + 1) * sizeof(IfFrame));
+    frame = &(*frames)[(*nframes)++];
+    memset(frame, 0, sizeof(IfFrame));
+
+    frame->pending = script->ncommands;
+    cmd = add_command(script, CMD_JUMP_IF_FALSE, line);
+    parse_expression(script, line, args, &script->commands[frame->pending].expr);
+  }
+  else if (strcmp(text, "elif") == 0 || strcmp(text, "else") == 0)
+  {
+    bool is_else = text[2] == 's';
+
+    if (frame == NULL || frame->else_seen)
+      pg_fatal("%s:%d: \\%s without \\if", path, line, text);
+
+    frame->ends = pg_realloc(frame->ends, (frame->nends + 1) * sizeof(int));
+    frame->ends[frame->nends++] = script->ncommands;
+    add_command(script, CMD_JUMP, line);
+
+    script->commands[frame->pending].target = script->ncommands;
+
+    if (is_else)
+    {
+      frame->pending = -1;
+      frame->else_seen = true;
+    }
+    else
+    {
+      frame->pending = script->ncommands;
+      add_command(script, CMD_JUMP_IF_FALSE, line);
+      parse_expression(script, line, args, &script->commands[frame->pending].expr);
+    }
+  }
+  else if (strcmp(text, "endif") == 0)
+  {
+    if (frame == NULL)
+      pg_fatal("%s:%d: \\endif without \\if", path, line);
+
+    if (frame->pending >= 0)
+      script->commands[frame->pending].target = script->ncommands;
+    for (int i = 0; i < frame->nends; i++)
+      script->commands[frame->ends[i]].target = script->ncommands;
+
+    pg_free(frame->ends);
+    (*nframes)--;
+  }
+  else
+    pg_fatal("%s:%d: unknown meta-command \"\\%s\"", path, line, text);
+}
+
+/*
+ * parse_expression
+ *
+ * Compiles an expression into code for evaluate(), in postfix order.
+ */
+static void
+parse_expression(Script *script, int line, const char *text, Expression *expr)
+{
+  ExprParser ep;
+
+  memset(&ep, 0, sizeof(ep));
+  ep.script = script;
+  ep.line = line;
+  ep.p = text;
+
+  parse_or(&ep);
+
+  while (isspace((unsigned char) *ep.p))
+    ep.p++;
+  if (*ep.p != '\0')
+    pg_fatal("%s:%d: syntax error at \"%s\"", script->path, line, ep.p);
+
+  expr->code = ep.code;
+  expr->length = ep.length;
+}
+
+static void
+skip_spaces(ExprParser *ep)
+{
+  while (isspace((unsigned char) *ep->p))
+    ep->p++;
+}
+
+static void
+emit(ExprParser *ep, OpCode op, int pushed, int popped)
+{
+  if (ep->length == ep->size)
+  {
+    ep->size = Max(16, ep->size * 2);
+    ep->code = pg_realloc(ep->code, ep->size * sizeof(Instruction));
+  }
+
+  ep->code[ep->length].op = op;
+  ep->code[ep->length].arg.ival = 0;
+  ep->length++;
+
+  ep->depth += pushed - popped;
+  if (ep->depth > MAX_STACK)
+    pg_fatal("%s:%d: expression too complex", ep->script->path, ep->line);
+}
+
+/* keywords end where an identifier would */
+static bool
+accept_keyword(ExprParser *ep, const char *keyword)
+{
+  int len = strlen(keyword);
+
+  skip_spaces(ep);
+  if (pg_strncasecmp(ep->p, keyword, len) == 0 &&
+      !is_variable_char(ep->p[len], false))
+  {
+    ep->p += len;
+    return true;
+  }
+
+  return false;
+}
+
+static bool
+accept(ExprParser *ep, const char *token)
+{
+  int len = strlen(token);
+
+  skip_spaces(ep);
+  if (strncmp(ep->p, token, len) == 0)
+  {
+    ep->p += len;
+    return true;
+  }
+
+  return false;
+}
+
+static void
+parse_or(ExprParser *ep)
+{
+  parse_and(ep);
+  while (accept_keyword(ep, "or"))
+  {
+    parse_and(ep);
+    emit(ep, OP_OR, 1, 2);
+  }
+}
+
+static void
+parse_and(ExprParser *ep)
+{
+  parse_not(ep);
+  while (accept_keyword(ep, "and"))
+  {
+    parse_not(ep);
+    emit(ep, OP_AND, 1, 2);
+  }
+}
+
+static void
+parse_not(ExprParser *ep)
+{
+  if (accept_keyword(ep, "not"))
+  {
+    parse_not(ep);
+    emit(ep, OP_NOT, 1, 1);
+  }
+  else
+    parse_comparison(ep);
+}
+
+static void
+parse_comparison(ExprParser *ep)
+{
+  OpCode op;
+
+  parse_additive(ep);
+
+  /* the longest operators first */
+  if (accept(ep, "<>") || accept(ep, "!="))
+    op = OP_NE;
+  else if (accept(ep, "<="))
+    op = OP_LE;
+  else if (accept(ep, ">="))
+    op = OP_GE;
+  else if (accept(ep, "<"))
+    op = OP_LT;
+  else if (accept(ep, ">"))
+    op = OP_GT;
+  else if (accept(ep, "="))
+    op = OP_EQ;
+  else
+    return;
+
+  parse_additive(ep);
+  emit(ep, op, 1, 2);
+}
+
+static void
+parse_additive(ExprParser *ep)
+{
+  parse_multiplicative(ep);
+  for (;;)
+  {
+    if (accept(ep, "+"))
+    {
+      parse_multiplicative(ep);
+      emit(ep, OP_ADD, 1, 2);
+    }
+    else if (accept(ep, "-"))
+    {
+      parse_multiplicative(ep);
+      emit(ep, OP_SUB, 1, 2);
+    }
+    else
+      break;
+  }
+}
+
+static void
+parse_multiplicative(ExprParser *ep)
+{
+  parse_unary(ep);
+  for (;;)
+  {
+    OpCode op;
+
+    if (accept(ep, "*"))
+      op = OP_MUL;
+    else if (accept(ep, "/"))
+      op = OP_DIV;
+    else if (accept(ep, "%"))
+      op = OP_MOD;
+    else
+      break;
+
+    parse_unary(ep);
+    emit(ep, op, 1, 2);
+  }
+}
+
+static void
+parse_unary(ExprParser *ep)
+{
+  if (accept(ep, "-"))
+  {
+    parse_unary(ep);
+    emit(ep, OP_NEG, 1, 1);
+  }
+  else if (accept(ep, "+"))
+    parse_unary(ep);
+  else
+    parse_primary(ep);
+}
+
+static void
+parse_primary(ExprParser *ep)
+{
+  const char *path = ep->script->path;
+  const char *start;
+
+  skip_spaces(ep);
+  start = ep->p;
+
+  if (accept(ep, "("))
+  {
+    parse_or(ep);
+    if (!accept(ep, ")"))
+      pg_fatal("%s:%d: missing \")\"", path, ep->line);
+  }
+  else if (isdigit((unsigned char) *start) || *start == '.')
+  {
+    char   *end;
+    int64   ival;
+
+    /* an integer unless it has a dot or an exponent */
+    ep->p += strspn(start, "0123456789");
+    if (*ep->p == '.' || *ep->p == 'e' || *ep->p == 'E')
+    {
+      double dval = strtod(start, &end);
+
+      emit(ep, OP_DOUBLE, 1, 0);
+      ep->code[ep->length - 1].arg.dval = dval;
+    }
+    else
+    {
+      errno = 0;
+      ival = strtoi64(start, &end, 10);
+      if (errno != 0)
+        pg_fatal("%s:%d: integer out of range \"%.*s\"", path, ep->line,
+                 (int) (ep->p - start), start);
+
+      emit(ep, OP_INT, 1, 0);
+      ep->code[ep->length - 1].arg.ival = ival;
+    }
+    ep->p = end;
+  }
+  else if (*start == ':')
+  {
+    int namelen = 0;
+    int variable;
+
+    while (is_variable_char(start[1 + namelen], namelen == 0))
+      namelen++;
+
+    variable = find_variable(ep->script, start + 1, namelen, false);
+    if (variable < 0)
+      pg_fatal("%s:%d: undefined variable \"%.*s\"", path, ep->line,
+               namelen, start + 1);
+
+    emit(ep, OP_VARIABLE, 1, 0);
+    ep->code[ep->length - 1].arg.variable = variable;
+    ep->p = start + 1 + namelen;
+  }
+  else if (is_variable_char(*start, true))
+  {
+    int namelen = 0;
+    int nargs = 0;
+    int f;
+
+    while (is_variable_char(start[namelen], namelen == 0))
+      namelen++;
+    ep->p = start + namelen;
+
+    for (f = 0; functions[f].name; f++)
+    {
+      if (strlen(functions[f].name) == namelen &&
+          pg_strncasecmp(functions[f].name, start, namelen) == 0)
+        break;
+    }
+    if (functions[f].name == NULL)
+      pg_fatal("%s:%d: unknown function \"%.*s\"", path, ep->line,
+               namelen, start);
+
+    if (!accept(ep, "("))
+      pg_fatal("%s:%d: missing \"(\" after \"%s\"", path, ep->line,
+               functions[f].name);
+    if (!accept(ep, ")"))
+    {
+      do
+      {
+        parse_or(ep);
+        nargs++;
+      } while (accept(ep, ","));
+      if (!accept(ep, ")"))
+        pg_fatal("%s:%d: missing \")\"", path, ep->line);
+    }
+    if (nargs != functions[f].nargs)
+      pg_fatal("%s:%d: %s takes %d arguments", path, ep->line,
+               functions[f].name, functions[f].nargs);
+
+    emit(ep, functions[f].op, 1, nargs);
+  }
+  else
+    pg_fatal("%s:%d: syntax error at \"%s\"", path, ep->line, start);
+}
+
+/*
+ * script_client_create
+ *
+ * Allocates a client, its variables and its random generator.
+ */
+ScriptClient *
+script_client_create(const Script *script, PGconn *conn, int id)
+{
+  ScriptClient *client = pg_malloc0(sizeof(ScriptClient));
+
+  client->script = script;
+  client->conn = conn;
+  client->id = id;
+  client->variables = pg_malloc0(script->nvariables * sizeof(ScriptValue));
+  client->variables[0].u.ival = id;
+  client->param_text = pg_malloc(Max(script->max_params, 1) * sizeof(*client->param_text));
+  client->param_values = pg_malloc(Max(script->max_params, 1) * sizeof(char *));
+
+  if (!pg_prng_strong_seed(&client->prng))
+    pg_fatal("could not seed the random generator of client %d", id);
+
+  return client;
+}
+
+/*
+ * script_client_prepare
+ *
+ * Prepares the SQL commands of the script on the connection of the client.
+ */
+bool
+script_client_prepare(ScriptClient *client)
+{
+  const Script *script = client->script;
+
+  for (int i = 0; i < script->ncommands; i++)
+  {
+    const Command *cmd = &script->commands[i];
+    char           name[16];
+    PGresult      *res;
+
+    if (cmd->type != CMD_SQL)
+      continue;
+
+    snprintf(name, sizeof(name), "s%d", i);
+    res = PQprepare(client->conn, name, cmd->sql, cmd->nparams, NULL);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+    {
+      pg_log_error("%s:%d: could not prepare: %s",
+                   script->path, cmd->line, PQerrorMessage(client->conn));
+      PQclear(res);
+      return false;
+    }
+    PQclear(res);
+  }
+
+  return true;
+}
+
+/*
+ * script_run
+ *
+ * Runs the script once. Returns false on error, the client should stop.
+ */
+bool
+script_run(ScriptClient *client)
+{
+  const Script *script = client->script;
+  int           pc = 0;
+
+  while (pc < script->ncommands)
+  {
+    const Command *cmd = &script->commands[pc];
+    ScriptValue    value;
+    int64          ival;
+
+    switch (cmd->type)
+    {
+      case CMD_SET:
+        if (!evaluate(client, cmd, &value))
+          return false;
+        client->variables[cmd->variable] = value;
+        pc++;
+        break;
+
+      case CMD_SLEEP:
+        if (!evaluate(client, cmd, &value) || !to_int(&value, &ival))
+          return false;
+        if (ival > 0)
+          pg_usleep(ival * cmd->unit);
+        pc++;
+        break;
+
+      case CMD_JUMP_IF_FALSE:
+        if (!evaluate(client, cmd, &value))
+          return false;
+        pc = to_double(&value) != 0 ? pc + 1 : cmd->target;
+        break;
+
+      case CMD_JUMP:
+        pc = cmd->target;
+        break;
+
+      case CMD_SQL:
+        {
+          char      name[16];
+          PGresult *res;
+
+          for (int i = 0; i < cmd->nparams; i++)
+          {
+            const ScriptValue *param = &client->variables[cmd->params[i]];
+
+            if (param->is_double)
+              snprintf(client->param_text[i], 32, "%.17g", param->u.dval);
+            else
+              snprintf(client->param_text[i], 32, INT64_FORMAT, param->u.ival);
+            client->param_values[i] = client->param_text[i];
+          }
+
+          snprintf(name, sizeof(name), "s%d", pc);
+          res = PQexecPrepared(client->conn, name, cmd->nparams,
+                               client->param_values, NULL, NULL, 0);
+          if (PQresultStatus(res) != PGRES_COMMAND_OK &&
+              PQresultStatus(res) != PGRES_TUPLES_OK)
+          {
+            pg_log_error("client %d, %s:%d: %s", client->id, script->path,
+                         cmd->line, PQerrorMessage(client->conn));
+            PQclear(res);
+            return false;
+          }
+          PQclear(res);
+          pc++;
+        }
+        break;
+    }
+  }
+
+  client->transactions++;
+  return true;
+}
+
+static bool
+to_int(const ScriptValue *value, int64 *result)
+{
+  if (!value->is_double)
+  {
+    *result = value->u.ival;
+    return true;
+  }
+
+  if (isnan(value->u.dval) || !FLOAT8_FITS_IN_INT64(value->u.dval))
+  {
+    pg_log_error("double %g out of range for an integer", value->u.dval);
+    return false;
+  }
+
+  *result = (int64) value->u.dval;
+  return true;
+}
+
+static double
+to_double(const ScriptValue *value)
+{
+  return value->is_double ? value->u.dval : (double) value->u.ival;
+}
+
+/* the new value may be computed from the old one */
+#define SET_INT(v, x) \
+  do { int64 _x = (x); (v)->is_double = false; (v)->u.ival = _x; } while (0)
+#define SET_DOUBLE(v, x) \
+  do { double _x = (x); (v)->is_double = true; (v)->u.dval = _x; } while (0)
+
+/*
+ * evaluate
+ *
+ * Runs the code of the expression of a command. An operation on two
+ * integers gives an integer, checked for overflow, a double otherwise.
+ */
+static bool
+evaluate(ScriptClient *client, const Command *cmd, ScriptValue *result)
+{
+  const Expression *expr = &cmd->expr;
+  ScriptValue       stack[MAX_STACK];
+  int               sp = 0;
+
+  for (int i = 0; i < expr->length; i++)
+  {
+    const Instruction *in = &expr->code[i];
+    ScriptValue       *a = sp > 0 ? &stack[sp - 1] : NULL;
+    ScriptValue       *b = a;
+    int64              x;
+    int64              y;
+    int64              r;
+    double             d;
+
+    /* binary operators leave their result in a */
+    if (in->op >= OP_ADD && in->op <= OP_OR && in->op != OP_NEG)
+    {
+      a = &stack[sp - 2];
+      sp--;
+    }
+
+    switch (in->op)
+    {
+      case OP_INT:
+        SET_INT(&stack[sp], in->arg.ival);
+        sp++;
+        break;
+      case OP_DOUBLE:
+        SET_DOUBLE(&stack[sp], in->arg.dval);
+        sp++;
+        break;
+      case OP_VARIABLE:
+        stack[sp++] = client->variables[in->arg.variable];
+        break;
+
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+        if (a->is_double || b->is_double)
+        {
+          double u = to_double(a);
+          double v = to_double(b);
+
+          SET_DOUBLE(a, in->op == OP_ADD ? u + v : in->op == OP_SUB ? u - v : u * v);
+        }
+        else if (in->op == OP_ADD ? pg_add_s64_overflow(a->u.ival, b->u.ival, &r) :
+                 in->op == OP_SUB ? pg_sub_s64_overflow(a->u.ival, b->u.ival, &r) :
+                 pg_mul_s64_overflow(a->u.ival, b->u.ival, &r))
+        {
+          pg_log_error("%s:%d: bigint out of range", client->script->path, cmd->line);
+          return false;
+        }
+        else
+          SET_INT(a, r);
+        break;
+      case OP_DIV:
+      case OP_MOD:
+        if (a->is_double || b->is_double)
+        {
+          d = to_double(b);
+          if (in->op == OP_MOD)
+          {
+            pg_log_error("%s:%d: %% needs integers", client->script->path, cmd->line);
+            return false;
+          }
+          if (d == 0.0)
+            goto division_by_zero;
+          SET_DOUBLE(a, to_double(a) / d);
+        }
+        else
+        {
+          if (b->u.ival == 0)
+            goto division_by_zero;
+          /* PG_INT64_MIN / -1 overflows */
+          if (b->u.ival == -1)
+          {
+            if (in->op == OP_MOD)
+              SET_INT(a, 0);
+            else if (pg_sub_s64_overflow(0, a->u.ival, &r))
+            {
+              pg_log_error("%s:%d: bigint out of range", client->script->path, cmd->line);
+              return false;
+            }
+            else
+              SET_INT(a, r);
+          }
+          else
+            SET_INT(a, in->op == OP_DIV ? a->u.ival / b->u.ival : a->u.ival % b->u.ival);
+        }
+        break;
+      case OP_NEG:
+        if (a->is_double)
+          a->u.dval = -a->u.dval;
+        else if (pg_sub_s64_overflow(0, a->u.ival, &a->u.ival))
+        {
+          pg_log_error("%s:%d: bigint out of range", client->script->path, cmd->line);
+          return false;
+        }
+        break;
+
+      case OP_EQ:
+      case OP_NE:
+      case OP_LT:
+      case OP_LE:
+      case OP_GT:
+      case OP_GE:
+        {
+          int cmp;
+
+          if (a->is_double || b->is_double)
+          {
+            double u = to_double(a);
+            double v = to_double(b);
+
+            cmp = u < v ? -1 : u > v ? 1 : 0;
+          }
+          else
+            cmp = a->u.ival < b->u.ival ? -1 : a->u.ival > b->u.ival ? 1 : 0;
+
+          SET_INT(a, in->op == OP_EQ ? cmp == 0 :
+                     in->op == OP_NE ? cmp != 0 :
+                     in->op == OP_LT ? cmp < 0 :
+                     in->op == OP_LE ? cmp <= 0 :
+                     in->op == OP_GT ? cmp > 0 : cmp >= 0);
+        }
+        break;
+      case OP_AND:
+        SET_INT(a, to_double(a) != 0 && to_double(b) != 0);
+        break;
+      case OP_OR:
+        SET_INT(a, to_double(a) != 0 || to_double(b) != 0);
+        break;
+      case OP_NOT:
+        SET_INT(a, to_double(a) == 0);
+        break;
+
+      case OP_ABS:
+        if (a->is_double)
+          a->u.dval = fabs(a->u.dval);
+        else if (a->u.ival < 0 && pg_sub_s64_overflow(0, a->u.ival, &a->u.ival))
+        {
+          pg_log_error("%s:%d: bigint out of range", client->script->path, cmd->line);
+          return false;
+        }
+        break;
+      case OP_TO_INT:
+        if (!to_int(a, &x))
+          return false;
+        SET_INT(a, x);
+        break;
+      case OP_TO_DOUBLE:
+        SET_DOUBLE(a, to_double(a));
+        break;
+
+      case OP_RANDOM:
+      case OP_RANDOM_EXPONENTIAL:
+      case OP_RANDOM_ZIPFIAN:
+        {
+          int nargs = in->op == OP_RANDOM ? 2 : 3;
+
+          sp -= nargs - 1;
+          a = &stack[sp - 1];
+          if (!to_int(&a[0], &x) || !to_int(&a[1], &y))
+            return false;
+          if (x > y)
+          {
+            pg_log_error("%s:%d: empty range given to random", client->script->path, cmd->line);
+            return false;
+          }
+
+          if (in->op == OP_RANDOM)
+            SET_INT(a, x + (int64) pg_prng_uint64_range(&client->prng, 0, (uint64) y - (uint64) x));
+          else if (in->op == OP_RANDOM_EXPONENTIAL)
+          {
+            d = to_double(&a[2]);
+            if (d <= 0.0)
+            {
+              pg_log_error("%s:%d: exponential parameter must be greater than zero",
+                           client->script->path, cmd->line);
+              return false;
+            }
+            SET_INT(a, random_exponential(&client->prng, x, y, d));
+          }
+          else
+          {
+            d = to_double(&a[2]);
+            if (d <= 1.0)
+            {
+              pg_log_error("%s:%d: zipfian parameter must be greater than 1",
+                           client->script->path, cmd->line);
+              return false;
+            }
+            SET_INT(a, random_zipfian(&client->prng, x, y, d));
+          }
+        }
+        break;
+    }
+  }
+
+  client->evaluations++;
+  *result = stack[0];
+  return true;
+
+division_by_zero:
+  pg_log_error("%s:%d: division by zero", client->script->path, cmd->line);
+  return false;
+}
+
+/*
+ * random_exponential
+ *
+ * Exponential distribution over [min, max], by inversion of its truncated
+ * cumulative distribution, like pgbench.
+ */
+static int64
+random_exponential(pg_prng_state *state, int64 min, int64 max, double parameter)
+{
+  double cut = exp(-parameter);
+  double uniform = 1.0 - pg_prng_double(state);
+  double rand = -log(cut + (1.0 - cut) * uniform) / parameter;
+
+  return min + (int64) ((max - min + 1) * rand);
+}
+
+/*
+ * random_zipfian
+ *
+ * Zipfian distribution over [min, max] for s > 1, by the rejection method
+ * of Devroye (Non-Uniform Random Variate Generation, p. 550), like pgbench.
+ */
+static int64
+random_zipfian(pg_prng_state *state, int64 min, int64 max, double s)
+{
+  double b = pow(2.0, s - 1.0);
+  double n = (double) (max - min + 1);
+  double x;
+  double t;
+  double u;
+  double v;
+
+  for (;;)
+  {
+    u = 1.0 - pg_prng_double(state);
+    v = pg_prng_double(state);
+    x = floor(pow(u, -1.0 / (s - 1.0)));
+    t = pow(1.0 + 1.0 / x, s - 1.0);
+    if (v * x * (t - 1.0) / (b - 1.0) <= t / b && x <= n)
+      break;
+  }
+
+  return min + (int64) x - 1;
+}
@@ -0,0 +1,47 @@
+/*
+ * script, scripts run by client
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "libpq-fe.h"
+#include "common/pg_prng.h"
+
+/* value of a variable or of an expression */
+typedef struct ScriptValue
+{
+  bool          is_double;
+  union
+  {
+    int64       ival;
+    double      dval;
+  }             u;
+} ScriptValue;
+
+typedef struct Script Script;
+
+/* one client running a script, on its own connection */
+typedef struct ScriptClient
+{
+  const Script *script;
+  PGconn       *conn;
+  int           id;
+  pg_prng_state prng;
+  ScriptValue  *variables;      /* indexed as resolved by script_parse */
+  char        (*param_text)[32];
+  const char  **param_values;
+  int64         transactions;
+  int64         evaluations;
+} ScriptClient;
+
+extern Script *script_parse(const char *path);
+extern ScriptClient *script_client_create(const Script *script, PGconn *conn,
+                                          int id);
+extern bool script_client_prepare(ScriptClient *client);
+extern bool script_run(ScriptClient *client);
+
+#endif                          /* SCRIPT_H */
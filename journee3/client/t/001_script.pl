@@ -0,0 +1,122 @@
+# Scripts of client: \set, \if, \sleep, variables in SQL, errors
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $node = PostgreSQL::Test::Cluster->new('main');
+$node->init;
+$node->start;
+
+$node->safe_psql('postgres',
+	'CREATE TABLE resultats (branche text, n int8, moitie float8, texte text)');
+
+# writes a script in the directory of the node
+sub script
+{
+	my ($name, $content) = @_;
+	my $path = $node->basedir . "/$name.sql";
+
+	append_to_file($path, $content);
+	return $path;
+}
+
+sub run_client
+{
+	my ($path, @args) = @_;
+
+	return [ 'client', '-f', $path, '-T', '1', @args, $node->connstr('postgres') ];
+}
+
+# branches, variables next to casts and in literals, \sleep units
+my $branches = script('branches', <<'SCRIPT');
+\set n 9223372036854775806
+\set n :n + 1
+\set m :n
+\set x 3
+\set zero 0
+\set un 1
+\sleep :zero
+\sleep :un us
+\sleep 2 * :zero ms
+\if :x = 1
+INSERT INTO resultats VALUES ('if', :n, :x::float8 / 2, :m::text);
+\elif :x = 3
+INSERT INTO resultats VALUES ('elif', :n, :x::float8 / 2, :m::text || '::');
+\else
+INSERT INTO resultats VALUES ('else', :n, :x::float8 / 2, :m::text);
+\endif
+\if :x > 5
+INSERT INTO resultats VALUES ('if', :client_id, 0, NULL);
+\elif :x < 0
+INSERT INTO resultats VALUES ('elif', :client_id, 0, NULL);
+\else
+INSERT INTO resultats VALUES ('else', :client_id, :x / 2, ':x');
+\endif
+SCRIPT
+
+$node->command_checks_all(
+	run_client($branches, '-c', '2'),
+	0,
+	[ qr/clients: 2 \(0 failed\)/, qr/expressions per second: \d+/ ],
+	[qr/^$/],
+	'script with branches');
+
+is( $node->safe_psql(
+		'postgres',
+		'SELECT DISTINCT branche, n, moitie, texte FROM resultats ORDER BY 1, 2'),
+	"elif|9223372036854775807|1.5|9223372036854775807::\n"
+	  . "else|0|1|:x\n"
+	  . "else|1|1|:x",
+	'branches taken and parameters bound');
+
+# errors while running make the client fail
+$node->command_checks_all(
+	run_client(script('addition', "\\set n 9223372036854775807\n\\set n :n + 1\n")),
+	2,
+	[qr/clients: 1 \(1 failed\)/],
+	[qr/bigint out of range/],
+	'integer overflow of an addition');
+
+$node->command_checks_all(
+	run_client(script('negation', "\\set n -9223372036854775807 - 1\n\\set n -:n\n")),
+	2,
+	[qr/clients: 1 \(1 failed\)/],
+	[qr/bigint out of range/],
+	'integer overflow of a negation');
+
+$node->command_checks_all(
+	run_client(script('conversion', "\\set n int(1e300)\n")),
+	2,
+	[qr/clients: 1 \(1 failed\)/],
+	[qr/out of range for an integer/],
+	'double out of range for an integer');
+
+# errors while parsing stop before connecting
+$node->command_checks_all(
+	run_client(script('litteral', "\\set n 9223372036854775808\n")),
+	1,
+	[qr/^$/],
+	[qr/integer out of range/],
+	'integer literal out of range');
+
+$node->command_checks_all(
+	run_client(script('unite', "\\set d 1\n\\sleep :d min\n")),
+	1,
+	[qr/^$/],
+	[qr/unknown time unit "min"/],
+	'unknown time unit');
+
+$node->command_checks_all(
+	run_client(script('sinon', "\\else\n")),
+	1,
+	[qr/^$/],
+	[qr/\\else without \\if/],
+	'\else without \if');
+
+$node->stop;
+
+done_testing();
@@ -10,6 +10,7 @@
 // #include
 #include "libpq-fe.h"
 #include <signal.h>
+#include <time.h>
 #include "postgres_fe.h"
 #include "common/logging.h"
 #include "fe_utils/connect_utils.h"
@@ -17,9 +18,17 @@
 #include "fe_utils/string_utils.h"
 #include "getopt_long.h"
 
+#include "rollup.h"
+
 static volatile int keepRunning = 1;
 
 static void help(const char *progname);
+static bool slot_exists(PGconn *conn, const char *slot, bool echo);
+static char *read_flush_lsn(PGconn *conn, bool echo);
+static void advance_slot(PGconn *conn, const char *slot, const char *lsn,
+                         bool echo);
+static void report_retained_wal(PGconn *conn, const char *slot, bool echo);
+static char *prepare_rollup(PGconn *conn, const char *table, bool echo);
 void intHandler(int dummy);
 
 void intHandler(int dummy)
@@ -42,6 +51,12 @@ main(int argc, char **argv)
     {"port", required_argument, NULL, 'p'},
     {"username", required_argument, NULL, 'U'},
     {"echo", no_argument, NULL, 'e'},
+    {"two-phase", no_argument, NULL, 't'},
+    {"columns", required_argument, NULL, 'c'},
+    {"sample-rate", required_argument, NULL, 's'},
+    {"wal-report-interval", required_argument, NULL, 'W'},
+    {"rollup", required_argument, NULL, 'r'},
+    {"slot", required_argument, NULL, 'S'},
     {NULL, 0, NULL, 0}
   };
   int           optindex;
@@ -51,7 +66,19 @@ main(int argc, char **argv)
   char         *port = NULL;
   char         *username = NULL;
   char         *table = NULL;
+  char         *columns = NULL;
+  char         *sample_rate = NULL;
+  char         *slot = NULL;
+  bool          keep_slot = false;
+  PQExpBufferData options;
+  int           wal_report = 0;
+  time_t        last_wal_report = 0;
   bool          echo = false;
+  bool          two_phase = false;
+  Rollup       *rollups = NULL;
+  char         *rollup_relation = NULL;
+  size_t        rollup_len = 0;
+  char         *upto = NULL;
 
   pg_logging_init(argv[0]);
   progname = get_progname(argv[0]);
@@ -60,10 +87,13 @@ main(int argc, char **argv)
 
   // Get options
 
-  while ((c = getopt_long(argc, argv, "d:eh:p:U:", long_options, &optindex)) != -1)
+  while ((c = getopt_long(argc, argv, "c:d:eh:p:r:s:S:tU:W:", long_options, &optindex)) != -1)
   {
     switch (c)
     {
+      case 'c':
+        columns = pg_strdup(optarg);
+        break;
       case 'd':
         dbname = pg_strdup(optarg);
         break;
@@ -76,9 +106,26 @@ main(int argc, char **argv)
       case 'p':
         port = pg_strdup(optarg);
         break;
+      case 'r':
+        rollups = rollup_parse(optarg, rollups);
+        break;
+      case 's':
+        sample_rate = pg_strdup(optarg);
+        break;
+      case 'S':
+        slot = pg_strdup(optarg);
+        keep_slot = true;
+        break;
+      case 't':
+        two_phase = true;
+        break;
       case 'U':
         username = pg_strdup(optarg);
         break;
+      case 'W':
+        if (!option_parse_int(optarg, "-W/--wal-report-interval", 0, INT_MAX, &wal_report))
+          exit(1);
+        break;
       case 0:
         /* this covers the long options */
         break;
@@ -108,6 +155,27 @@ main(int argc, char **argv)
       exit(1);
   }
 
+  // A rollup reads whole rows of every change, all of them
+
+  if (rollups && (columns || sample_rate || two_phase))
+  {
+    pg_log_error("option -r/--rollup cannot be used with -c, -s or -t");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+  if (rollups)
+    columns = "full";
+
+  // The deltas of a rollup are only forgotten by the slot once committed to
+  // the targets: the slot must outlive audit
+
+  if (rollups && !slot)
+  {
+    pg_log_error("option -r/--rollup needs a slot given with -S");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
   // Connect to the database
 
   cparams.dbname = dbname;
@@ -121,36 +189,97 @@ main(int argc, char **argv)
 
   pqsignal(SIGINT, intHandler);
 
+  if (rollups)
+  {
+    rollup_relation = prepare_rollup(conn, table, echo);
+    rollup_len = strlen(rollup_relation);
+  }
+
   // Main Stuff
 
   pg_log_info("Auditing table \"%s\"...", table);
 
-  // Create logical slot
-  initPQExpBuffer(&sql);
-  appendPQExpBuffer(&sql,
-    "SELECT * FROM "
-    "pg_create_logical_replication_slot('audit_%d', 'plugin_audit', false, true);",
-    PQbackendPID(conn));
-  if (echo)
-    printf("%s\n", sql.data);
-  result = PQexec(conn, sql.data);
-  if (PQresultStatus(result) != PGRES_TUPLES_OK)
+  // Create logical slot, unless a slot given with -S already exists. Our
+  // own slot is temporary, dropped even if audit is killed
+  if (!slot)
+    slot = psprintf("audit_%d", PQbackendPID(conn));
+  if (!keep_slot || !slot_exists(conn, slot, echo))
   {
-    pg_log_error("create slot failed: %s", PQerrorMessage(conn));
-    PQfinish(conn);
-    exit(1);
+    initPQExpBuffer(&sql);
+    appendPQExpBufferStr(&sql,
+      "SELECT * FROM "
+      "pg_create_logical_replication_slot(");
+    appendStringLiteralConn(&sql, slot, conn);
+    appendPQExpBuffer(&sql, ", 'plugin_audit', %s, %s);",
+      keep_slot ? "false" : "true", two_phase ? "true" : "false");
+    if (echo)
+      printf("%s\n", sql.data);
+    result = PQexec(conn, sql.data);
+    if (PQresultStatus(result) != PGRES_TUPLES_OK)
+    {
+      pg_log_error("create slot failed: %s", PQerrorMessage(conn));
+      PQfinish(conn);
+      exit(1);
+    }
+    PQclear(result);
+    termPQExpBuffer(&sql);
+  }
+
+  // A flush committed to the targets before audit stopped, but not yet
+  // confirmed to the slot, is not read again
+
+  if (rollups)
+  {
+    char *flushed = rollup_flushed_lsn(conn, rollups, echo);
+
+    if (flushed)
+      advance_slot(conn, slot, flushed, echo);
+    pg_free(flushed);
   }
-  PQclear(result);
-  termPQExpBuffer(&sql);
 
   // Loop for new changes
+  initPQExpBuffer(&options);
+  if (columns)
+  {
+    appendPQExpBufferStr(&options, ", 'columns', ");
+    appendStringLiteralConn(&options, columns, conn);
+  }
+  if (sample_rate)
+  {
+    PQExpBufferData value;
+
+    // Only the audited table is sampled
+    initPQExpBuffer(&value);
+    appendPQExpBuffer(&value, "%s=%s", table, sample_rate);
+    appendPQExpBufferStr(&options, ", 'sample_rate', ");
+    appendStringLiteralConn(&options, value.data, conn);
+    termPQExpBuffer(&value);
+  }
   initPQExpBuffer(&sql);
-  appendPQExpBuffer(&sql,
-    "SELECT * FROM "
-    "pg_logical_slot_get_changes('audit_%d', NULL, NULL);",
-    PQbackendPID(conn));
   while (keepRunning)
   {
+    // Getting the changes confirms the slot at once up to the end of the
+    // WAL read, whether the table changed or not: the WAL retained only
+    // grows with the changes waiting to be read. A rollup peeks at the
+    // changes up to the WAL flushed, and only moves the slot there once
+    // their deltas are committed: changes whose deltas are lost when audit
+    // stops are read again
+
+    resetPQExpBuffer(&sql);
+    if (rollups)
+    {
+      upto = read_flush_lsn(conn, echo);
+      appendPQExpBufferStr(&sql, "SELECT * FROM pg_logical_slot_peek_changes(");
+      appendStringLiteralConn(&sql, slot, conn);
+      appendPQExpBuffer(&sql, ", '%s', NULL", upto);
+    }
+    else
+    {
+      appendPQExpBufferStr(&sql, "SELECT * FROM pg_logical_slot_get_changes(");
+      appendStringLiteralConn(&sql, slot, conn);
+      appendPQExpBufferStr(&sql, ", NULL, NULL");
+    }
+    appendPQExpBuffer(&sql, "%s);", options.data);
     if (echo)
       printf("%s\n", sql.data);
     result = PQexec(conn, sql.data);
@@ -162,39 +291,269 @@ main(int argc, char **argv)
     }
     for (int ligne = 0 ; ligne < PQntuples(result) ; ligne++)
     {
-      if (strstr(PQgetvalue(result, ligne, 2), table))
+      const char *change = PQgetvalue(result, ligne, 2);
+
+      // The end of a prepared transaction and its outcome are always
+      // printed, even when sampling dropped all of its changes: their GID
+      // ties the audited changes to the final COMMIT or ROLLBACK PREPARED
+
+      if (strncmp(change, "PREPARE TRANSACTION ", 20) == 0 ||
+          strncmp(change, "COMMIT PREPARED ", 16) == 0 ||
+          strncmp(change, "ROLLBACK PREPARED ", 18) == 0 ||
+          strncmp(change, "SKIPPED ", 8) == 0)
+      {
+        printf("%s\n", change);
+      }
+      else if (rollups)
       {
-        printf("%s\n", PQgetvalue(result, ligne, 2));
+        // Only the changes of the table itself, its name then a space
+
+        if (strncmp(change, rollup_relation, rollup_len) == 0 &&
+            change[rollup_len] == ' ')
+          rollup_apply(rollups, change);
+      }
+      else if (strstr(change, table))
+      {
+        printf("%s\n", change);
       }
     }
     PQclear(result);
+
+    // Deltas first, then the slot
+
+    if (rollups)
+    {
+      rollup_flush(conn, rollups, upto, echo);
+      advance_slot(conn, slot, upto, echo);
+      pg_free(upto);
+      upto = NULL;
+    }
+
+    if (wal_report > 0 && time(NULL) - last_wal_report >= wal_report)
+    {
+      report_retained_wal(conn, slot, echo);
+      last_wal_report = time(NULL);
+    }
+
     sleep(1);
   }
   termPQExpBuffer(&sql);
+  termPQExpBuffer(&options);
+
+  // Drop logical slot, unless given with -S
+  if (!keep_slot)
+  {
+    initPQExpBuffer(&sql);
+    appendPQExpBufferStr(&sql,
+      "SELECT * FROM "
+      "pg_drop_replication_slot(");
+    appendStringLiteralConn(&sql, slot, conn);
+    appendPQExpBufferStr(&sql, ");");
+    if (echo)
+      printf("%s\n", sql.data);
+    result = PQexec(conn, sql.data);
+    if (PQresultStatus(result) != PGRES_TUPLES_OK)
+    {
+      pg_log_error("drop slot failed: %s", PQerrorMessage(conn));
+      PQfinish(conn);
+      exit(1);
+    }
+    PQclear(result);
+    termPQExpBuffer(&sql);
+  }
+
+  // Disconnect
+
+  PQfinish(conn);
+
+  exit(0);
+}
+
+/*
+ * slot_exists
+ *
+ * Returns whether the slot exists, checking that it decodes with
+ * plugin_audit.
+ */
+static bool
+slot_exists(PGconn *conn, const char *slot, bool echo)
+{
+  PQExpBufferData sql;
+  PGresult   *result;
+  bool        exists;
+
+  initPQExpBuffer(&sql);
+  appendPQExpBufferStr(&sql,
+    "SELECT plugin FROM pg_replication_slots "
+    "WHERE slot_name = ");
+  appendStringLiteralConn(&sql, slot, conn);
+  appendPQExpBufferStr(&sql, ";");
+  if (echo)
+    printf("%s\n", sql.data);
+  result = PQexec(conn, sql.data);
+  if (PQresultStatus(result) != PGRES_TUPLES_OK)
+  {
+    pg_log_error("read slot failed: %s", PQerrorMessage(conn));
+    PQfinish(conn);
+    exit(1);
+  }
+  exists = PQntuples(result) == 1;
+  if (exists && strcmp(PQgetvalue(result, 0, 0), "plugin_audit") != 0)
+  {
+    pg_log_error("slot \"%s\" does not use plugin_audit", slot);
+    PQfinish(conn);
+    exit(1);
+  }
+  PQclear(result);
+  termPQExpBuffer(&sql);
+
+  return exists;
+}
+
+/*
+ * read_flush_lsn
+ *
+ * Returns the end of the WAL flushed, up to which the changes are read.
+ */
+static char *
+read_flush_lsn(PGconn *conn, bool echo)
+{
+  PGresult   *result;
+  char       *lsn;
+
+  if (echo)
+    printf("SELECT pg_current_wal_flush_lsn();\n");
+  result = PQexec(conn, "SELECT pg_current_wal_flush_lsn();");
+  if (PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) != 1)
+  {
+    pg_log_error("read WAL position failed: %s", PQerrorMessage(conn));
+    PQfinish(conn);
+    exit(1);
+  }
+  lsn = pg_strdup(PQgetvalue(result, 0, 0));
+  PQclear(result);
+
+  return lsn;
+}
+
+/*
+ * advance_slot
+ *
+ * Confirms the slot up to lsn, if it is not there yet.
+ */
+static void
+advance_slot(PGconn *conn, const char *slot, const char *lsn, bool echo)
+{
+  PQExpBufferData sql;
+  PGresult   *result;
 
-  // Drop logical slot
   initPQExpBuffer(&sql);
   appendPQExpBuffer(&sql,
-    "SELECT * FROM "
-    "pg_drop_replication_slot('audit_%d');",
-    PQbackendPID(conn));
+    "SELECT pg_replication_slot_advance(slot_name, '%s') "
+    "FROM pg_replication_slots "
+    "WHERE confirmed_flush_lsn < '%s' AND slot_name = ",
+    lsn, lsn);
+  appendStringLiteralConn(&sql, slot, conn);
+  appendPQExpBufferStr(&sql, ";");
   if (echo)
     printf("%s\n", sql.data);
   result = PQexec(conn, sql.data);
   if (PQresultStatus(result) != PGRES_TUPLES_OK)
   {
-    pg_log_error("drop slot failed: %s", PQerrorMessage(conn));
+    pg_log_error("advance slot failed: %s", PQerrorMessage(conn));
     PQfinish(conn);
     exit(1);
   }
   PQclear(result);
   termPQExpBuffer(&sql);
+}
 
-  // Disconnect
+/*
+ * report_retained_wal
+ *
+ * Reports the WAL that the slot retains.
+ */
+static void
+report_retained_wal(PGconn *conn, const char *slot, bool echo)
+{
+  PQExpBufferData sql;
+  PGresult   *result;
 
-  PQfinish(conn);
+  initPQExpBuffer(&sql);
+  appendPQExpBufferStr(&sql,
+    "SELECT pg_size_pretty(pg_wal_lsn_diff(pg_current_wal_lsn(), restart_lsn)) "
+    "FROM pg_replication_slots "
+    "WHERE slot_name = ");
+  appendStringLiteralConn(&sql, slot, conn);
+  appendPQExpBufferStr(&sql, ";");
+  if (echo)
+    printf("%s\n", sql.data);
+  result = PQexec(conn, sql.data);
+  if (PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) != 1)
+  {
+    pg_log_error("read slot failed: %s", PQerrorMessage(conn));
+    PQfinish(conn);
+    exit(1);
+  }
+  pg_log_info("slot \"%s\" retains %s of WAL",
+              slot, PQgetvalue(result, 0, 0));
+  PQclear(result);
+  termPQExpBuffer(&sql);
+}
 
-  exit(0);
+/*
+ * prepare_rollup
+ *
+ * Checks that the changes of the table carry their old row, sets the
+ * DateStyle that day() reads, and returns the name of the table as printed
+ * by plugin_audit.
+ */
+static char *
+prepare_rollup(PGconn *conn, const char *table, bool echo)
+{
+  PQExpBufferData sql;
+  PGresult   *result;
+  char       *relation;
+
+  initPQExpBuffer(&sql);
+  appendPQExpBufferStr(&sql,
+    "SELECT quote_ident(n.nspname) || '.' || quote_ident(c.relname), c.relreplident "
+    "FROM pg_class c JOIN pg_namespace n ON n.oid = c.relnamespace "
+    "WHERE c.oid = ");
+  appendStringLiteralConn(&sql, table, conn);
+  appendPQExpBufferStr(&sql, "::regclass;");
+  if (echo)
+    printf("%s\n", sql.data);
+  result = PQexec(conn, sql.data);
+  if (PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) != 1)
+  {
+    pg_log_error("read table failed: %s", PQerrorMessage(conn));
+    PQfinish(conn);
+    exit(1);
+  }
+  if (strcmp(PQgetvalue(result, 0, 1), "f") != 0)
+  {
+    pg_log_error("a rollup needs the old rows of the table \"%s\"", table);
+    pg_log_error_hint("Run ALTER TABLE %s REPLICA IDENTITY FULL.", PQgetvalue(result, 0, 0));
+    PQfinish(conn);
+    exit(1);
+  }
+  relation = pg_strdup(PQgetvalue(result, 0, 0));
+  PQclear(result);
+  termPQExpBuffer(&sql);
+
+  if (echo)
+    printf("SET DateStyle = ISO;\n");
+  result = PQexec(conn, "SET DateStyle = ISO;");
+  if (PQresultStatus(result) != PGRES_COMMAND_OK)
+  {
+    pg_log_error("set DateStyle failed: %s", PQerrorMessage(conn));
+    PQfinish(conn);
+    exit(1);
+  }
+  PQclear(result);
+
+  return relation;
 }
 
 static void
@@ -204,7 +563,21 @@ help(const char *progname)
 	printf("Usage:\n");
 	printf("  %s TABLE [OPTION]...\n", progname);
 	printf("\nOptions:\n");
+	printf("  -c, --columns=MODE        columns of the changes: none, all, changed (key\n");
+	printf("                            and changed columns of UPDATE), or full (old\n");
+	printf("                            row of UPDATE too)\n");
 	printf("  -e, --echo                show the commands being sent to the server\n");
+	printf("  -r, --rollup=TARGET:GROUPS:AGGREGATES\n");
+	printf("                            maintain count and sum(column) by GROUPS in\n");
+	printf("                            TARGET instead of printing the changes, day(column)\n");
+	printf("                            grouping by date (can be repeated), needs -S\n");
+	printf("  -s, --sample-rate=RATE    keep this fraction of the rows, by their key\n");
+	printf("  -S, --slot=SLOTNAME       use this slot, created if it does not exist,\n");
+	printf("                            and keep it at exit\n");
+	printf("  -t, --two-phase           audit prepared transactions at PREPARE TRANSACTION\n");
+	printf("  -W, --wal-report-interval=SECS\n");
+	printf("                            seconds between reports of the WAL retained by the\n");
+	printf("                            slot (default: 0, disabled)\n");
 	printf("  -V, --version             output version information, then exit\n");
 	printf("  -?, --help                show this help, then exit\n");
 	printf("\nConnection options:\n");
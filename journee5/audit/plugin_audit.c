@@ -1,22 +1,55 @@
 #include "postgres.h"
 
+#include "access/detoast.h"
+#include "access/sysattr.h"
 #include "catalog/pg_type.h"
+#include "common/hashfn.h"
 
 #include "replication/logical.h"
 #include "replication/origin.h"
 
 #include "utils/builtins.h"
+#include "utils/datum.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/relcache.h"
+
+#include "plugin_audit_probes.h"
 
 PG_MODULE_MAGIC;
 
+/* columns printed after the action, set by the "columns" option */
+typedef enum
+{
+	AUDIT_COLUMNS_NONE,
+	AUDIT_COLUMNS_ALL,
+	AUDIT_COLUMNS_CHANGED,
+	AUDIT_COLUMNS_FULL
+} AuditColumns;
+
+/* a table of the "sample_rate" option */
+typedef struct
+{
+	char	   *table;			/* name, qualified or not */
+	double		rate;
+} AuditSampleRate;
+
 typedef struct
 {
 	MemoryContext context;
+	AuditColumns columns;
+	List	   *sample_rates;	/* list of AuditSampleRate */
 } AuditDecodingData;
 
+/* columns of a tuple given to print_columns */
+typedef enum
+{
+	PRINT_ALL,
+	PRINT_KEY,
+	PRINT_KEY_AND_CHANGED
+} PrintColumns;
+
 /*
  * Maintain the per-transaction level variables to track whether the
  * transaction and or streams have written any changes. In streaming mode the
@@ -30,6 +63,7 @@ typedef struct
 {
 	bool		xact_wrote_changes;
 	bool		stream_wrote_changes;
+	uint64		skipped;		/* changes left out by sampling */
 } AuditDecodingTxnData;
 
 static void pg_decode_startup(LogicalDecodingContext *ctx,
@@ -43,6 +77,38 @@ static void pg_decode_commit_txn(LogicalDecodingContext *ctx,
 static void pg_decode_change(LogicalDecodingContext *ctx,
 							 ReorderBufferTXN *txn, Relation relation,
 							 ReorderBufferChange *change);
+static void pg_decode_truncate(LogicalDecodingContext *ctx,
+							   ReorderBufferTXN *txn, int nrelations,
+							   Relation relations[],
+							   ReorderBufferChange *change);
+static bool pg_decode_filter_prepare(LogicalDecodingContext *ctx,
+									 TransactionId xid,
+									 const char *gid);
+static void pg_decode_begin_prepare_txn(LogicalDecodingContext *ctx,
+										ReorderBufferTXN *txn);
+static void pg_decode_prepare_txn(LogicalDecodingContext *ctx,
+								  ReorderBufferTXN *txn,
+								  XLogRecPtr prepare_lsn);
+static void pg_decode_commit_prepared_txn(LogicalDecodingContext *ctx,
+										  ReorderBufferTXN *txn,
+										  XLogRecPtr commit_lsn);
+static void pg_decode_rollback_prepared_txn(LogicalDecodingContext *ctx,
+											ReorderBufferTXN *txn,
+											XLogRecPtr prepare_end_lsn,
+											TimestampTz prepare_time);
+static void pg_output_gid(LogicalDecodingContext *ctx, const char *command,
+						  ReorderBufferTXN *txn);
+static void parse_sample_rates(AuditDecodingData *data, char *value);
+static double table_sample_rate(AuditDecodingData *data, Relation relation);
+static bool sample_change(Relation relation, ReorderBufferChange *change,
+						  double rate);
+static void pg_output_skipped(LogicalDecodingContext *ctx,
+							  ReorderBufferTXN *txn);
+static void print_columns(StringInfo s, Relation relation, HeapTuple tuple,
+						  HeapTuple oldtuple, PrintColumns which);
+static bool column_changed(Form_pg_attribute attr, Datum value, bool isnull,
+						   HeapTuple oldtuple, TupleDesc tupdesc);
+static bool varlena_equal(struct varlena *value, struct varlena *oldvalue);
 
 void
 _PG_init(void)
@@ -57,8 +123,14 @@ _PG_output_plugin_init(OutputPluginCallbacks *cb)
 	cb->startup_cb = pg_decode_startup;
 	cb->begin_cb = pg_decode_begin_txn;
 	cb->change_cb = pg_decode_change;
+	cb->truncate_cb = pg_decode_truncate;
 	cb->commit_cb = pg_decode_commit_txn;
 	cb->shutdown_cb = pg_decode_shutdown;
+	cb->filter_prepare_cb = pg_decode_filter_prepare;
+	cb->begin_prepare_cb = pg_decode_begin_prepare_txn;
+	cb->prepare_cb = pg_decode_prepare_txn;
+	cb->commit_prepared_cb = pg_decode_commit_prepared_txn;
+	cb->rollback_prepared_cb = pg_decode_rollback_prepared_txn;
 }
 
 
@@ -68,6 +140,7 @@ pg_decode_startup(LogicalDecodingContext *ctx, OutputPluginOptions *opt,
 				  bool is_init)
 {
 	AuditDecodingData *data;
+	ListCell   *option;
 
 	data = palloc0(sizeof(AuditDecodingData));
 	data->context = AllocSetContextCreate(ctx->context,
@@ -78,7 +151,53 @@ pg_decode_startup(LogicalDecodingContext *ctx, OutputPluginOptions *opt,
 	opt->output_type = OUTPUT_PLUGIN_TEXTUAL_OUTPUT;
 	opt->receive_rewrites = false;
 
-  /* we don't have any options yet, but that would be the place to do it */
+	data->columns = AUDIT_COLUMNS_NONE;
+
+	foreach(option, ctx->output_plugin_options)
+	{
+		DefElem    *elem = lfirst(option);
+
+		Assert(elem->arg == NULL || IsA(elem->arg, String));
+
+		if (strcmp(elem->defname, "columns") == 0)
+		{
+			char	   *value = elem->arg ? strVal(elem->arg) : "";
+
+			/*
+			 * none: action only, all: whole rows, changed: key and changed
+			 * columns of UPDATE, full: whole rows, and the old row of UPDATE
+			 */
+			if (strcmp(value, "none") == 0)
+				data->columns = AUDIT_COLUMNS_NONE;
+			else if (strcmp(value, "all") == 0)
+				data->columns = AUDIT_COLUMNS_ALL;
+			else if (strcmp(value, "changed") == 0)
+				data->columns = AUDIT_COLUMNS_CHANGED;
+			else if (strcmp(value, "full") == 0)
+				data->columns = AUDIT_COLUMNS_FULL;
+			else
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("could not parse value \"%s\" for parameter \"%s\"",
+								value, elem->defname)));
+		}
+		else if (strcmp(elem->defname, "sample_rate") == 0)
+		{
+			if (elem->arg == NULL)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("parameter \"%s\" needs a value", elem->defname)));
+			parse_sample_rates(data, pstrdup(strVal(elem->arg)));
+		}
+		else
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("option \"%s\" = \"%s\" is unknown",
+							elem->defname,
+							elem->arg ? strVal(elem->arg) : "(null)")));
+		}
+	}
 }
 
 /* cleanup this plugin's resources */
@@ -91,10 +210,51 @@ pg_decode_shutdown(LogicalDecodingContext *ctx)
 	MemoryContextDelete(data->context);
 }
 
+/*
+ * parse_sample_rates
+ *
+ * Reads the value of the "sample_rate" option, a list of table=rate
+ * separated by commas, where rate is the kept fraction of the changes.
+ */
+static void
+parse_sample_rates(AuditDecodingData *data, char *value)
+{
+	char	   *saveptr;
+
+	for (char *item = strtok_r(value, ",", &saveptr); item != NULL;
+		 item = strtok_r(NULL, ",", &saveptr))
+	{
+		AuditSampleRate *sample;
+		char	   *equal = strrchr(item, '=');
+		char	   *end = NULL;
+
+		sample = palloc(sizeof(AuditSampleRate));
+		if (equal != NULL)
+		{
+			*equal = '\0';
+			sample->table = item;
+			sample->rate = strtod(equal + 1, &end);
+		}
+		if (equal == NULL || item[0] == '\0' || end == equal + 1 || *end != '\0' ||
+			sample->rate < 0.0 || sample->rate > 1.0)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("could not parse value \"%s\" for parameter \"%s\"",
+							item, "sample_rate"),
+					 errhint("Use a list of table=rate, with a rate between 0 and 1.")));
+
+		data->sample_rates = lappend(data->sample_rates, sample);
+	}
+}
+
 /* BEGIN callback */
 static void
 pg_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 {
+	PLUGIN_AUDIT_PROBE1(begin, txn->xid);
+
+	txn->output_plugin_private = MemoryContextAllocZero(ctx->context,
+														sizeof(AuditDecodingTxnData));
 }
 
 /* COMMIT callback */
@@ -102,6 +262,101 @@ static void
 pg_decode_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 					 XLogRecPtr commit_lsn)
 {
+	PLUGIN_AUDIT_PROBE2(commit, txn->xid, commit_lsn);
+
+	pg_output_skipped(ctx, txn);
+}
+
+/*
+ * With a slot created with two_phase, a prepared transaction is decoded at
+ * PREPARE TRANSACTION, between a BEGIN PREPARE and a PREPARE TRANSACTION
+ * line, and its outcome is a COMMIT PREPARED or ROLLBACK PREPARED line. The
+ * lines carry the GID, which ties them together.
+ */
+
+/* decode every prepared transaction at PREPARE TRANSACTION */
+static bool
+pg_decode_filter_prepare(LogicalDecodingContext *ctx, TransactionId xid,
+						 const char *gid)
+{
+	return false;
+}
+
+/* BEGIN PREPARE callback */
+static void
+pg_decode_begin_prepare_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
+{
+	PLUGIN_AUDIT_PROBE1(begin, txn->xid);
+
+	txn->output_plugin_private = MemoryContextAllocZero(ctx->context,
+														sizeof(AuditDecodingTxnData));
+
+	pg_output_gid(ctx, "BEGIN PREPARE", txn);
+}
+
+/* PREPARE callback */
+static void
+pg_decode_prepare_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+					  XLogRecPtr prepare_lsn)
+{
+	PLUGIN_AUDIT_PROBE2(prepare, txn->xid, prepare_lsn);
+
+	pg_output_skipped(ctx, txn);
+	pg_output_gid(ctx, "PREPARE TRANSACTION", txn);
+}
+
+/* COMMIT PREPARED callback */
+static void
+pg_decode_commit_prepared_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+							  XLogRecPtr commit_lsn)
+{
+	PLUGIN_AUDIT_PROBE2(commit, txn->xid, commit_lsn);
+
+	pg_output_gid(ctx, "COMMIT PREPARED", txn);
+}
+
+/* ROLLBACK PREPARED callback */
+static void
+pg_decode_rollback_prepared_txn(LogicalDecodingContext *ctx,
+								ReorderBufferTXN *txn,
+								XLogRecPtr prepare_end_lsn,
+								TimestampTz prepare_time)
+{
+	pg_output_gid(ctx, "ROLLBACK PREPARED", txn);
+}
+
+/*
+ * pg_output_skipped
+ *
+ * Ends a decoded transaction: writes the number of changes left out by
+ * sampling, if any, and frees the data of the transaction.
+ */
+static void
+pg_output_skipped(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
+{
+	AuditDecodingTxnData *txndata = txn->output_plugin_private;
+
+	if (txndata == NULL)
+		return;
+
+	if (txndata->skipped > 0)
+	{
+		OutputPluginPrepareWrite(ctx, true);
+		appendStringInfo(ctx->out, "SKIPPED " UINT64_FORMAT, txndata->skipped);
+		OutputPluginWrite(ctx, true);
+	}
+
+	pfree(txndata);
+	txn->output_plugin_private = NULL;
+}
+
+static void
+pg_output_gid(LogicalDecodingContext *ctx, const char *command,
+			  ReorderBufferTXN *txn)
+{
+	OutputPluginPrepareWrite(ctx, true);
+	appendStringInfo(ctx->out, "%s %s", command, quote_literal_cstr(txn->gid));
+	OutputPluginWrite(ctx, true);
 }
 
 /*
@@ -115,10 +370,29 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	MemoryContext old;
 	Form_pg_class class_form;
 
+	PLUGIN_AUDIT_PROBE2(change__start, RelationGetRelid(relation), change->action);
+
 	data = ctx->output_plugin_private;
 
 	old = MemoryContextSwitchTo(data->context);
 
+	if (data->sample_rates != NIL)
+	{
+		double		rate = table_sample_rate(data, relation);
+
+		if (rate < 1.0 && !sample_change(relation, change, rate))
+		{
+			AuditDecodingTxnData *txndata = txn->output_plugin_private;
+
+			if (txndata != NULL)
+				txndata->skipped++;
+
+			MemoryContextSwitchTo(old);
+			MemoryContextReset(data->context);
+			return;
+		}
+	}
+
 	OutputPluginPrepareWrite(ctx, true);
 
 	class_form = RelationGetForm(relation);
@@ -132,12 +406,36 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	{
 		case REORDER_BUFFER_CHANGE_INSERT:
 			appendStringInfoString(ctx->out, " INSERT");
+			if (data->columns != AUDIT_COLUMNS_NONE && change->data.tp.newtuple)
+				print_columns(ctx->out, relation,
+							  &change->data.tp.newtuple->tuple, NULL,
+							  PRINT_ALL);
 			break;
 		case REORDER_BUFFER_CHANGE_UPDATE:
 			appendStringInfoString(ctx->out, " UPDATE");
+			if (data->columns != AUDIT_COLUMNS_NONE && change->data.tp.newtuple)
+				print_columns(ctx->out, relation,
+							  &change->data.tp.newtuple->tuple,
+							  change->data.tp.oldtuple ?
+							  &change->data.tp.oldtuple->tuple : NULL,
+							  data->columns == AUDIT_COLUMNS_CHANGED ?
+							  PRINT_KEY_AND_CHANGED : PRINT_ALL);
+			/* the old row is only logged with REPLICA IDENTITY FULL */
+			if (data->columns == AUDIT_COLUMNS_FULL && change->data.tp.oldtuple)
+			{
+				appendStringInfoString(ctx->out, " OLD");
+				print_columns(ctx->out, relation,
+							  &change->data.tp.oldtuple->tuple, NULL,
+							  PRINT_ALL);
+			}
 			break;
 		case REORDER_BUFFER_CHANGE_DELETE:
 			appendStringInfoString(ctx->out, " DELETE");
+			/* the old tuple only holds the replica identity */
+			if (data->columns != AUDIT_COLUMNS_NONE && change->data.tp.oldtuple)
+				print_columns(ctx->out, relation,
+							  &change->data.tp.oldtuple->tuple, NULL,
+							  PRINT_KEY);
 			break;
 		default:
 			Assert(false);
@@ -146,6 +444,261 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	MemoryContextSwitchTo(old);
 	MemoryContextReset(data->context);
 
+	PLUGIN_AUDIT_PROBE3(change__done, RelationGetRelid(relation), change->action,
+						ctx->out->len);
+
 	OutputPluginWrite(ctx, true);
 }
 
+/*
+ * callback for TRUNCATE, one line per table truncated, never sampled
+ */
+static void
+pg_decode_truncate(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+				   int nrelations, Relation relations[],
+				   ReorderBufferChange *change)
+{
+	AuditDecodingData *data = ctx->output_plugin_private;
+	MemoryContext old;
+
+	old = MemoryContextSwitchTo(data->context);
+
+	for (int i = 0; i < nrelations; i++)
+	{
+		OutputPluginPrepareWrite(ctx, true);
+		appendStringInfo(ctx->out, "%s TRUNCATE",
+			quote_qualified_identifier(get_namespace_name(RelationGetNamespace(relations[i])),
+									   RelationGetRelationName(relations[i])));
+		OutputPluginWrite(ctx, true);
+	}
+
+	MemoryContextSwitchTo(old);
+	MemoryContextReset(data->context);
+}
+
+/*
+ * table_sample_rate
+ *
+ * Returns the rate of the table in the "sample_rate" option, named with
+ * its schema or not, 1 when absent.
+ */
+static double
+table_sample_rate(AuditDecodingData *data, Relation relation)
+{
+	const char *relname = RelationGetRelationName(relation);
+	char	   *nspname = get_namespace_name(RelationGetNamespace(relation));
+	size_t		nsplen = strlen(nspname);
+	ListCell   *lc;
+
+	foreach(lc, data->sample_rates)
+	{
+		AuditSampleRate *sample = lfirst(lc);
+
+		if (strcmp(sample->table, relname) == 0 ||
+			(strncmp(sample->table, nspname, nsplen) == 0 &&
+			 sample->table[nsplen] == '.' &&
+			 strcmp(sample->table + nsplen + 1, relname) == 0))
+			return sample->rate;
+	}
+
+	return 1.0;
+}
+
+/*
+ * sample_change
+ *
+ * Keeps a change when the hash of its replica identity key falls under the
+ * rate, so that a row is kept or left out by all its changes, in every
+ * run. Values are hashed detoasted, compressed ones as well as those whose
+ * TOAST chunks came with the change. A change without a key to hash,
+ * because the table has no replica identity index or the old tuple was not
+ * logged, is kept.
+ *
+ * A key value still stored out of line, as an unchanged key in an UPDATE,
+ * would have to be fetched from the TOAST table, which decoding must not
+ * read. Hashing its TOAST pointer would not give the hash of the value seen
+ * by the other changes of the row, so such a change is kept as well.
+ */
+static bool
+sample_change(Relation relation, ReorderBufferChange *change, double rate)
+{
+	TupleDesc	tupdesc = RelationGetDescr(relation);
+	ReorderBufferTupleBuf *tuplebuf;
+	Bitmapset  *key;
+	uint64		hash = 0;
+	int			member = -1;
+
+	if (change->action == REORDER_BUFFER_CHANGE_DELETE)
+		tuplebuf = change->data.tp.oldtuple;
+	else
+		tuplebuf = change->data.tp.newtuple;
+
+	key = RelationGetIdentityKeyBitmap(relation);
+	if (tuplebuf == NULL || key == NULL)
+		return true;
+
+	while ((member = bms_next_member(key, member)) >= 0)
+	{
+		AttrNumber	attnum = member + FirstLowInvalidHeapAttributeNumber;
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+		Datum		value;
+		bool		isnull;
+
+		value = heap_getattr(&tuplebuf->tuple, attnum, tupdesc, &isnull);
+		if (isnull)
+			continue;
+
+		if (attr->attbyval)
+			hash = hash_bytes_extended((const unsigned char *) &value,
+									   sizeof(Datum), hash);
+		else if (attr->attlen == -1)
+		{
+			struct varlena *varlena;
+
+			if (VARATT_IS_EXTERNAL_ONDISK(DatumGetPointer(value)))
+				return true;
+
+			varlena = PG_DETOAST_DATUM_PACKED(value);
+
+			hash = hash_bytes_extended((const unsigned char *) VARDATA_ANY(varlena),
+									   VARSIZE_ANY_EXHDR(varlena), hash);
+		}
+		else if (attr->attlen == -2)
+			hash = hash_bytes_extended((const unsigned char *) DatumGetCString(value),
+									   strlen(DatumGetCString(value)), hash);
+		else
+			hash = hash_bytes_extended((const unsigned char *) DatumGetPointer(value),
+									   attr->attlen, hash);
+	}
+
+	return (double) hash / (double) PG_UINT64_MAX < rate;
+}
+
+/*
+ * print_columns
+ *
+ * Appends the columns of a tuple as " name=value". PRINT_KEY prints the
+ * columns of the replica identity index, or the whole tuple without one,
+ * that is with REPLICA IDENTITY FULL. PRINT_KEY_AND_CHANGED prints the key
+ * and the columns that differ from the old tuple, so that the size of the
+ * output follows the size of the change rather than the width of the row.
+ */
+static void
+print_columns(StringInfo s, Relation relation, HeapTuple tuple,
+			  HeapTuple oldtuple, PrintColumns which)
+{
+	TupleDesc	tupdesc = RelationGetDescr(relation);
+	Bitmapset  *key = NULL;
+
+	if (which != PRINT_ALL)
+		key = RelationGetIdentityKeyBitmap(relation);
+
+	for (int natt = 0; natt < tupdesc->natts; natt++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, natt);
+		Datum		value;
+		bool		isnull;
+		Oid			typoutput;
+		bool		typisvarlena;
+		bool		is_key;
+
+		if (attr->attisdropped)
+			continue;
+
+		value = heap_getattr(tuple, natt + 1, tupdesc, &isnull);
+		is_key = bms_is_member(attr->attnum - FirstLowInvalidHeapAttributeNumber, key);
+
+		if (which == PRINT_KEY && key != NULL && !is_key)
+			continue;
+		if (which == PRINT_KEY_AND_CHANGED && !is_key &&
+			!column_changed(attr, value, isnull, oldtuple, tupdesc))
+			continue;
+
+		appendStringInfo(s, " %s=", quote_identifier(NameStr(attr->attname)));
+
+		if (isnull)
+			appendStringInfoString(s, "null");
+		else if (attr->attlen == -1 &&
+				 VARATT_IS_EXTERNAL_ONDISK(DatumGetPointer(value)))
+			appendStringInfoString(s, "unchanged-toast-datum");
+		else
+		{
+			getTypeOutputInfo(attr->atttypid, &typoutput, &typisvarlena);
+			if (typisvarlena)
+				value = PointerGetDatum(PG_DETOAST_DATUM(value));
+			appendStringInfoString(s,
+				quote_literal_cstr(OidOutputFunctionCall(typoutput, value)));
+		}
+	}
+}
+
+/*
+ * column_changed
+ *
+ * Compares a column of the new tuple with the old tuple, as stored: an
+ * on-disk TOAST pointer in the new tuple is a value that the UPDATE did not
+ * rewrite, and is never fetched. Without an old tuple, that is when the
+ * replica identity is not FULL and the key did not change, the other
+ * columns are taken as changed. A varlena is compared by its contents, see
+ * varlena_equal().
+ */
+static bool
+column_changed(Form_pg_attribute attr, Datum value, bool isnull,
+			   HeapTuple oldtuple, TupleDesc tupdesc)
+{
+	Datum		oldvalue;
+	bool		oldisnull;
+
+	if (!isnull && attr->attlen == -1 &&
+		VARATT_IS_EXTERNAL_ONDISK(DatumGetPointer(value)))
+		return false;
+
+	if (oldtuple == NULL)
+		return true;
+
+	oldvalue = heap_getattr(oldtuple, attr->attnum, tupdesc, &oldisnull);
+
+	if (isnull || oldisnull)
+		return isnull != oldisnull;
+
+	if (attr->attlen == -1)
+		return !varlena_equal((struct varlena *) DatumGetPointer(value),
+							  (struct varlena *) DatumGetPointer(oldvalue));
+
+	return !datumIsEqual(value, oldvalue, attr->attbyval, attr->attlen);
+}
+
+/*
+ * varlena_equal
+ *
+ * Compares two varlenas by their contents. The old tuple is flattened when
+ * logged, but the same value may be compressed inline in one tuple and not
+ * in the other, or have a short header in only one of them: a compressed
+ * value is decompressed first. An external value is never fetched, and is
+ * taken as different.
+ */
+static bool
+varlena_equal(struct varlena *value, struct varlena *oldvalue)
+{
+	struct varlena *a = value;
+	struct varlena *b = oldvalue;
+	bool		equal;
+
+	if (VARATT_IS_EXTERNAL(a) || VARATT_IS_EXTERNAL(b))
+		return false;
+
+	if (VARATT_IS_COMPRESSED(a))
+		a = detoast_attr(a);
+	if (VARATT_IS_COMPRESSED(b))
+		b = detoast_attr(b);
+
+	equal = VARSIZE_ANY_EXHDR(a) == VARSIZE_ANY_EXHDR(b) &&
+		memcmp(VARDATA_ANY(a), VARDATA_ANY(b), VARSIZE_ANY_EXHDR(a)) == 0;
+
+	if (a != value)
+		pfree(a);
+	if (b != oldvalue)
+		pfree(b);
+
+	return equal;
+}
@@ -0,0 +1,28 @@
+/*
+ * plugin_audit_probes.h
+ *
+ * USDT probes of plugin_audit, used by the scripts of bpftrace/. They need
+ * <sys/sdt.h> (systemtap-sdt-dev or systemtap-sdt-devel), and are compiled
+ * out without it. An enabled probe is a single nop until a tracer attaches.
+ */
+#ifndef PLUGIN_AUDIT_PROBES_H
+#define PLUGIN_AUDIT_PROBES_H
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PLUGIN_AUDIT_USDT
+#endif
+#endif
+
+#ifdef PLUGIN_AUDIT_USDT
+#define PLUGIN_AUDIT_PROBE1(name, a) DTRACE_PROBE1(plugin_audit, name, a)
+#define PLUGIN_AUDIT_PROBE2(name, a, b) DTRACE_PROBE2(plugin_audit, name, a, b)
+#define PLUGIN_AUDIT_PROBE3(name, a, b, c) DTRACE_PROBE3(plugin_audit, name, a, b, c)
+#else
+#define PLUGIN_AUDIT_PROBE1(name, a) ((void) 0)
+#define PLUGIN_AUDIT_PROBE2(name, a, b) ((void) 0)
+#define PLUGIN_AUDIT_PROBE3(name, a, b, c) ((void) 0)
+#endif
+
+#endif                          /* PLUGIN_AUDIT_PROBES_H */
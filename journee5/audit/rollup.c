@@ -0,0 +1,843 @@
+/*
+ * rollup, aggregates maintained by audit
+ *
+ * A rollup is declared as TARGET:GROUPS:AGGREGATES, for example
+ * "sales_per_day:store,day(sold_at):count,sum(amount)":
+ *
+ *   - GROUPS, the columns of the table grouped by, day(column) for the
+ *     date part of a date or a timestamp;
+ *   - AGGREGATES, count and sum(column) of integer or numeric columns.
+ *
+ * TARGET is a table with the group columns, named as in the table, then
+ * count and sum_COLUMN, and lsn of type pg_lsn. It needs a unique index on
+ * the group columns, NULLS NOT DISTINCT if they can be null, and must be
+ * filled before audit first starts, while the table is not written.
+ *
+ * Each decoded change adds its new row to its group and removes its old
+ * row from its group, in a hash table of deltas: the table must have
+ * REPLICA IDENTITY FULL so that UPDATE and DELETE carry the old row. The
+ * sums are added as exact decimals in 128 bits, and a value that does not
+ * fit is left for the server to add as a numeric. A TRUNCATE of the table
+ * drops the deltas, and the next flush empties the target before writing
+ * the deltas that followed it. Each flush upserts the deltas to the
+ * target in batches, in one transaction, with the LSN up to which the
+ * changes were read. audit moves its slot there after the commit, and at
+ * startup, from the greatest lsn of the targets: a flush is applied once,
+ * even if audit stops between both.
+ *
+ * A group whose count fell to zero keeps the lsn of its flush, and is only
+ * deleted by the next flush of its rollup. A sum is null while its group
+ * never had a non-null value, like sum(), but stays at 0 once all its
+ * non-null values are deleted: the number of non-null values is not kept.
+ * An emptied target has no lsn left: audit then reads again the changes of
+ * the last flush, which empties the target again.
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <ctype.h>
+#include "postgres_fe.h"
+#include "common/hashfn.h"
+#include "common/logging.h"
+#include "fe_utils/string_utils.h"
+
+#include "rollup.h"
+
+#ifndef HAVE_INT128
+#error "rollup sums need a 128-bit integer type"
+#endif
+
+/* number of buckets of each rollup, a power of 2 */
+#define ROLLUP_BUCKETS 1024
+
+/* groups per INSERT */
+#define ROLLUP_BATCH 500
+
+/* digits after the point of a sum, 38 still fitting in 128 bits */
+#define DECIMAL_MAX_SCALE 38
+
+/* value of a column not rewritten by an UPDATE */
+static char toast_unchanged[] = "unchanged-toast-datum";
+
+typedef struct RollupGroup
+{
+  char         *column;
+  bool          day;            /* date part only */
+} RollupGroup;
+
+/* exact decimal, units / 10^scale, then the values that did not fit */
+typedef struct Decimal
+{
+  int128        units;
+  int           scale;
+  PQExpBuffer   rest;           /* " + value::numeric" terms, or NULL */
+} Decimal;
+
+typedef struct RollupEntry
+{
+  struct RollupEntry *next;
+  uint32        hash;
+  char         *key;            /* each group value ended by '\0', '\1' for null */
+  int           keylen;
+  char        **values;         /* NULL for null */
+  int64         count;
+  Decimal      *sums;
+  bool         *nonnull;        /* a non-null value was added or removed */
+} RollupEntry;
+
+struct Rollup
+{
+  Rollup       *next;
+  char         *target;
+  RollupGroup  *groups;
+  int           ngroups;
+  bool          count;
+  char        **sums;
+  int           nsums;
+  RollupEntry  *buckets[ROLLUP_BUCKETS];
+  int           nentries;
+  bool          zeroed;         /* groups of count 0 may be left */
+  bool          truncated;      /* the target must be emptied */
+};
+
+/* columns of a row of a change */
+typedef struct Row
+{
+  int           ncolumns;
+  char        **names;
+  char        **values;         /* NULL for null, or toast_unchanged */
+} Row;
+
+static bool parse_row(const char **p, Row *row);
+static char *parse_identifier(const char **p);
+static char *parse_literal(const char **p);
+static void free_row(Row *row);
+static const char *row_value(const Row *row, const Row *old, const char *column);
+static void apply_row(Rollup *rollup, const Row *row, const Row *old, int sign);
+static void truncate_rollup(Rollup *rollup);
+static void free_entry(Rollup *rollup, RollupEntry *entry);
+static void add_decimal(Decimal *sum, const char *value, int sign,
+                        const char *column);
+static void append_decimal(PQExpBuffer buf, const Decimal *value);
+static void flush_rollup(PGconn *conn, Rollup *rollup, const char *lsn,
+                         bool echo);
+static void exec_or_exit(PGconn *conn, const char *sql, bool echo);
+
+/*
+ * rollup_parse
+ *
+ * Parses a definition, exits on error, and returns it before next.
+ */
+Rollup *
+rollup_parse(const char *definition, Rollup *next)
+{
+  Rollup *rollup = pg_malloc0(sizeof(Rollup));
+  char   *copy = pg_strdup(definition);
+  char   *groups;
+  char   *aggregates;
+  char   *item;
+
+  rollup->next = next;
+  rollup->zeroed = true;
+
+  groups = strchr(copy, ':');
+  aggregates = groups ? strchr(groups + 1, ':') : NULL;
+  if (aggregates == NULL || groups == copy || groups[1] == ':')
+    pg_fatal("invalid rollup \"%s\", expected TARGET:GROUPS:AGGREGATES", definition);
+  *groups++ = '\0';
+  *aggregates++ = '\0';
+  rollup->target = copy;
+
+  for (item = strtok(groups, ","); item; item = strtok(NULL, ","))
+  {
+    RollupGroup *group;
+    size_t       len = strlen(item);
+
+    rollup->groups = pg_realloc(rollup->groups,
+                                (rollup->ngroups + 1) * sizeof(RollupGroup));
+    group = &rollup->groups[rollup->ngroups++];
+
+    group->day = strncmp(item, "day(", 4) == 0 && item[len - 1] == ')';
+    group->column = group->day ? pnstrdup(item + 4, len - 5) : item;
+  }
+
+  for (item = strtok(aggregates, ","); item; item = strtok(NULL, ","))
+  {
+    size_t len = strlen(item);
+
+    if (strcmp(item, "count") == 0)
+      rollup->count = true;
+    else if (strncmp(item, "sum(", 4) == 0 && item[len - 1] == ')')
+    {
+      rollup->sums = pg_realloc(rollup->sums, (rollup->nsums + 1) * sizeof(char *));
+      rollup->sums[rollup->nsums++] = pnstrdup(item + 4, len - 5);
+    }
+    else
+      pg_fatal("invalid aggregate \"%s\", expected count or sum(column)", item);
+  }
+
+  if (rollup->ngroups == 0 || (!rollup->count && rollup->nsums == 0))
+    pg_fatal("invalid rollup \"%s\", expected TARGET:GROUPS:AGGREGATES", definition);
+
+  return rollup;
+}
+
+/*
+ * rollup_apply
+ *
+ * Adds a change of the table, printed by plugin_audit with columns=full,
+ * to the deltas of each rollup.
+ */
+void
+rollup_apply(Rollup *rollups, const char *change)
+{
+  const char *p = change;
+  bool        quoted = false;
+  Row         row = {0};
+  Row         old = {0};
+
+  /* the relation, maybe quoted */
+  for (; *p && (quoted || *p != ' '); p++)
+  {
+    if (*p == '"')
+      quoted = !quoted;
+  }
+  while (*p == ' ')
+    p++;
+
+  if (strncmp(p, "INSERT", 6) == 0)
+  {
+    p += 6;
+    parse_row(&p, &row);
+    for (Rollup *rollup = rollups; rollup; rollup = rollup->next)
+      apply_row(rollup, &row, NULL, 1);
+  }
+  else if (strncmp(p, "UPDATE", 6) == 0)
+  {
+    p += 6;
+    if (!parse_row(&p, &row))
+      pg_fatal("UPDATE without its old row, the table needs REPLICA IDENTITY FULL");
+    p += 3;
+    parse_row(&p, &old);
+    for (Rollup *rollup = rollups; rollup; rollup = rollup->next)
+    {
+      apply_row(rollup, &old, NULL, -1);
+      apply_row(rollup, &row, &old, 1);
+    }
+  }
+  else if (strncmp(p, "DELETE", 6) == 0)
+  {
+    p += 6;
+    parse_row(&p, &old);
+    for (Rollup *rollup = rollups; rollup; rollup = rollup->next)
+      apply_row(rollup, &old, NULL, -1);
+  }
+  else if (strncmp(p, "TRUNCATE", 8) == 0)
+  {
+    for (Rollup *rollup = rollups; rollup; rollup = rollup->next)
+      truncate_rollup(rollup);
+  }
+
+  free_row(&row);
+  free_row(&old);
+}
+
+/*
+ * parse_row
+ *
+ * Reads " name=value" columns up to the end, or up to " OLD": returns true
+ * when stopped there, *p then pointing at it.
+ */
+static bool
+parse_row(const char **p, Row *row)
+{
+  for (;;)
+  {
+    char *name;
+    char *value;
+
+    while (**p == ' ')
+      (*p)++;
+
+    if (**p == '\0')
+      return false;
+    /* an identifier in capitals would be quoted */
+    if (strncmp(*p, "OLD", 3) == 0 && ((*p)[3] == ' ' || (*p)[3] == '\0'))
+      return true;
+
+    name = parse_identifier(p);
+    if (**p != '=')
+      pg_fatal("could not parse change at \"%s\"", *p);
+    (*p)++;
+
+    if (strncmp(*p, "null", 4) == 0)
+    {
+      value = NULL;
+      *p += 4;
+    }
+    else if (strncmp(*p, toast_unchanged, strlen(toast_unchanged)) == 0)
+    {
+      value = toast_unchanged;
+      *p += strlen(toast_unchanged);
+    }
+    else
+      value = parse_literal(p);
+
+    row->names = pg_realloc(row->names, (row->ncolumns + 1) * sizeof(char *));
+    row->values = pg_realloc(row->values, (row->ncolumns + 1) * sizeof(char *));
+    row->names[row->ncolumns] = name;
+    row->values[row->ncolumns] = value;
+    row->ncolumns++;
+  }
+}
+
+/* a name as written by quote_identifier */
+static char *
+parse_identifier(const char **p)
+{
+  PQExpBufferData name;
+
+  initPQExpBuffer(&name);
+
+  if (**p != '"')
+  {
+    while (**p && **p != '=')
+      appendPQExpBufferChar(&name, *(*p)++);
+    return name.data;
+  }
+
+  for ((*p)++; **p; (*p)++)
+  {
+    if (**p == '"')
+    {
+      if ((*p)[1] != '"')
+      {
+        (*p)++;
+        break;
+      }
+      (*p)++;
+    }
+    appendPQExpBufferChar(&name, **p);
+  }
+
+  return name.data;
+}
+
+/* a value as written by quote_literal_cstr, E'' when it has backslashes */
+static char *
+parse_literal(const char **p)
+{
+  PQExpBufferData value;
+  bool            escape = false;
+
+  if (**p == 'E')
+  {
+    escape = true;
+    (*p)++;
+  }
+  if (**p != '\'')
+    pg_fatal("could not parse change at \"%s\"", *p);
+
+  initPQExpBuffer(&value);
+
+  for ((*p)++; **p; (*p)++)
+  {
+    if (**p == '\'')
+    {
+      if ((*p)[1] != '\'')
+      {
+        (*p)++;
+        return value.data;
+      }
+      (*p)++;
+    }
+    else if (escape && **p == '\\' && (*p)[1] != '\0')
+      (*p)++;
+    appendPQExpBufferChar(&value, **p);
+  }
+
+  pg_fatal("unterminated value in change");
+}
+
+static void
+free_row(Row *row)
+{
+  for (int i = 0; i < row->ncolumns; i++)
+  {
+    pg_free(row->names[i]);
+    if (row->values[i] != toast_unchanged)
+      pg_free(row->values[i]);
+  }
+  pg_free(row->names);
+  pg_free(row->values);
+}
+
+/*
+ * row_value
+ *
+ * Returns the value of a column, from the old row when the UPDATE did not
+ * rewrite it.
+ */
+static const char *
+row_value(const Row *row, const Row *old, const char *column)
+{
+  for (int i = 0; i < row->ncolumns; i++)
+  {
+    if (strcmp(row->names[i], column) == 0)
+    {
+      if (row->values[i] == toast_unchanged && old)
+        return row_value(old, NULL, column);
+      if (row->values[i] == toast_unchanged)
+        pg_fatal("value of column \"%s\" not logged, the table needs REPLICA IDENTITY FULL",
+                 column);
+      return row->values[i];
+    }
+  }
+
+  pg_fatal("column \"%s\" not found in the changes of the table", column);
+}
+
+/*
+ * apply_row
+ *
+ * Adds a row to its group, or removes it with a sign of -1.
+ */
+static void
+apply_row(Rollup *rollup, const Row *row, const Row *old, int sign)
+{
+  PQExpBufferData key;
+  RollupEntry   **bucket;
+  RollupEntry    *entry;
+  uint32          hash;
+
+  /* an UPDATE or a DELETE without the old row of the table */
+  if (row->ncolumns == 0)
+    pg_fatal("change without its row, the table needs REPLICA IDENTITY FULL");
+
+  initPQExpBuffer(&key);
+  for (int i = 0; i < rollup->ngroups; i++)
+  {
+    const char *value = row_value(row, old, rollup->groups[i].column);
+
+    if (value == NULL)
+      appendPQExpBufferChar(&key, '\1');
+    else
+    {
+      /* ISO DateStyle, the date comes first */
+      size_t len = rollup->groups[i].day ? strcspn(value, " T") : strlen(value);
+
+      appendBinaryPQExpBuffer(&key, value, len);
+      appendPQExpBufferChar(&key, '\0');
+    }
+  }
+
+  hash = hash_bytes((const unsigned char *) key.data, key.len);
+  bucket = &rollup->buckets[hash & (ROLLUP_BUCKETS - 1)];
+
+  for (entry = *bucket; entry; entry = entry->next)
+  {
+    if (entry->hash == hash && entry->keylen == key.len &&
+        memcmp(entry->key, key.data, key.len) == 0)
+      break;
+  }
+
+  if (entry == NULL)
+  {
+    const char *k = key.data;
+
+    entry = pg_malloc0(sizeof(RollupEntry));
+    entry->hash = hash;
+    entry->key = key.data;
+    entry->keylen = key.len;
+    entry->values = pg_malloc(rollup->ngroups * sizeof(char *));
+    entry->sums = pg_malloc0(Max(rollup->nsums, 1) * sizeof(Decimal));
+    entry->nonnull = pg_malloc0(Max(rollup->nsums, 1) * sizeof(bool));
+    for (int i = 0; i < rollup->ngroups; i++)
+    {
+      entry->values[i] = *k == '\1' ? NULL : (char *) k;
+      k += *k == '\1' ? 1 : strlen(k) + 1;
+    }
+    entry->next = *bucket;
+    *bucket = entry;
+    rollup->nentries++;
+  }
+  else
+    termPQExpBuffer(&key);
+
+  entry->count += sign;
+  for (int i = 0; i < rollup->nsums; i++)
+  {
+    const char *value = row_value(row, old, rollup->sums[i]);
+
+    /* like sum(), nulls are ignored */
+    if (value)
+    {
+      add_decimal(&entry->sums[i], value, sign, rollup->sums[i]);
+      entry->nonnull[i] = true;
+    }
+  }
+}
+
+/*
+ * truncate_rollup
+ *
+ * Forgets the deltas of a rollup, whose target is emptied by the next
+ * flush.
+ */
+static void
+truncate_rollup(Rollup *rollup)
+{
+  for (int b = 0; b < ROLLUP_BUCKETS; b++)
+  {
+    RollupEntry *entry = rollup->buckets[b];
+
+    while (entry)
+    {
+      RollupEntry *next = entry->next;
+
+      free_entry(rollup, entry);
+      entry = next;
+    }
+    rollup->buckets[b] = NULL;
+  }
+  rollup->nentries = 0;
+  rollup->truncated = true;
+}
+
+static void
+free_entry(Rollup *rollup, RollupEntry *entry)
+{
+  for (int i = 0; i < rollup->nsums; i++)
+  {
+    if (entry->sums[i].rest)
+      destroyPQExpBuffer(entry->sums[i].rest);
+  }
+  pg_free(entry->key);
+  pg_free(entry->values);
+  pg_free(entry->sums);
+  pg_free(entry->nonnull);
+  pg_free(entry);
+}
+
+/*
+ * add_decimal
+ *
+ * Adds an integer or a numeric, as printed, to an exact sum. A value that
+ * does not fit, or has more than DECIMAL_MAX_SCALE digits after the point,
+ * is appended to the sum for the server to add.
+ */
+static void
+add_decimal(Decimal *sum, const char *value, int sign, const char *column)
+{
+  int128      units = 0;
+  int         scale = 0;
+  int128      total = sum->units;
+  int         total_scale = sum->scale;
+  bool        negative = false;
+  bool        point = false;
+  bool        overflow = false;
+  const char *c = value;
+
+  if (*c == '-' || *c == '+')
+    negative = *c++ == '-';
+  if (*c == '\0')
+    pg_fatal("sum of \"%s\" needs integer or numeric values, not \"%s\"", column, value);
+
+  for (; *c; c++)
+  {
+    if (*c == '.' && !point)
+      point = true;
+    else if (isdigit((unsigned char) *c))
+    {
+      overflow |= __builtin_mul_overflow(units, 10, &units) ||
+                  __builtin_add_overflow(units, *c - '0', &units);
+      if (point)
+        scale++;
+    }
+    else
+      pg_fatal("sum of \"%s\" needs integer or numeric values, not \"%s\"", column, value);
+  }
+  overflow |= scale > DECIMAL_MAX_SCALE;
+  if (negative != (sign < 0))
+    units = -units;
+
+  /* same scale, the sum only changing if the addition fits */
+  while (!overflow && total_scale < scale)
+  {
+    overflow = __builtin_mul_overflow(total, 10, &total);
+    total_scale++;
+  }
+  while (!overflow && scale < total_scale)
+  {
+    overflow = __builtin_mul_overflow(units, 10, &units);
+    scale++;
+  }
+
+  if (!overflow && !__builtin_add_overflow(total, units, &total))
+  {
+    sum->units = total;
+    sum->scale = total_scale;
+    return;
+  }
+
+  if (sum->rest == NULL)
+    sum->rest = createPQExpBuffer();
+  appendPQExpBuffer(sum->rest, " %c %s::numeric", sign < 0 ? '-' : '+', value);
+}
+
+static void
+append_decimal(PQExpBuffer buf, const Decimal *value)
+{
+  char    digits[48];
+  char   *c = digits + sizeof(digits);
+  uint128 units = value->units < 0 ? -(uint128) value->units : (uint128) value->units;
+  int     n = 0;
+
+  /* digits of the absolute value from the last, at least one before the point */
+  *--c = '\0';
+  do
+  {
+    *--c = '0' + (int) (units % 10);
+    units /= 10;
+    if (++n == value->scale)
+      *--c = '.';
+  } while (units > 0 || n <= value->scale);
+  if (value->units < 0)
+    *--c = '-';
+
+  if (value->rest)
+    appendPQExpBuffer(buf, "(%s%s)", c, value->rest->data);
+  else
+    appendPQExpBufferStr(buf, c);
+}
+
+/*
+ * rollup_flush
+ *
+ * Writes the deltas of every rollup in one transaction, then forgets them.
+ */
+void
+rollup_flush(PGconn *conn, Rollup *rollups, const char *lsn, bool echo)
+{
+  bool pending = false;
+
+  for (Rollup *rollup = rollups; rollup; rollup = rollup->next)
+    pending |= rollup->nentries > 0 || rollup->truncated;
+  if (!pending)
+    return;
+
+  exec_or_exit(conn, "BEGIN;", echo);
+  for (Rollup *rollup = rollups; rollup; rollup = rollup->next)
+    flush_rollup(conn, rollup, lsn, echo);
+  exec_or_exit(conn, "COMMIT;", echo);
+}
+
+static void
+flush_rollup(PGconn *conn, Rollup *rollup, const char *lsn, bool echo)
+{
+  PQExpBufferData head;
+  PQExpBufferData sql;
+  PQExpBufferData conflict;
+  int             rows = 0;
+  int             groups = rollup->nentries;
+  bool            emptied = false;
+
+  // A TRUNCATE of the table empties the target, before the deltas of the
+  // changes that followed it
+
+  if (rollup->truncated)
+  {
+    char *truncate = psprintf("DELETE FROM %s;", rollup->target);
+
+    exec_or_exit(conn, truncate, echo);
+    pg_free(truncate);
+    rollup->truncated = false;
+    rollup->zeroed = false;
+  }
+
+  if (rollup->nentries == 0)
+    return;
+
+  // Same columns and conflict clause for every batch
+
+  initPQExpBuffer(&head);
+  appendPQExpBuffer(&head, "INSERT INTO %s AS r (", rollup->target);
+  for (int i = 0; i < rollup->ngroups; i++)
+  {
+    appendPQExpBufferStr(&head, fmtId(rollup->groups[i].column));
+    appendPQExpBufferStr(&head, ", ");
+  }
+  if (rollup->count)
+    appendPQExpBufferStr(&head, "count, ");
+  for (int i = 0; i < rollup->nsums; i++)
+  {
+    char *column = psprintf("sum_%s", rollup->sums[i]);
+
+    appendPQExpBufferStr(&head, fmtId(column));
+    appendPQExpBufferStr(&head, ", ");
+    pg_free(column);
+  }
+  appendPQExpBufferStr(&head, "lsn) VALUES ");
+
+  initPQExpBuffer(&conflict);
+  appendPQExpBufferStr(&conflict, " ON CONFLICT (");
+  for (int i = 0; i < rollup->ngroups; i++)
+  {
+    if (i > 0)
+      appendPQExpBufferStr(&conflict, ", ");
+    appendPQExpBufferStr(&conflict, fmtId(rollup->groups[i].column));
+  }
+  appendPQExpBufferStr(&conflict, ") DO UPDATE SET ");
+  if (rollup->count)
+    appendPQExpBufferStr(&conflict, "count = r.count + EXCLUDED.count, ");
+  for (int i = 0; i < rollup->nsums; i++)
+  {
+    char *column = psprintf("sum_%s", rollup->sums[i]);
+    char *quoted = pg_strdup(fmtId(column));
+
+    /* null when neither has a non-null value */
+    appendPQExpBuffer(&conflict, "%s = coalesce(r.%s + EXCLUDED.%s, r.%s, EXCLUDED.%s), ",
+                      quoted, quoted, quoted, quoted, quoted);
+    pg_free(quoted);
+    pg_free(column);
+  }
+  appendPQExpBufferStr(&conflict, "lsn = EXCLUDED.lsn;");
+
+  initPQExpBuffer(&sql);
+  for (int b = 0; b < ROLLUP_BUCKETS; b++)
+  {
+    RollupEntry *entry = rollup->buckets[b];
+
+    while (entry)
+    {
+      RollupEntry *next = entry->next;
+
+      if (rows == 0)
+        appendPQExpBufferStr(&sql, head.data);
+      else
+        appendPQExpBufferStr(&sql, ", ");
+
+      appendPQExpBufferChar(&sql, '(');
+      for (int i = 0; i < rollup->ngroups; i++)
+      {
+        if (entry->values[i])
+          appendStringLiteralConn(&sql, entry->values[i], conn);
+        else
+          appendPQExpBufferStr(&sql, "NULL");
+        appendPQExpBufferStr(&sql, ", ");
+      }
+      if (rollup->count)
+        appendPQExpBuffer(&sql, INT64_FORMAT ", ", entry->count);
+      for (int i = 0; i < rollup->nsums; i++)
+      {
+        if (entry->nonnull[i])
+          append_decimal(&sql, &entry->sums[i]);
+        else
+          appendPQExpBufferStr(&sql, "NULL");
+        appendPQExpBufferStr(&sql, ", ");
+      }
+      appendPQExpBuffer(&sql, "'%s')", lsn);
+
+      emptied |= entry->count < 0;
+
+      if (++rows == ROLLUP_BATCH)
+      {
+        appendPQExpBufferStr(&sql, conflict.data);
+        exec_or_exit(conn, sql.data, echo);
+        resetPQExpBuffer(&sql);
+        rows = 0;
+      }
+
+      free_entry(rollup, entry);
+      entry = next;
+    }
+    rollup->buckets[b] = NULL;
+  }
+
+  if (rows > 0)
+  {
+    appendPQExpBufferStr(&sql, conflict.data);
+    exec_or_exit(conn, sql.data, echo);
+  }
+
+  // A group whose rows were all deleted disappears, as with a refresh, but
+  // only at the next flush: until then its lsn tells that this flush was
+  // committed
+
+  if (rollup->zeroed && rollup->count)
+  {
+    resetPQExpBuffer(&sql);
+    appendPQExpBuffer(&sql, "DELETE FROM %s WHERE count = 0 AND lsn < '%s';",
+                      rollup->target, lsn);
+    exec_or_exit(conn, sql.data, echo);
+  }
+
+  rollup->zeroed = emptied;
+  rollup->nentries = 0;
+
+  pg_log_info("rollup \"%s\": %d groups updated up to %s", rollup->target, groups, lsn);
+
+  termPQExpBuffer(&sql);
+  termPQExpBuffer(&conflict);
+  termPQExpBuffer(&head);
+}
+
+/*
+ * rollup_flushed_lsn
+ *
+ * Returns the greatest lsn of the targets, the end of the last flush
+ * committed, or NULL if none.
+ */
+char *
+rollup_flushed_lsn(PGconn *conn, Rollup *rollups, bool echo)
+{
+  PQExpBufferData sql;
+  PGresult       *result;
+  char           *lsn = NULL;
+
+  initPQExpBuffer(&sql);
+  appendPQExpBufferStr(&sql, "SELECT max(lsn) FROM (");
+  for (Rollup *rollup = rollups; rollup; rollup = rollup->next)
+  {
+    if (rollup != rollups)
+      appendPQExpBufferStr(&sql, " UNION ALL ");
+    appendPQExpBuffer(&sql, "SELECT max(lsn) AS lsn FROM %s", rollup->target);
+  }
+  appendPQExpBufferStr(&sql, ") AS targets;");
+
+  if (echo)
+    printf("%s\n", sql.data);
+  result = PQexec(conn, sql.data);
+  if (PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) != 1)
+  {
+    pg_log_error("read rollups failed: %s", PQerrorMessage(conn));
+    PQfinish(conn);
+    exit(1);
+  }
+  if (!PQgetisnull(result, 0, 0))
+    lsn = pg_strdup(PQgetvalue(result, 0, 0));
+  PQclear(result);
+  termPQExpBuffer(&sql);
+
+  return lsn;
+}
+
+static void
+exec_or_exit(PGconn *conn, const char *sql, bool echo)
+{
+  PGresult *result;
+
+  if (echo)
+    printf("%s\n", sql);
+  result = PQexec(conn, sql);
+  if (PQresultStatus(result) != PGRES_COMMAND_OK)
+  {
+    pg_log_error("rollup failed: %s", PQerrorMessage(conn));
+    PQfinish(conn);
+    exit(1);
+  }
+  PQclear(result);
+}
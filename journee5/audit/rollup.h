@@ -0,0 +1,21 @@
+/*
+ * rollup, aggregates maintained by audit
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include "libpq-fe.h"
+
+typedef struct Rollup Rollup;
+
+extern Rollup *rollup_parse(const char *definition, Rollup *next);
+extern void rollup_apply(Rollup *rollups, const char *change);
+extern void rollup_flush(PGconn *conn, Rollup *rollups, const char *lsn,
+                         bool echo);
+extern char *rollup_flushed_lsn(PGconn *conn, Rollup *rollups, bool echo);
+
+#endif                          /* ROLLUP_H */
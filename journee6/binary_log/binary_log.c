@@ -0,0 +1,691 @@
+/* PostgreSQL headers */
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "libpq/libpq-be.h"
+#include "pgtime.h"
+#include "port/atomics.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "tcop/tcopprot.h"
+#include "utils/backend_status.h"
+#include "utils/guc.h"
+#include "utils/timestamp.h"
+#include "utils/wait_event.h"
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+/* record format, shared with binary_log_decode */
+#include "binary_log.h"
+
+/* module declaration */
+PG_MODULE_MAGIC;
+
+/* size of the buffer of the writer, written at once */
+#define WRITE_BUFFER_SIZE (1024 * 1024)
+
+/* structure definitions */
+
+/*
+ * Ring buffer of a process, indexed by its PGPROC number. Only the process
+ * using the slot writes records in it, and only the writer reads them, so
+ * the two positions are enough to synchronize them without a lock. The
+ * positions grow forever and are taken modulo the size of the ring.
+ */
+typedef struct BinaryLogRing
+{
+  pg_atomic_uint64 write_pos;
+  pg_atomic_uint64 read_pos;
+  pg_atomic_uint64 overflows;   /* records sent to the text log instead */
+  pg_atomic_uint32 writing;     /* a record is being written */
+  char             data[FLEXIBLE_ARRAY_MEMBER];
+} BinaryLogRing;
+
+typedef struct BinaryLogShared
+{
+  Latch  *writer_latch;         /* NULL when the writer does not run */
+  int     ring_count;
+  Size    ring_size;
+} BinaryLogShared;
+
+/* variable definitions */
+static char *log_directory = NULL;
+static int   buffer_size = 64;
+static int   rotation_size = 10 * 1024;
+static int   rotation_age = 60;
+static int   flush_delay = 200;
+static bool  replace_text_log = true;
+
+static BinaryLogShared *shared = NULL;
+static bool  is_writer = false;
+static int   line_number = 0;
+
+static emit_log_hook_type prev_emit_log_hook = NULL;
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* state of the writer */
+static int      current_fd = -1;
+static char     current_path[MAXPGPATH];
+static Size     current_size = 0;
+static pg_time_t current_opened_at = 0;
+static char    *write_buffer = NULL;
+static Size     write_buffered = 0;
+static uint64   reported_overflows = 0;
+
+/* function definitions */
+void        _PG_init(void);
+PGDLLEXPORT void binary_log_main(Datum main_arg) pg_attribute_noreturn();
+static Size binary_log_shmem_size(void);
+static Size binary_log_ring_stride(void);
+static BinaryLogRing *binary_log_ring(int number);
+static void binary_log_shmem_request(void);
+static void binary_log_shmem_startup(void);
+static void binary_log_emit_log(ErrorData *edata);
+static bool binary_log_record(ErrorData *edata);
+static bool binary_log_level_output(int elevel, int log_min_level);
+static uint8 binary_log_severity(int elevel);
+static void ring_copy_in(BinaryLogRing *ring, uint64 pos,
+                         const void *data, Size len);
+static void binary_log_writer_exit(int code, Datum arg);
+static void drain_rings(void);
+static void flush_write_buffer(void);
+static void write_all(const char *data, Size len);
+static void open_log_file(void);
+static void close_log_file(void);
+
+/* function code */
+
+/*
+ * _PG_init
+ *
+ * Declares our GUCs, installs the hooks and registers the writer. The
+ * rings live in shared memory, so the module must be preloaded.
+ */
+void
+_PG_init(void)
+{
+  BackgroundWorker worker;
+
+  if (!process_shared_preload_libraries_in_progress)
+    ereport(ERROR,
+        (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+         errmsg("binary_log must be loaded via shared_preload_libraries")));
+
+  DefineCustomStringVariable("binary_log.directory",
+    gettext_noop("Répertoire des fichiers du journal binaire."),
+    gettext_noop("Un chemin relatif part du répertoire des données."),
+    &log_directory,
+    "log_binary",
+    PGC_SIGHUP,
+    0,
+    NULL, NULL, NULL);
+
+  DefineCustomIntVariable("binary_log.buffer_size",
+    gettext_noop("Taille du tampon circulaire de chaque processus."),
+    NULL,
+    &buffer_size,
+    64,
+    8,
+    MAX_KILOBYTES / 16,
+    PGC_POSTMASTER,
+    GUC_UNIT_KB,
+    NULL, NULL, NULL);
+
+  DefineCustomIntVariable("binary_log.rotation_size",
+    gettext_noop("Taille à partir de laquelle un nouveau fichier est créé."),
+    gettext_noop("0 désactive la rotation sur la taille."),
+    &rotation_size,
+    10 * 1024,
+    0,
+    MAX_KILOBYTES,
+    PGC_SIGHUP,
+    GUC_UNIT_KB,
+    NULL, NULL, NULL);
+
+  DefineCustomIntVariable("binary_log.rotation_age",
+    gettext_noop("Durée après laquelle un nouveau fichier est créé."),
+    gettext_noop("0 désactive la rotation sur la durée."),
+    &rotation_age,
+    60,
+    0,
+    INT_MAX / SECS_PER_MINUTE,
+    PGC_SIGHUP,
+    GUC_UNIT_MIN,
+    NULL, NULL, NULL);
+
+  DefineCustomIntVariable("binary_log.flush_delay",
+    gettext_noop("Délai entre deux vidages des tampons."),
+    NULL,
+    &flush_delay,
+    200,
+    10,
+    10000,
+    PGC_SIGHUP,
+    GUC_UNIT_MS,
+    NULL, NULL, NULL);
+
+  DefineCustomBoolVariable("binary_log.replace_text_log",
+    gettext_noop("N'écrit pas dans le journal texte les messages du journal binaire."),
+    gettext_noop("Les messages qui ne tiennent pas dans le tampon vont toujours dans le journal texte."),
+    &replace_text_log,
+    true,
+    PGC_SUSET,
+    0,
+    NULL, NULL, NULL);
+
+  MarkGUCPrefixReserved("binary_log");
+
+  prev_emit_log_hook = emit_log_hook;
+  emit_log_hook = binary_log_emit_log;
+  prev_shmem_request_hook = shmem_request_hook;
+  shmem_request_hook = binary_log_shmem_request;
+  prev_shmem_startup_hook = shmem_startup_hook;
+  shmem_startup_hook = binary_log_shmem_startup;
+
+  memset(&worker, 0, sizeof(worker));
+  worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+  worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+  worker.bgw_restart_time = 1;
+  strcpy(worker.bgw_library_name, "binary_log");
+  strcpy(worker.bgw_function_name, "binary_log_main");
+  strcpy(worker.bgw_name, "binary_log writer");
+  strcpy(worker.bgw_type, "binary_log writer");
+  RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * One ring per PGPROC, auxiliary processes included, since they log too.
+ */
+static Size
+binary_log_ring_stride(void)
+{
+  return MAXALIGN(offsetof(BinaryLogRing, data) + (Size) buffer_size * 1024);
+}
+
+static Size
+binary_log_shmem_size(void)
+{
+  return add_size(MAXALIGN(sizeof(BinaryLogShared)),
+                  mul_size(MaxBackends + NUM_AUXILIARY_PROCS,
+                           binary_log_ring_stride()));
+}
+
+static BinaryLogRing *
+binary_log_ring(int number)
+{
+  return (BinaryLogRing *) ((char *) shared + MAXALIGN(sizeof(BinaryLogShared))
+                            + number * binary_log_ring_stride());
+}
+
+static void
+binary_log_shmem_request(void)
+{
+  if (prev_shmem_request_hook)
+    prev_shmem_request_hook();
+
+  RequestAddinShmemSpace(binary_log_shmem_size());
+}
+
+static void
+binary_log_shmem_startup(void)
+{
+  bool found;
+
+  if (prev_shmem_startup_hook)
+    prev_shmem_startup_hook();
+
+  LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+  shared = ShmemInitStruct("binary_log", binary_log_shmem_size(), &found);
+  if (!found)
+  {
+    shared->writer_latch = NULL;
+    shared->ring_count = MaxBackends + NUM_AUXILIARY_PROCS;
+    shared->ring_size = (Size) buffer_size * 1024;
+
+    for (int i = 0; i < shared->ring_count; i++)
+    {
+      BinaryLogRing *ring = binary_log_ring(i);
+
+      pg_atomic_init_u64(&ring->write_pos, 0);
+      pg_atomic_init_u64(&ring->read_pos, 0);
+      pg_atomic_init_u64(&ring->overflows, 0);
+      pg_atomic_init_u32(&ring->writing, 0);
+    }
+  }
+
+  LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * binary_log_emit_log
+ *
+ * Copies the message in the ring of the process. When it fits, the text
+ * log is skipped, so that the backend neither formats the line nor waits
+ * on the pipe of the logging collector.
+ */
+static void
+binary_log_emit_log(ErrorData *edata)
+{
+  if (prev_emit_log_hook)
+    prev_emit_log_hook(edata);
+
+  /* the postmaster has no ring, and the writer logs its own errors as text */
+  if (!edata->output_to_server || shared == NULL || MyProc == NULL || is_writer)
+    return;
+
+  if (binary_log_record(edata) && replace_text_log)
+    edata->output_to_server = false;
+}
+
+/*
+ * binary_log_record
+ *
+ * Writes a record in the ring, returns false when it could not. This runs
+ * while an error is being reported, so it must neither allocate memory nor
+ * report errors.
+ */
+static bool
+binary_log_record(ErrorData *edata)
+{
+  BinaryLogRecord record;
+  BinaryLogRing  *ring;
+  Latch          *latch;
+  const char     *message = edata->message ? edata->message : "";
+  const char     *statement = "";
+  const char     *host = "";
+  const char     *application = application_name ? application_name : "";
+  uint64          write_pos;
+  uint64          read_pos;
+  uint32          length;
+
+  if (MyProc->pgprocno >= shared->ring_count)
+    return false;
+  ring = binary_log_ring(MyProc->pgprocno);
+
+  /*
+   * The flag is set before the latch is read: the writer, which clears the
+   * latch before waiting for the flags at shutdown, either waits for this
+   * record or makes us go to the text log.
+   */
+  pg_atomic_write_u32(&ring->writing, 1);
+  pg_memory_barrier();
+  latch = shared->writer_latch;
+  if (latch == NULL)
+  {
+    pg_atomic_write_u32(&ring->writing, 0);
+    return false;
+  }
+
+  memset(&record, 0, sizeof(record));
+  record.duration = -1;
+
+  /* "duration: 1.234 ms  statement: ..." keeps only the statement */
+  if (strncmp(message, "duration: ", 10) == 0)
+  {
+    char   *end;
+    double  milliseconds = strtod(message + 10, &end);
+
+    if (end != message + 10 && strncmp(end, " ms", 3) == 0)
+    {
+      record.duration = (int64) (milliseconds * 1000.0);
+      message = end + 3;
+      while (*message == ' ')
+        message++;
+    }
+  }
+
+  /* like the STATEMENT line of the text log */
+  if (debug_query_string != NULL && !edata->hide_stmt &&
+      binary_log_level_output(edata->elevel, log_min_error_statement))
+    statement = debug_query_string;
+
+  if (MyProcPort != NULL && MyProcPort->remote_host != NULL)
+    host = MyProcPort->remote_host;
+
+  record.pid = MyProcPid;
+  record.timestamp = GetCurrentTimestamp();
+  record.query_id = pgstat_get_my_query_id();
+  record.database = MyProc->databaseId;
+  record.role = MyProc->roleId;
+  record.line_number = ++line_number;
+  record.sqlerrcode = edata->sqlerrcode;
+  record.severity = binary_log_severity(edata->elevel);
+  record.host_length = Min(strlen(host), PG_UINT16_MAX);
+  record.application_length = Min(strlen(application), PG_UINT16_MAX);
+  record.message_length = strlen(message);
+  record.statement_length = strlen(statement);
+
+  length = BINARY_LOG_ALIGN(sizeof(record) + record.host_length +
+                            record.application_length +
+                            record.message_length + record.statement_length);
+  record.length = length;
+
+  /* a record bigger than half the ring would block it, log it as text */
+  write_pos = pg_atomic_read_u64(&ring->write_pos);
+  read_pos = pg_atomic_read_u64(&ring->read_pos);
+  if (length > shared->ring_size / 2 ||
+      shared->ring_size - (write_pos - read_pos) < length)
+  {
+    pg_atomic_fetch_add_u64(&ring->overflows, 1);
+    pg_atomic_write_u32(&ring->writing, 0);
+    SetLatch(latch);
+    return false;
+  }
+
+  /* do not overwrite what the writer may still be reading */
+  pg_memory_barrier();
+
+  ring_copy_in(ring, write_pos, &record, sizeof(record));
+  ring_copy_in(ring, write_pos + sizeof(record), host, record.host_length);
+  ring_copy_in(ring, write_pos + sizeof(record) + record.host_length,
+               application, record.application_length);
+  ring_copy_in(ring, write_pos + sizeof(record) + record.host_length +
+               record.application_length,
+               message, record.message_length);
+  ring_copy_in(ring, write_pos + sizeof(record) + record.host_length +
+               record.application_length + record.message_length,
+               statement, record.statement_length);
+
+  /* the record must be complete before the writer sees it */
+  pg_write_barrier();
+  pg_atomic_write_u64(&ring->write_pos, write_pos + length);
+  pg_memory_barrier();
+  pg_atomic_write_u32(&ring->writing, 0);
+
+  if (write_pos + length - read_pos > shared->ring_size / 2)
+    SetLatch(latch);
+
+  return true;
+}
+
+/*
+ * binary_log_level_output
+ *
+ * Same as is_log_level_output() of elog.c, which is static: LOG ranks
+ * between ERROR and FATAL for the server log.
+ */
+static bool
+binary_log_level_output(int elevel, int log_min_level)
+{
+  if (elevel == LOG || elevel == LOG_SERVER_ONLY)
+    return log_min_level == LOG || log_min_level <= ERROR;
+  if (elevel == WARNING_CLIENT_ONLY)
+    return false;
+  if (log_min_level == LOG)
+    return elevel >= FATAL;
+  return elevel >= log_min_level;
+}
+
+static uint8
+binary_log_severity(int elevel)
+{
+  switch (elevel)
+  {
+    case DEBUG5:
+    case DEBUG4:
+    case DEBUG3:
+    case DEBUG2:
+    case DEBUG1:
+      return BINARY_LOG_DEBUG;
+    case INFO:
+      return BINARY_LOG_INFO;
+    case NOTICE:
+      return BINARY_LOG_NOTICE;
+    case WARNING:
+      return BINARY_LOG_WARNING;
+    case ERROR:
+      return BINARY_LOG_ERROR;
+    case FATAL:
+      return BINARY_LOG_FATAL;
+    case PANIC:
+      return BINARY_LOG_PANIC;
+    default:
+      return BINARY_LOG_LOG;
+  }
+}
+
+/*
+ * ring_copy_in
+ *
+ * Copies data at a position of the ring, wrapping around its end.
+ */
+static void
+ring_copy_in(BinaryLogRing *ring, uint64 pos, const void *data, Size len)
+{
+  Size offset = pos % shared->ring_size;
+  Size first = Min(len, shared->ring_size - offset);
+
+  memcpy(ring->data + offset, data, first);
+  memcpy(ring->data, (const char *) data + first, len - first);
+}
+
+/*
+ * binary_log_main
+ *
+ * Main loop of the writer: drains the rings into the current file every
+ * flush_delay, or sooner when a ring is half full, and rotates the file.
+ */
+void
+binary_log_main(Datum main_arg)
+{
+  pqsignal(SIGHUP, SignalHandlerForConfigReload);
+  pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+  BackgroundWorkerUnblockSignals();
+
+  is_writer = true;
+  write_buffer = palloc(WRITE_BUFFER_SIZE);
+  open_log_file();
+
+  before_shmem_exit(binary_log_writer_exit, 0);
+  shared->writer_latch = MyLatch;
+
+  for (;;)
+  {
+    bool      shutdown;
+    pg_time_t now;
+
+    ResetLatch(MyLatch);
+
+    if (ConfigReloadPending)
+    {
+      ConfigReloadPending = false;
+      ProcessConfigFile(PGC_SIGHUP);
+    }
+
+    /*
+     * On shutdown, processes go back to the text log before the last
+     * drain. The records started before they saw it are waited for, so
+     * that nothing is left behind in the rings.
+     */
+    shutdown = ShutdownRequestPending;
+    if (shutdown)
+    {
+      shared->writer_latch = NULL;
+      pg_memory_barrier();
+
+      for (int i = 0; i < shared->ring_count; i++)
+      {
+        while (pg_atomic_read_u32(&binary_log_ring(i)->writing) != 0)
+          pg_usleep(1000L);
+      }
+      pg_read_barrier();
+    }
+
+    drain_rings();
+
+    if (shutdown)
+      break;
+
+    now = (pg_time_t) time(NULL);
+    if ((rotation_size > 0 && current_size >= (Size) rotation_size * 1024) ||
+        (rotation_age > 0 && now - current_opened_at >= rotation_age * SECS_PER_MINUTE))
+    {
+      close_log_file();
+      open_log_file();
+    }
+
+    (void) WaitLatch(MyLatch,
+                     WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                     flush_delay,
+                     PG_WAIT_EXTENSION);
+  }
+
+  close_log_file();
+  proc_exit(0);
+}
+
+static void
+binary_log_writer_exit(int code, Datum arg)
+{
+  shared->writer_latch = NULL;
+}
+
+/*
+ * drain_rings
+ *
+ * Copies the records of every ring into the write buffer, which is written
+ * whenever it is full, and once at the end.
+ */
+static void
+drain_rings(void)
+{
+  uint64 overflows = 0;
+
+  for (int i = 0; i < shared->ring_count; i++)
+  {
+    BinaryLogRing *ring = binary_log_ring(i);
+    uint64         write_pos = pg_atomic_read_u64(&ring->write_pos);
+    uint64         read_pos = pg_atomic_read_u64(&ring->read_pos);
+
+    overflows += pg_atomic_read_u64(&ring->overflows);
+
+    if (read_pos == write_pos)
+      continue;
+
+    /* the records must not be read before write_pos */
+    pg_read_barrier();
+
+    while (read_pos < write_pos)
+    {
+      Size offset = read_pos % shared->ring_size;
+      Size len = Min(write_pos - read_pos, shared->ring_size - offset);
+
+      len = Min(len, WRITE_BUFFER_SIZE - write_buffered);
+      memcpy(write_buffer + write_buffered, ring->data + offset, len);
+      write_buffered += len;
+      read_pos += len;
+
+      if (write_buffered == WRITE_BUFFER_SIZE)
+        flush_write_buffer();
+    }
+
+    /* the records must be copied before the process may overwrite them */
+    pg_memory_barrier();
+    pg_atomic_write_u64(&ring->read_pos, read_pos);
+  }
+
+  flush_write_buffer();
+
+  if (overflows > reported_overflows)
+  {
+    ereport(LOG,
+        (errmsg("%llu messages did not fit in the binary_log buffers and went to the text log",
+                (unsigned long long) (overflows - reported_overflows)),
+         errhint("Consider increasing binary_log.buffer_size or decreasing binary_log.flush_delay.")));
+    reported_overflows = overflows;
+  }
+}
+
+static void
+flush_write_buffer(void)
+{
+  write_all(write_buffer, write_buffered);
+  current_size += write_buffered;
+  write_buffered = 0;
+}
+
+static void
+write_all(const char *data, Size len)
+{
+  while (len > 0)
+  {
+    ssize_t written = write(current_fd, data, len);
+
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      ereport(ERROR,
+          (errcode_for_file_access(),
+           errmsg("could not write to file \"%s\": %m", current_path)));
+    }
+    data += written;
+    len -= written;
+  }
+}
+
+/*
+ * open_log_file
+ *
+ * Creates a new file, named after the current time. Files created in the
+ * same second get a sequence number, so that their names sort in order.
+ */
+static void
+open_log_file(void)
+{
+  BinaryLogFileHeader header;
+  char      name[MAXPGPATH];
+  pg_time_t now = (pg_time_t) time(NULL);
+
+  if (MakePGDirectory(log_directory) < 0 && errno != EEXIST)
+    ereport(ERROR,
+        (errcode_for_file_access(),
+         errmsg("could not create directory \"%s\": %m", log_directory)));
+
+  pg_strftime(name, sizeof(name), "binary_log-%Y%m%d-%H%M%S",
+              pg_localtime(&now, log_timezone));
+
+  for (int sequence = 0;; sequence++)
+  {
+    snprintf(current_path, sizeof(current_path), "%s/%s-%03d.bin",
+             log_directory, name, sequence);
+    current_fd = OpenTransientFile(current_path,
+                                   O_WRONLY | O_CREAT | O_EXCL | PG_BINARY);
+    if (current_fd >= 0)
+      break;
+    if (errno != EEXIST)
+      ereport(ERROR,
+          (errcode_for_file_access(),
+           errmsg("could not create file \"%s\": %m", current_path)));
+  }
+
+  memcpy(header.magic, BINARY_LOG_MAGIC, sizeof(header.magic));
+  header.version = BINARY_LOG_VERSION;
+  write_all((const char *) &header, sizeof(header));
+
+  current_size = sizeof(header);
+  current_opened_at = now;
+}
+
+static void
+close_log_file(void)
+{
+  if (current_fd < 0)
+    return;
+
+  if (CloseTransientFile(current_fd) != 0)
+    ereport(LOG,
+        (errcode_for_file_access(),
+         errmsg("could not close file \"%s\": %m", current_path)));
+  current_fd = -1;
+}
@@ -0,0 +1,59 @@
+/*
+ * binary_log.h
+ *
+ * Format of the files written by the binary_log module, shared with the
+ * binary_log_decode tool.
+ *
+ * A file starts with a BinaryLogFileHeader, followed by records. Each
+ * record is a BinaryLogRecord followed by the host, the application name,
+ * the message and the statement, without terminating zero bytes, and padded
+ * so that the next record starts on a multiple of 8 bytes. All integers use
+ * the byte order of the server.
+ */
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+#define BINARY_LOG_MAGIC    "PGBL"
+#define BINARY_LOG_VERSION  1
+
+#define BINARY_LOG_ALIGN(len)  (((len) + 7) & ~((uint32) 7))
+
+typedef struct BinaryLogFileHeader
+{
+  char    magic[4];
+  uint32  version;
+} BinaryLogFileHeader;
+
+/* severities, independent of the elevel values of a given release */
+typedef enum BinaryLogSeverity
+{
+  BINARY_LOG_DEBUG,
+  BINARY_LOG_LOG,
+  BINARY_LOG_INFO,
+  BINARY_LOG_NOTICE,
+  BINARY_LOG_WARNING,
+  BINARY_LOG_ERROR,
+  BINARY_LOG_FATAL,
+  BINARY_LOG_PANIC
+} BinaryLogSeverity;
+
+typedef struct BinaryLogRecord
+{
+  uint32  length;             /* of the whole record, padding included */
+  int32   pid;
+  int64   timestamp;          /* TimestampTz, µs since 2000-01-01 */
+  int64   duration;           /* µs, -1 if not a "duration:" message */
+  uint64  query_id;
+  Oid     database;
+  Oid     role;
+  int32   line_number;        /* per process, like %l */
+  int32   sqlerrcode;         /* packed like MAKE_SQLSTATE() */
+  uint32  message_length;
+  uint32  statement_length;
+  uint16  host_length;
+  uint16  application_length;
+  uint8   severity;           /* a BinaryLogSeverity */
+  uint8   reserved[3];
+} BinaryLogRecord;
+
+#endif                          /* BINARY_LOG_H */
@@ -0,0 +1,350 @@
+/*
+ * binary_log_decode, renders the files of the binary_log module as a text
+ * log
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <time.h>
+#include "postgres_fe.h"
+#include "common/logging.h"
+#include "fe_utils/connect_utils.h"
+#include "fe_utils/option_utils.h"
+#include "getopt_long.h"
+
+#include "binary_log.h"
+
+/* the log_line_prefix of journee3.conf */
+#define DEFAULT_PREFIX "h=%h;u=%u;d=%d;a=%a;p=%p;l=%l "
+
+/* seconds between the Unix epoch and the PostgreSQL one */
+#define POSTGRES_EPOCH_OFFSET INT64CONST(946684800)
+
+static const char *const severities[] = {
+  "DEBUG", "LOG", "INFO", "NOTICE", "WARNING", "ERROR", "FATAL", "PANIC"
+};
+
+static PGresult *databases = NULL;
+static PGresult *roles = NULL;
+
+static void help(const char *progname);
+static bool decode_file(const char *path, const char *prefix);
+static void print_prefix(const char *prefix, const BinaryLogRecord *record,
+                         const char *host, const char *application);
+static void print_name(PGresult *names, Oid oid);
+static void print_timestamp(int64 timestamp, bool milliseconds);
+
+int
+main(int argc, char **argv)
+{
+  const char   *progname;
+  PGconn     *conn;
+  ConnParams  cparams;
+  static struct option long_options[] = {
+    {"prefix", required_argument, NULL, 'P'},
+    {"dbname", required_argument, NULL, 'd'},
+    {"host", required_argument, NULL, 'h'},
+    {"port", required_argument, NULL, 'p'},
+    {"username", required_argument, NULL, 'U'},
+    {NULL, 0, NULL, 0}
+  };
+  int           optindex;
+  int           c;
+  char         *prefix = DEFAULT_PREFIX;
+  char         *dbname = NULL;
+  char         *host = NULL;
+  char         *port = NULL;
+  char         *username = NULL;
+  bool          ok = true;
+
+  pg_logging_init(argv[0]);
+  progname = get_progname(argv[0]);
+
+  handle_help_version_opts(argc, argv, "binary_log_decode", help);
+
+  while ((c = getopt_long(argc, argv, "d:h:p:P:U:", long_options, &optindex)) != -1)
+  {
+    switch (c)
+    {
+      case 'd':
+        dbname = pg_strdup(optarg);
+        break;
+      case 'h':
+        host = pg_strdup(optarg);
+        break;
+      case 'p':
+        port = pg_strdup(optarg);
+        break;
+      case 'P':
+        prefix = pg_strdup(optarg);
+        break;
+      case 'U':
+        username = pg_strdup(optarg);
+        break;
+      case 0:
+        /* this covers the long options */
+        break;
+      default:
+        /* getopt_long already emitted a complaint */
+        pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+        exit(1);
+    }
+  }
+
+  if (optind >= argc)
+  {
+    pg_log_error("missing required argument file");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  // Records only hold OIDs, a connection gives back the names
+
+  if (dbname)
+  {
+    cparams.dbname = dbname;
+    cparams.pghost = host;
+    cparams.pgport = port;
+    cparams.pguser = username;
+    cparams.prompt_password = TRI_DEFAULT;
+    cparams.override_dbname = NULL;
+
+    conn = connectDatabase(&cparams, progname, false, false, false);
+
+    databases = PQexec(conn, "SELECT oid, datname FROM pg_database");
+    roles = PQexec(conn, "SELECT oid, rolname FROM pg_roles");
+    if (PQresultStatus(databases) != PGRES_TUPLES_OK ||
+        PQresultStatus(roles) != PGRES_TUPLES_OK)
+    {
+      pg_log_error("could not read the names: %s", PQerrorMessage(conn));
+      PQfinish(conn);
+      exit(1);
+    }
+
+    PQfinish(conn);
+  }
+
+  for (; optind < argc; optind++)
+    ok &= decode_file(argv[optind], prefix);
+
+  exit(ok ? 0 : 1);
+}
+
+/*
+ * decode_file
+ *
+ * Prints the records of a file. The last record of the file being written
+ * may be incomplete, it is skipped with a warning.
+ */
+static bool
+decode_file(const char *path, const char *prefix)
+{
+  FILE       *file;
+  BinaryLogFileHeader header;
+  BinaryLogRecord record;
+  char       *data = NULL;
+  size_t      data_size = 0;
+
+  file = fopen(path, PG_BINARY_R);
+  if (file == NULL)
+  {
+    pg_log_error("could not open file \"%s\": %m", path);
+    return false;
+  }
+
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, BINARY_LOG_MAGIC, sizeof(header.magic)) != 0)
+  {
+    pg_log_error("\"%s\" is not a binary_log file", path);
+    fclose(file);
+    return false;
+  }
+  if (header.version != BINARY_LOG_VERSION)
+  {
+    pg_log_error("file \"%s\" has version %u, expected %u",
+                 path, header.version, BINARY_LOG_VERSION);
+    fclose(file);
+    return false;
+  }
+
+  while (fread(&record, sizeof(record), 1, file) == 1)
+  {
+    const char *host;
+    const char *application;
+    const char *message;
+    const char *statement;
+    size_t      length;
+
+    if (record.length < sizeof(record) || record.severity >= lengthof(severities))
+    {
+      pg_log_error("invalid record in file \"%s\"", path);
+      fclose(file);
+      return false;
+    }
+
+    length = record.length - sizeof(record);
+    if (length + 1 > data_size)
+    {
+      data_size = length + 1;
+      data = pg_realloc(data, data_size);
+    }
+    if (fread(data, 1, length, file) != length)
+    {
+      pg_log_warning("incomplete record at the end of file \"%s\"", path);
+      break;
+    }
+
+    host = data;
+    application = host + record.host_length;
+    message = application + record.application_length;
+    statement = message + record.message_length;
+
+    print_prefix(prefix, &record, host, application);
+    printf("%s:  ", severities[record.severity]);
+    if (record.duration >= 0)
+    {
+      printf("duration: %.3f ms", record.duration / 1000.0);
+      if (record.message_length > 0)
+        printf("  ");
+    }
+    printf("%.*s\n", (int) record.message_length, message);
+
+    if (record.statement_length > 0)
+    {
+      print_prefix(prefix, &record, host, application);
+      printf("STATEMENT:  %.*s\n", (int) record.statement_length, statement);
+    }
+  }
+
+  pg_free(data);
+  fclose(file);
+  return true;
+}
+
+/*
+ * print_prefix
+ *
+ * Prints the prefix of a line, with the escapes of log_line_prefix that a
+ * record can fill.
+ */
+static void
+print_prefix(const char *prefix, const BinaryLogRecord *record,
+             const char *host, const char *application)
+{
+  for (const char *p = prefix; *p; p++)
+  {
+    if (*p != '%' || p[1] == '\0')
+    {
+      putchar(*p);
+      continue;
+    }
+
+    switch (*++p)
+    {
+      case 'a':
+        printf("%.*s", record->application_length, application);
+        break;
+      case 'u':
+        print_name(roles, record->role);
+        break;
+      case 'd':
+        print_name(databases, record->database);
+        break;
+      case 'h':
+        printf("%.*s", record->host_length, host);
+        break;
+      case 'p':
+        printf("%d", record->pid);
+        break;
+      case 'l':
+        printf("%d", record->line_number);
+        break;
+      case 't':
+        print_timestamp(record->timestamp, false);
+        break;
+      case 'm':
+        print_timestamp(record->timestamp, true);
+        break;
+      case 'n':
+        printf("%lld.%03d",
+               (long long) (record->timestamp / 1000000 + POSTGRES_EPOCH_OFFSET),
+               (int) (record->timestamp % 1000000 / 1000));
+        break;
+      case 'e':
+        for (int i = 0; i < 5; i++)
+          putchar(((record->sqlerrcode >> (6 * i)) & 0x3F) + '0');
+        break;
+      case 'Q':
+        printf("%lld", (long long) record->query_id);
+        break;
+      case '%':
+        putchar('%');
+        break;
+      default:
+        /* like the server, unknown escapes are ignored */
+        break;
+    }
+  }
+}
+
+/*
+ * print_name
+ *
+ * Prints the name of an OID when the names were read, the OID otherwise.
+ */
+static void
+print_name(PGresult *names, Oid oid)
+{
+  if (oid == InvalidOid)
+    return;
+
+  if (names != NULL)
+  {
+    for (int i = 0; i < PQntuples(names); i++)
+    {
+      if (atooid(PQgetvalue(names, i, 0)) == oid)
+      {
+        printf("%s", PQgetvalue(names, i, 1));
+        return;
+      }
+    }
+  }
+
+  printf("%u", oid);
+}
+
+static void
+print_timestamp(int64 timestamp, bool milliseconds)
+{
+  time_t     seconds = (time_t) (timestamp / 1000000 + POSTGRES_EPOCH_OFFSET);
+  struct tm *tm = localtime(&seconds);
+  char       buffer[128];
+
+  strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", tm);
+  printf("%s", buffer);
+  if (milliseconds)
+    printf(".%03d", (int) (timestamp % 1000000 / 1000));
+  strftime(buffer, sizeof(buffer), " %Z", tm);
+  printf("%s", buffer);
+}
+
+static void
+help(const char *progname)
+{
+	printf("%s renders the files of binary_log as a text log.\n\n", progname);
+	printf("Usage:\n");
+	printf("  %s [OPTION]... FILE...\n", progname);
+	printf("\nOptions:\n");
+	printf("  -P, --prefix=PREFIX       line prefix, like log_line_prefix\n");
+	printf("                            (default: \"%s\")\n", DEFAULT_PREFIX);
+	printf("  -V, --version             output version information, then exit\n");
+	printf("  -?, --help                show this help, then exit\n");
+	printf("\nConnection options, to print names instead of OIDs:\n");
+	printf("  -d, --dbname=DBNAME       database name\n");
+	printf("  -h, --host=HOSTNAME       database server host or socket directory\n");
+	printf("  -p, --port=PORT           database server port\n");
+	printf("  -U, --username=USERNAME   user name to connect as\n");
+}